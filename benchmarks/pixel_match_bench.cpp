@@ -0,0 +1,208 @@
+// Benchmark of the ImageSearch/PixelSearch kernels in source/lib/pixel_match.cpp on synthetic
+// screenshots.  The kernels have no Windows dependencies, so this builds on Linux or Windows:
+//
+//   g++ -std=c++14 -O2 -pthread -I../source/lib pixel_match_bench.cpp ../source/lib/pixel_match.cpp -o pixel_match_bench
+//   cl /O2 /EHsc /I..\source\lib pixel_match_bench.cpp ..\source\lib\pixel_match.cpp
+//
+// Each case is searched with the kernels (with and without AVX2) and with a naive search which
+// anchors on the needle's top-left pixel, as ImageSearch did originally.  All searches must return
+// the same position.  PixelRangeFindAll() is compared with calling the naive search from each
+// position after the previous match, as ImageSearchAll did originally.
+
+#include "pixel_match.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static uint32_t sSeed = 12345;
+static uint32_t Random()
+{
+	sSeed = sSeed * 1103515245 + 12345;
+	return sSeed >> 8;
+}
+
+// A desktop-like screenshot: a flat background with windows, each with a title bar, a body of a
+// lighter flat color and rows of "text" (short runs of dark pixels).
+static std::vector<uint32_t> MakeScreen(int aWidth, int aHeight)
+{
+	std::vector<uint32_t> screen(aWidth * aHeight, 0x003A6EA5);
+	for (int w = 0; w < 12; ++w)
+	{
+		int left = Random() % (aWidth - 200), top = Random() % (aHeight - 150);
+		int right = left + 200 + Random() % (aWidth / 2), bottom = top + 150 + Random() % (aHeight / 2);
+		if (right > aWidth) right = aWidth;
+		if (bottom > aHeight) bottom = aHeight;
+		for (int y = top; y < bottom; ++y)
+		{
+			uint32_t *row = &screen[y * aWidth];
+			bool title = y < top + 24;
+			bool text_row = !title && (y - top) % 16 < 9;
+			for (int x = left; x < right; ++x)
+				row[x] = title ? 0x00F0F0F0 : 0x00FFFFFF;
+			if (text_row)
+				for (int x = left + 8; x < right - 8; x += 6)
+					if (Random() % 3)
+						for (int i = 0; i < 4; ++i)
+							row[x + i] = 0x00101010 + (Random() % 0x20) * 0x010101;
+		}
+	}
+	// Screen pixels sometimes have a non-zero high-order byte, which is ignored.
+	for (size_t i = 0; i < screen.size(); i += 7)
+		screen[i] |= 0xFF000000;
+	return screen;
+}
+
+static std::vector<uint32_t> Cut(const std::vector<uint32_t> &aScreen, int aScreenWidth, int aX, int aY, int aWidth, int aHeight)
+{
+	std::vector<uint32_t> image(aWidth * aHeight);
+	for (int y = 0; y < aHeight; ++y)
+		for (int x = 0; x < aWidth; ++x)
+			image[y * aWidth + x] = aScreen[(aY + y) * aScreenWidth + aX + x] & 0x00FFFFFF;
+	return image;
+}
+
+static bool InRange(uint32_t aPixel, uint32_t aLow, uint32_t aHigh)
+{
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		uint32_t c = (aPixel >> shift) & 0xFF;
+		if (c < ((aLow >> shift) & 0xFF) || c > ((aHigh >> shift) & 0xFF))
+			return false;
+	}
+	return true;
+}
+
+static int32_t NaiveFind(const PixelRange &aNeedle, const uint32_t *aHaystack, int32_t aWidth, int32_t aHeight, int32_t aStart = 0)
+{
+	for (int32_t y = aStart / aWidth; y + aNeedle.height <= aHeight; ++y)
+		for (int32_t x = y == aStart / aWidth ? aStart % aWidth : 0; x + aNeedle.width <= aWidth; ++x)
+		{
+			if (!InRange(aHaystack[y * aWidth + x], aNeedle.low[0], aNeedle.high[0]))
+				continue;
+			bool match = true;
+			for (int32_t j = 0; j < aNeedle.height && match; ++j)
+				for (int32_t i = 0; i < aNeedle.width; ++i)
+					if (!InRange(aHaystack[(y + j) * aWidth + x + i], aNeedle.low[j * aNeedle.width + i], aNeedle.high[j * aNeedle.width + i]))
+					{
+						match = false;
+						break;
+					}
+			if (match)
+				return y * aWidth + x;
+		}
+	return -1;
+}
+
+template<typename F> static double TimeMs(int aRepeat, F aSearch, int32_t &aFound)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < aRepeat; ++r)
+		aFound = aSearch();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / aRepeat;
+}
+
+static bool CpuHasAVX2()
+{
+#if defined(__GNUC__)
+	return __builtin_cpu_supports("avx2");
+#else
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0; // Assumes the OS saves AVX state, as on all current versions.
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+	int repeat = argc > 1 ? atoi(argv[1]) : 5;
+	bool avx2 = CpuHasAVX2();
+	printf("%-34s %10s %10s %10s %8s\n", "case", "naive ms", "sse2 ms", avx2 ? "avx2 ms" : "(no avx2)", "speedup");
+	struct Size { int width, height; } sizes[] = { { 1920, 1080 }, { 3840, 2160 } };
+	for (auto &size : sizes)
+	{
+		int w = size.width, h = size.height;
+		sSeed = 12345 + w; // Each screen is the same regardless of which other cases are run.
+		auto screen = MakeScreen(w, h);
+		// A 32x32 needle near the bottom-right, so most of the screen is searched.
+		int nx = w - 300, ny = h - 120;
+		auto needle_pixels = Cut(screen, w, nx, ny, 32, 32);
+		// The same needle with its background-colored pixels transparent, as with *TransN.
+		auto mask = std::vector<uint32_t>(32 * 32);
+		for (size_t i = 0; i < mask.size(); ++i)
+			mask[i] = needle_pixels[i] == 0x00FFFFFF;
+		// A needle which doesn't occur, so that the whole screen is searched.
+		auto absent = needle_pixels;
+		absent[absent.size() - 1] ^= 0x00808080;
+
+		struct Case { const char *name; const uint32_t *pixels, *mask; int variation; } cases[] = {
+			{ "exact", needle_pixels.data(), nullptr, 0 },
+			{ "variation 16", needle_pixels.data(), nullptr, 16 },
+			{ "transparent background", needle_pixels.data(), mask.data(), 0 },
+			{ "not found", absent.data(), nullptr, 0 },
+		};
+		for (auto &c : cases)
+		{
+			PixelRange needle;
+			if (!PixelRangeInit(needle, c.pixels, c.mask, 32, 32, 0xFFFFFFFF, c.variation, 0x00FFFFFF))
+				return 1;
+			int32_t naive = -1, sse2 = -1, fast = -1;
+			double naive_ms = TimeMs(repeat, [&] { return NaiveFind(needle, screen.data(), w, h); }, naive);
+			double sse2_ms = TimeMs(repeat, [&] { return PixelRangeFind(needle, screen.data(), w, h, false); }, sse2);
+			double fast_ms = avx2 ? TimeMs(repeat, [&] { return PixelRangeFind(needle, screen.data(), w, h, true); }, fast) : sse2_ms;
+			if (!avx2)
+				fast = sse2;
+			char name[64];
+			snprintf(name, sizeof(name), "%dx%d %s", w, h, c.name);
+			printf("%-34s %10.3f %10.3f %10.3f %7.1fx%s\n", name, naive_ms, sse2_ms, fast_ms
+				, naive_ms / (fast_ms < sse2_ms ? fast_ms : sse2_ms)
+				, naive == sse2 && sse2 == fast ? "" : "  MISMATCH");
+			PixelRangeFree(needle);
+		}
+		// PixelSearch for a color which occurs only in the last pixel.
+		uint32_t color = 0x00123456;
+		screen[(h - 1) * w + w - 1] = color;
+		int32_t found = -1;
+		double ms = TimeMs(repeat * 10, [&] { return PixelFind(screen.data(), w, h, color, color | 0xFF000000, false, false); }, found);
+		char name[64];
+		snprintf(name, sizeof(name), "%dx%d PixelFind, last pixel", w, h);
+		printf("%-34s %10s %10.3f%s\n", name, "", ms, found == w * h - 1 ? "" : "  MISMATCH");
+
+		// Every occurrence of an 8x8 icon stamped at 200 positions.
+		auto icon = Cut(screen, w, nx, ny, 8, 8);
+		icon[0] = 0x00ABCDEF;
+		for (int i = 0; i < 200; ++i)
+		{
+			int x = Random() % (w - 8), y = Random() % (h - 8);
+			for (int j = 0; j < 8; ++j)
+				memcpy(&screen[(y + j) * w + x], &icon[j * 8], 8 * sizeof(uint32_t));
+		}
+		PixelRange needle;
+		if (!PixelRangeInit(needle, icon.data(), nullptr, 8, 8, 0xFFFFFFFF, 0, 0x00FFFFFF))
+			return 1;
+		std::vector<int32_t> naive_all, all;
+		double naive_ms = TimeMs(repeat, [&] {
+			naive_all.clear();
+			for (int32_t i = 0; (i = NaiveFind(needle, screen.data(), w, h, i)) >= 0; ++i)
+				naive_all.push_back(i);
+			return 0;
+		}, found);
+		double all_ms = TimeMs(repeat, [&] {
+			all.clear();
+			PixelRangeFindAll(needle, screen.data(), w, h, avx2, 0, all);
+			return 0;
+		}, found);
+		snprintf(name, sizeof(name), "%dx%d FindAll, %d matches", w, h, (int)all.size());
+		printf("%-34s %10.3f %10s %10.3f %7.1fx%s\n", name, naive_ms, "", all_ms, naive_ms / all_ms
+			, naive_all == all ? "" : "  MISMATCH");
+		PixelRangeFree(needle);
+	}
+	return 0;
+}
@@ -0,0 +1,213 @@
+// Test and benchmark of WebSocketFrameParser in source/websocket_frame.cpp.  The parser has no
+// Windows dependencies, so this builds on Linux or Windows:
+//
+//   g++ -std=c++14 -O2 -I../source websocket_parser_bench.cpp ../source/websocket_frame.cpp -o websocket_parser_bench
+//   cl /O2 /EHsc /I..\source websocket_parser_bench.cpp ..\source\websocket_frame.cpp
+//
+// A stream of generated frames (masked and unmasked, with 7-, 16- and 64-bit lengths, messages
+// fragmented into continuation frames with control frames interleaved) is fed to the parser in
+// pieces split at random boundaries, as recv() would return them.  Messages are reassembled as
+// WebSocketClient does, and everything received must match what was sent.  The stream is then
+// corrupted at random and parsed again, which must neither crash nor yield an oversized frame.
+
+#include "websocket_frame.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static uint32_t sSeed = 12345;
+static uint32_t Random()
+{
+	sSeed = sSeed * 1103515245 + 12345;
+	return sSeed >> 8;
+}
+
+// A data message or control frame, as the receiver should see it.
+struct Event
+{
+	uint8_t opcode;
+	std::string data;
+	bool operator==(const Event &aOther) const { return opcode == aOther.opcode && data == aOther.data; }
+};
+
+static void AppendFrame(std::string &aStream, bool aFin, uint8_t aOpcode, const char *aData, size_t aLen, bool aMasked)
+{
+	aStream += (char)((aFin ? 0x80 : 0) | aOpcode);
+	char mask_bit = aMasked ? (char)0x80 : 0;
+	if (aLen < 126)
+		aStream += (char)(aLen | mask_bit);
+	else if (aLen < 65536)
+	{
+		aStream += (char)(126 | mask_bit);
+		aStream += (char)(aLen >> 8);
+		aStream += (char)aLen;
+	}
+	else
+	{
+		aStream += (char)(127 | mask_bit);
+		for (int i = 7; i >= 0; --i)
+			aStream += (char)((uint64_t)aLen >> (i * 8));
+	}
+	size_t offset = aStream.size();
+	if (aMasked)
+	{
+		uint8_t key[4];
+		for (auto &k : key)
+			k = (uint8_t)Random();
+		aStream.append((const char *)key, 4);
+		aStream.append(aData, aLen);
+		uint8_t *payload = (uint8_t *)&aStream[offset + 4];
+		websocket_mask(payload, payload, aLen, key);
+	}
+	else
+		aStream.append(aData, aLen);
+}
+
+static std::string RandomData(size_t aLen)
+{
+	std::string data(aLen, '\0');
+	for (auto &c : data)
+		c = (char)Random();
+	return data;
+}
+
+static size_t RandomMessageLength(bool aShort)
+{
+	switch (aShort ? 9 : Random() % 10)
+	{
+	case 0: return 65536 + Random() % 200000; // 64-bit length.
+	case 1: case 2: case 3: return 126 + Random() % (65536 - 126); // 16-bit length.
+	default: return Random() % 126; // 7-bit length.
+	}
+}
+
+// Generates about aBytes of frames, and the events they should produce.  If aShort is true, all
+// payloads have 7-bit lengths.
+static std::string MakeStream(size_t aBytes, bool aShort, std::vector<Event> &aEvents)
+{
+	std::string stream;
+	while (stream.size() < aBytes)
+	{
+		Event message { (uint8_t)(Random() % 2 ? 0x1 : 0x2), RandomData(RandomMessageLength(aShort)) };
+		int fragments = Random() % 3 ? 1 : 2 + Random() % 4;
+		size_t sent = 0;
+		for (int f = 0; f < fragments; ++f)
+		{
+			bool fin = f == fragments - 1;
+			size_t len = fin ? message.data.size() - sent : Random() % (message.data.size() - sent + 1);
+			AppendFrame(stream, fin, f ? 0x0 : message.opcode, message.data.data() + sent, len, Random() % 2 != 0);
+			sent += len;
+			if (!fin && Random() % 3 == 0)
+			{
+				// Control frames may appear between the fragments of a message.
+				Event control { (uint8_t)(Random() % 2 ? 0x9 : 0xA), RandomData(Random() % 126) };
+				AppendFrame(stream, true, control.opcode, control.data.data(), control.data.size(), Random() % 2 != 0);
+				aEvents.push_back(std::move(control));
+			}
+		}
+		aEvents.push_back(std::move(message));
+	}
+	return stream;
+}
+
+// Feeds aStream to a parser in pieces of 1 to aMaxChunk bytes and reassembles messages as
+// WebSocketClient::process_frames does.  Returns false on a protocol error.
+static bool Parse(const std::string &aStream, size_t aMaxChunk, std::vector<Event> &aEvents)
+{
+	WebSocketFrameParser parser;
+	WebSocketFrameParser::Frame frame;
+	Event message { 0, std::string() };
+	for (size_t pos = 0; pos < aStream.size(); )
+	{
+		size_t chunk = 1 + Random() % aMaxChunk;
+		if (chunk > aStream.size() - pos)
+			chunk = aStream.size() - pos;
+		parser.Feed(aStream.data() + pos, chunk);
+		pos += chunk;
+		WebSocketFrameParser::Result result;
+		while ((result = parser.Next(frame)) == WebSocketFrameParser::Complete)
+		{
+			if (frame.opcode & 0x8)
+			{
+				if (frame.payload.size() > 125)
+					return false;
+				aEvents.push_back({ frame.opcode, std::move(frame.payload) });
+				continue;
+			}
+			if (frame.opcode == 0x0)
+			{
+				if (!message.opcode || message.data.size() + frame.payload.size() > WebSocketFrameParser::MaxPayload)
+					return false;
+				message.data += frame.payload;
+			}
+			else
+			{
+				if (message.opcode)
+					return false;
+				message.opcode = frame.opcode;
+				message.data = std::move(frame.payload);
+			}
+			if (frame.fin)
+			{
+				aEvents.push_back(std::move(message));
+				message = { 0, std::string() };
+			}
+		}
+		if (result == WebSocketFrameParser::ProtocolError)
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t megabytes = argc > 1 ? atoi(argv[1]) : 64;
+	std::vector<Event> sent;
+	std::string stream = MakeStream(megabytes * 1000000, false, sent);
+	printf("%.1f MB, %d messages and control frames\n", stream.size() / 1e6, (int)sent.size());
+	printf("%-24s %10s %10s\n", "pieces", "ms", "MB/s");
+	struct Case { const char *name; size_t max_chunk; } cases[] = {
+		{ "whole stream", stream.size() },
+		{ "1 to 64K bytes", 65536 },
+		{ "1 to 1460 bytes", 1460 }, // Up to one TCP segment.
+		{ "1 to 16 bytes", 16 },
+	};
+	bool ok = true;
+	for (auto &c : cases)
+	{
+		std::vector<Event> received;
+		received.reserve(sent.size());
+		auto start = std::chrono::steady_clock::now();
+		bool parsed = Parse(stream, c.max_chunk, received);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		bool match = parsed && received == sent;
+		ok = ok && match;
+		printf("%-24s %10.1f %10.1f%s\n", c.name, ms, stream.size() / 1000.0 / ms, match ? "" : "  MISMATCH");
+	}
+
+	// Corrupt a few bits of a stream of short frames, so that headers are often hit.  Whatever the
+	// parser makes of it, every frame it returns must be within the limits it enforces.
+	int errors = 0, runs = 2000;
+	std::vector<Event> unused;
+	std::string clean = MakeStream(100000, true, unused);
+	for (int r = 0; r < runs; ++r)
+	{
+		std::string corrupt = clean;
+		for (int i = 1 + Random() % 8; i > 0; --i)
+			corrupt[Random() % corrupt.size()] ^= (char)(1 << (Random() % 8));
+		std::vector<Event> received;
+		if (!Parse(corrupt, 1 + Random() % 4096, received))
+			++errors;
+		for (auto &e : received)
+			if (e.data.size() > WebSocketFrameParser::MaxPayload)
+			{
+				printf("corrupt stream yielded an oversized message\n");
+				ok = false;
+			}
+	}
+	printf("%d corrupted streams parsed, %d rejected as protocol errors\n", runs, errors);
+	return ok ? 0 : 1;
+}
@@ -20,6 +20,7 @@ GNU General Public License for more details.
 #include "window.h" // For MsgBox()
 #include "TextIO.h"
 #include "simple_threading.h"
+#include "profiler.h"
 
 // General note:
 // The use of Sleep() should be avoided *anywhere* in the code.  Instead, call MsgSleep().
@@ -184,6 +185,10 @@ ResultType ParseCmdLineArgs(LPTSTR &script_filespec)
 			}
 			// The actual debug session is initiated after the script is successfully parsed.
 		}
+#endif
+#ifdef CONFIG_PROFILER
+		else if (!_tcsnicmp(param, _T("/Profile"), 8) && (param[8] == '\0' || param[8] == '='))
+			g_Profiler.Enable(param[8] == '=' ? param + 9 : NULL);
 #endif
 		else // since this is not a recognized switch, the end of the [Switches] section has been reached (by design).
 		{
@@ -299,6 +304,11 @@ int MainExecuteScript(bool aMsgSleep)
 		g_Debugger.Break();
 	}
 #endif
+#ifdef CONFIG_PROFILER
+	// Start sampling now that the script is loaded, so that only its execution is profiled.
+	if (g_Profiler.IsEnabled())
+		g_Profiler.Start();
+#endif
 
 	// Initialize simple threading system
 	g_SimpleThreading.IncrementThreadCount();
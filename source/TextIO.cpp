@@ -3,6 +3,7 @@
 #include "script.h"
 #include "script_object.h"
 #include "script_func_impl.h"
+#include <emmintrin.h> // SSE2 intrinsics, used by TextDecode().
 EXTERN_SCRIPT;
 
 UINT g_ACP = GetACP(); // Requires a reboot to change.
@@ -1191,3 +1192,295 @@ __int64 TextMem::_Length() const
 {
 	return mData.mLength;
 }
+
+
+
+//
+// TextDecode
+//
+#define TEXT_DECODE_PART_SIZE (64 * 1024 * 1024) // Max bytes per call to MultiByteToWideChar(), which takes an int.
+
+static LPCSTR TextDecodePartEnd(LPCSTR aText, LPCSTR aEnd)
+// Returns the end of the next part of aText for MultiByteToWideChar(), which must not split a character.
+// Bytes below 0x30 are single-byte characters in every multi-byte code page supported for files (they
+// are never used as trail bytes), so the part is ended after one of those if it must be shortened.
+{
+	if (aEnd - aText <= TEXT_DECODE_PART_SIZE)
+		return aEnd;
+	for (LPCSTR cp = aText + TEXT_DECODE_PART_SIZE; cp > aText; --cp)
+		if ((BYTE)cp[-1] < 0x30)
+			return cp;
+	return aText + TEXT_DECODE_PART_SIZE; // No safe point; this is unlikely to be valid text anyway.
+}
+
+static size_t TextDecodeUTF8(LPCSTR aText, size_t aSize, LPWSTR aBuf)
+// Runs of ASCII are widened 16 bytes at a time, since that's most of the text in typical files.
+// Everything else is passed to MultiByteToWideChar() in parts which end at an ASCII char.
+{
+	LPCSTR src = aText, src_end = aText + aSize;
+	LPWSTR dst = aBuf;
+	const __m128i zero = _mm_setzero_si128();
+	while (src < src_end)
+	{
+		for (; src_end - src >= 16; src += 16, dst += 16)
+		{
+			__m128i block = _mm_loadu_si128((const __m128i *)src);
+			if (_mm_movemask_epi8(block))
+				break;
+			_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(block, zero));
+			_mm_storeu_si128((__m128i *)(dst + 8), _mm_unpackhi_epi8(block, zero));
+		}
+		for (; src < src_end && !(*src & 0x80); ++src)
+			*dst++ = *src;
+		if (src == src_end)
+			break;
+		// Find the next run of 16 ASCII chars, which is also the start of a character.
+		LPCSTR part_end = src + 1;
+		for (;;)
+		{
+			if (src_end - part_end < 16)
+			{
+				part_end = src_end;
+				break;
+			}
+			if (!_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)part_end)))
+				break;
+			part_end += 16;
+		}
+		if (part_end - src > TEXT_DECODE_PART_SIZE)
+		{
+			// Back up to the lead byte of the character at the limit.
+			for (part_end = src + TEXT_DECODE_PART_SIZE; (*part_end & 0xC0) == 0x80 && part_end > src + 1; --part_end);
+		}
+		dst += MultiByteToWideChar(CP_UTF8, 0, src, (int)(part_end - src), dst, (int)(part_end - src));
+		src = part_end;
+	}
+	return dst - aBuf;
+}
+
+size_t TextDecodeMaxLength(LPCVOID aText, size_t aSize, UINT aCodePage)
+{
+	if (aCodePage == CP_UTF16)
+		return (aSize + 1) / sizeof(WCHAR);
+	CPINFO info;
+	if (aCodePage == CP_UTF8 || GetCPInfo(aCodePage, &info) && info.MaxCharSize <= 2)
+		return aSize; // Each char takes at least one byte and becomes one or two UTF-16 code units.
+	// Code pages such as UTF-7 and GB18030 can produce more code units than bytes, so count them.
+	size_t length = 0;
+	for (LPCSTR text = (LPCSTR)aText, text_end = text + aSize, part_end; text < text_end; text = part_end)
+	{
+		part_end = TextDecodePartEnd(text, text_end);
+		length += MultiByteToWideChar(aCodePage, 0, text, (int)(part_end - text), NULL, 0);
+	}
+	return length;
+}
+
+size_t TextDecode(LPCVOID aText, size_t aSize, UINT aCodePage, LPTSTR aBuf)
+{
+	if (aCodePage == CP_UTF16)
+	{
+		size_t length = aSize / sizeof(WCHAR);
+		wmemcpy(aBuf, (LPCWSTR)aText, length);
+		if (aSize & 1) // Incomplete final code unit, as in TextStream::Read().
+			aBuf[length++] = INVALID_CHAR;
+		return length;
+	}
+	if (aCodePage == CP_UTF8)
+		return TextDecodeUTF8((LPCSTR)aText, aSize, aBuf);
+	LPTSTR dst = aBuf;
+	for (LPCSTR text = (LPCSTR)aText, text_end = text + aSize, part_end; text < text_end; text = part_end)
+	{
+		part_end = TextDecodePartEnd(text, text_end);
+		// The caller has ensured there is room for the whole result, so the buffer size isn't tracked.
+		dst += MultiByteToWideChar(aCodePage, 0, text, (int)(part_end - text), dst, INT_MAX);
+	}
+	return dst - aBuf;
+}
+
+
+//
+// TextMappedFile
+//
+#define TEXT_MAP_VIEW_SIZE (16 * 1024 * 1024) // Max bytes mapped and decoded at once.
+#define TEXT_MAP_ALIGNMENT 0x10000 // Allocation granularity; view offsets must be a multiple of this.
+
+bool TextMappedFile::Open(LPCTSTR aFileSpec, UINT aCodePage)
+{
+	Close();
+	// Use the same sharing mode as TextFile so that the file can be appended to while it is read.
+	mFile = CreateFile(aFileSpec, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING
+		, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (mFile == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (GetFileType(mFile) != FILE_TYPE_DISK || !GetFileSizeEx(mFile, &size)
+		|| size.QuadPart && !(mMapping = CreateFileMapping(mFile, NULL, PAGE_READONLY, 0, 0, NULL)))
+	{
+		DWORD error = GetLastError();
+		Close();
+		SetLastError(error);
+		return false;
+	}
+	mSize = size.QuadPart; // A mapping can't be created for an empty file, but it has no lines anyway.
+	mCodePage = aCodePage == CP_ACP ? g_ACP : aCodePage; // The BOM, if any, is checked by DecodeNextBlock().
+	return true;
+}
+
+void TextMappedFile::Close()
+{
+	if (mView)
+		UnmapViewOfFile(mView);
+	if (mMapping)
+		CloseHandle(mMapping);
+	if (mFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mFile);
+	free(mBuffer);
+	mFile = INVALID_HANDLE_VALUE;
+	mMapping = NULL;
+	mView = NULL;
+	mViewOffset = mSize = mOffset = 0;
+	mViewSize = mBufferSize = 0;
+	mBuffer = mPos = mEnd = NULL;
+	mSplitChar = 0;
+}
+
+bool TextMappedFile::MapView(unsigned __int64 aOffset)
+{
+	if (mView)
+		UnmapViewOfFile(mView);
+	mViewOffset = aOffset & ~(unsigned __int64)(TEXT_MAP_ALIGNMENT - 1);
+	mViewSize = (size_t)min(mSize - mViewOffset, (unsigned __int64)TEXT_MAP_VIEW_SIZE);
+	mView = (LPBYTE)MapViewOfFile(mMapping, FILE_MAP_READ, (DWORD)(mViewOffset >> 32), (DWORD)mViewOffset, mViewSize);
+	return mView != NULL;
+}
+
+bool TextMappedFile::DecodeNextBlock(size_t aKeep)
+// Decodes the next block of the file, after the last aKeep chars of the current block (the start of
+// a line which continues into the next block).  Returns false at the end of the file or on failure.
+{
+	if (mOffset >= mSize || !MapView(mOffset))
+		return false;
+	// Accessing the view can raise an exception if the file is truncated by another process or
+	// there is an I/O error.  Since this can't be detected in advance, treat it as the end of the file.
+	__try
+	{
+		LPBYTE begin = mView + (mOffset - mViewOffset), end = mView + mViewSize;
+		if (mOffset == 0)
+		{
+			// Check for a byte order mark, as in TextStream::Open().
+			if (end - begin >= 2 && begin[0] == 0xFF && begin[1] == 0xFE)
+				mCodePage = CP_UTF16, begin += 2;
+			else if (end - begin >= 3 && begin[0] == 0xEF && begin[1] == 0xBB && begin[2] == 0xBF)
+				mCodePage = CP_UTF8, begin += 3;
+		}
+		if (mViewOffset + mViewSize < mSize)
+		{
+			// End the block after the last complete line, so that no character or CR+LF pair is split.
+			LPBYTE cut = end;
+			if (mCodePage == CP_UTF16)
+			{
+				// The view offset is always even, so code units are aligned within the view.
+				for (cut = end; cut > begin && ((LPWSTR)cut)[-1] != '\n'; cut -= sizeof(WCHAR));
+				if (cut == begin) // No line break, so the line continues into the next block.
+				{
+					cut = end;
+					if (IS_HIGH_SURROGATE(((LPWSTR)cut)[-1]))
+						cut -= sizeof(WCHAR);
+					if (((LPWSTR)cut)[-1] == '\r')
+						cut -= sizeof(WCHAR);
+				}
+			}
+			else
+			{
+				for (cut = end; cut > begin && cut[-1] != '\n'; --cut);
+				if (cut == begin)
+				{
+					cut = end;
+					if (mCodePage == CP_UTF8)
+					{
+						// Back up to the lead byte of the last (possibly incomplete) character.
+						LPBYTE lead = end - 1;
+						while (lead > begin && (*lead & 0xC0) == 0x80)
+							--lead;
+						if (*lead >= 0xC0)
+							cut = lead;
+					}
+					else
+					{
+						while (cut > begin && cut[-1] >= 0x30)
+							--cut;
+					}
+					if (cut > begin && cut[-1] == '\r')
+						--cut;
+				}
+			}
+			if (cut > begin)
+				end = cut;
+		}
+		size_t size = end - begin;
+		size_t keep_offset = mEnd - mBuffer - aKeep;
+		size_t buf_size = aKeep + TextDecodeMaxLength(begin, size, mCodePage) + 1;
+		if (buf_size > mBufferSize)
+		{
+			LPTSTR new_buf = trealloc(mBuffer, buf_size);
+			if (!new_buf)
+				return false;
+			mBuffer = new_buf;
+			mBufferSize = buf_size;
+		}
+		if (aKeep)
+			tmemmove(mBuffer, mBuffer + keep_offset, aKeep);
+		mPos = mBuffer;
+		mEnd = mBuffer + aKeep + TextDecode(begin, size, mCodePage, mBuffer + aKeep);
+		*mEnd = '\0';
+		mOffset = mViewOffset + (end - mView);
+	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		mOffset = mSize;
+		return false;
+	}
+	return true;
+}
+
+LPTSTR TextMappedFile::ReadLine(size_t aMaxLength, size_t &aLength)
+{
+	if (mSplitChar)
+	{
+		*mPos = mSplitChar; // Restore the char which was overwritten to terminate the previous part.
+		mSplitChar = 0;
+	}
+	for (;;)
+	{
+		LPTSTR eol = tmemchr2(mPos, mEnd, '\n', '\r');
+		size_t length = (eol ? eol : mEnd) - mPos;
+		LPTSTR line = mPos;
+		if (length > aMaxLength)
+		{
+			// Return part of the line, as TextStream::ReadLine() does when the caller's buffer is full.
+			mPos += aMaxLength;
+			mSplitChar = *mPos;
+			*mPos = '\0';
+			aLength = aMaxLength;
+			return line;
+		}
+		if (eol)
+		{
+			mPos = eol + 1;
+			if (*eol == '\r' && mPos < mEnd && *mPos == '\n') // Blocks never end between \r and \n.
+				++mPos;
+			*eol = '\0';
+			aLength = length;
+			return line;
+		}
+		// The line continues into the next block, or this is the last line of the file.
+		if (!DecodeNextBlock(length))
+		{
+			if (!length)
+				return NULL;
+			mPos = mEnd; // Already null-terminated.
+			aLength = length;
+			return line;
+		}
+	}
+}
@@ -313,6 +313,56 @@ private:
 
 
 
+// TextMappedFile reads lines from a file through a memory-mapped view rather than ReadFile(),
+// decoding a large block at a time and handing out each line in place.  It is used by Loop Read
+// when the file is a regular disk file; otherwise Open() fails and TextFile should be used instead.
+// Lines are terminated by \n, \r\n or \r, as with TextStream::ReadLine().
+class TextMappedFile
+{
+public:
+	TextMappedFile()
+		: mFile(INVALID_HANDLE_VALUE), mMapping(NULL), mView(NULL), mViewOffset(0), mViewSize(0)
+		, mSize(0), mOffset(0), mCodePage(CP_ACP), mBuffer(NULL), mBufferSize(0), mPos(NULL), mEnd(NULL), mSplitChar(0)
+	{}
+	~TextMappedFile() { Close(); }
+
+	bool Open(LPCTSTR aFileSpec, UINT aCodePage);
+	void Close();
+
+	// Returns the next line without its end-of-line character(s), or NULL if there are no more.
+	// The line is null-terminated and remains valid until the next call.  Lines longer than
+	// aMaxLength are returned in parts.
+	LPTSTR ReadLine(size_t aMaxLength, size_t &aLength);
+
+	UINT GetCodePage() { return mCodePage; }
+
+private:
+	bool MapView(unsigned __int64 aOffset);
+	bool DecodeNextBlock(size_t aKeep);
+
+	HANDLE mFile, mMapping;
+	LPBYTE mView; // The currently mapped part of the file.
+	unsigned __int64 mViewOffset;
+	size_t mViewSize;
+	unsigned __int64 mSize; // Size of the file.
+	unsigned __int64 mOffset; // Offset of the first byte not yet decoded.
+	UINT mCodePage;
+	LPTSTR mBuffer; // Decoded text of the current block.
+	size_t mBufferSize;
+	LPTSTR mPos, mEnd; // The next line and the end of the decoded text.
+	TCHAR mSplitChar; // The char overwritten by the terminator of a line which was split.
+};
+
+
+
+// Returns the maximum number of characters which aSize bytes of text in aCodePage can decode to.
+size_t TextDecodeMaxLength(LPCVOID aText, size_t aSize, UINT aCodePage);
+// Decodes aSize bytes of text in aCodePage into aBuf, which must have room for TextDecodeMaxLength()
+// characters.  Returns the number of characters written (not null-terminated).
+size_t TextDecode(LPCVOID aText, size_t aSize, UINT aCodePage, LPTSTR aBuf);
+
+
+
 // TextMem is intended to attach a memory block, which provides code pages and end-of-line conversions (CRLF <-> LF).
 // It is used for reading the script data in compiled script.
 // Note that TextMem doesn't have any ability to write and seek.
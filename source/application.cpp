@@ -20,6 +20,7 @@ GNU General Public License for more details.
 #include "window.h" // for several MsgBox and window functions
 #include "util.h" // for strlcpy()
 #include "resources/resource.h"  // For ID_TRAY_OPEN.
+#include "websocket_api.h" // For WebSocketDispatchMessages().
 
 
 bool MsgSleep(int aSleepDuration, MessageMode aMode)
@@ -613,6 +614,7 @@ bool MsgSleep(int aSleepDuration, MessageMode aMode)
 		case AHK_HOOK_HOTKEY:  // Sent from this app's keyboard or mouse hook.
 		case AHK_HOTSTRING:    // Sent from keybd hook to activate a non-auto-replace hotstring.
 		case AHK_CLIPBOARD_CHANGE:
+		case AHK_WEBSOCKET_MESSAGE:
 			// This extra handling is present because common controls and perhaps other OS features tend
 			// to use WM_USER+NN messages, a practice that will probably be even more common in the future.
 			// To cut down on message conflicts, dispatch such messages whenever their HWND isn't a what
@@ -787,6 +789,14 @@ bool MsgSleep(int aSleepDuration, MessageMode aMode)
 				priority = 0;  // Always use default for now.
 				break;
 
+			case AHK_WEBSOCKET_MESSAGE: // One post covers every message received since the last one.
+				WebSocketPostRetrieved(); // Let the next message post again in case this one is discarded below.
+				// If the callback is already running, its dispatch loop will pick up the new messages.
+				if (g_script.mOnWebSocketMessageIsRunning || !g_script.mOnWebSocketMessage.Count())
+					continue;
+				priority = 0;
+				break;
+
 			case AHK_INPUT_END:
 				input_hook = InputRelease((input_type *)msg.wParam); // The function will verify that it is a valid input_type pointer.
 				if (!input_hook)
@@ -962,6 +972,7 @@ bool MsgSleep(int aSleepDuration, MessageMode aMode)
 			{
 			case AHK_GUI_ACTION: // Listed first for performance.
 			case AHK_CLIPBOARD_CHANGE:
+			case AHK_WEBSOCKET_MESSAGE:
 			case AHK_INPUT_END:
 			case AHK_INPUT_KEYDOWN:
 			case AHK_INPUT_CHAR:
@@ -1262,6 +1273,14 @@ bool MsgSleep(int aSleepDuration, MessageMode aMode)
 				break;
 			}
 
+			case AHK_WEBSOCKET_MESSAGE:
+				g_script.mOnWebSocketMessageIsRunning = true;
+				DEBUGGER_STACK_PUSH(_T("WebSocketOnMessage"))
+				WebSocketDispatchMessages();
+				DEBUGGER_STACK_POP()
+				g_script.mOnWebSocketMessageIsRunning = false;
+				break;
+
 			case AHK_INPUT_END:
 			{
 				ExprTokenType param = input_hook->ScriptObject;
@@ -27,6 +27,8 @@
 #ifndef AUTOHOTKEYSC
 // DBGp
 #define CONFIG_DEBUGGER
+// Sampling profiler (/Profile and #Profile).  Requires CONFIG_DEBUGGER for its call stack.
+#define CONFIG_PROFILER
 #endif
 
 // Generates warnings to help we check whether the codes are ready to handle Unicode or not.
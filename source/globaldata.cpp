@@ -33,7 +33,6 @@ GNU General Public License for more details.
 HINSTANCE g_hInstance = NULL; // Set by WinMain().
 DWORD g_MainThreadID = GetCurrentThreadId();
 DWORD g_HookThreadID; // Not initialized by design because 0 itself might be a valid thread ID.
-CRITICAL_SECTION g_CriticalRegExCache;
 
 UINT g_DefaultScriptCodepage = CP_UTF8;
 
@@ -145,14 +144,6 @@ GuiType *g_firstGui = NULL, *g_lastGui = NULL;
 HWND g_hWndToolTip[MAX_TOOLTIPS] = {NULL};
 MsgMonitorList g_MsgMonitor;
 
-// Init not needed for these:
-UCHAR g_SortCaseSensitive;
-bool g_SortNumeric;
-bool g_SortReverse;
-int g_SortColumnOffset;
-IObject *g_SortFunc;
-ResultType g_SortFuncResult;
-
 // Hot-string vars (initialized when ResetHook() is first called):
 TCHAR g_HSBuf[HS_BUF_SIZE];
 int g_HSBufLength;
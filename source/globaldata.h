@@ -28,7 +28,6 @@ GNU General Public License for more details.
 extern HINSTANCE g_hInstance;
 extern DWORD g_MainThreadID;
 extern DWORD g_HookThreadID;
-extern CRITICAL_SECTION g_CriticalRegExCache;
 
 extern UINT g_DefaultScriptCodepage;
 
@@ -122,13 +121,6 @@ extern GuiType *g_firstGui, *g_lastGui;
 extern HWND g_hWndToolTip[MAX_TOOLTIPS];
 extern MsgMonitorList g_MsgMonitor;
 
-extern UCHAR g_SortCaseSensitive;
-extern bool g_SortNumeric;
-extern bool g_SortReverse;
-extern int g_SortColumnOffset;
-extern IObject *g_SortFunc;
-extern ResultType g_SortFuncResult;
-
 #define g_DerefChar   '%' // As of v2 these are constant, so even more parts of the code assume they
 #define g_EscapeChar  '`' // are at their usual default values to reduce code size/complexity.
 #define g_delimiter   ',' // Also, g_delimiter was never used in expressions (i.e. for SYM_COMMA).
@@ -2577,11 +2577,22 @@ bool CollectHotstring(KBDLLHOOKSTRUCT &aEvent, TCHAR ch[], int char_count, HWND
 		bool first_char_with_case_is_upper, first_char_with_case_has_gone_by;
 		CaseConformModes case_conform_mode;
 
+		// Rather than checking every hotstring, look up the ones whose abbreviation could match
+		// the end of the buffer.  This keeps the cost per keystroke low even for scripts with
+		// thousands of hotstrings.
+		HotstringIDType candidate[HS_MAX_CANDIDATES];
+		int candidate_count = Hotstring::FindCandidates(g_HSBuf, g_HSBufLength
+			, g_HSBufLength > 1 && _tcschr(g_EndChars, g_HSBuf[g_HSBufLength - 1]) != NULL, candidate);
+		bool check_all = candidate_count < 0; // Too many candidates, so check them all.
+		if (check_all)
+			candidate_count = Hotstring::sHotstringCount;
+
 		// Searching through the hot strings in the original, physical order is the documented
 		// way in which precedence is determined, i.e. the first match is the only one that will
-		// be triggered.
-		for (HotstringIDType u = 0; u < Hotstring::sHotstringCount; ++u)
+		// be triggered.  FindCandidates() returns them in that order.
+		for (int c = 0; c < candidate_count; ++c)
 		{
+			HotstringIDType u = check_all ? c : candidate[c];
 			Hotstring &hs = *Hotstring::shs[u];  // For performance and convenience.
 			if (hs.mSuspended)
 				continue;
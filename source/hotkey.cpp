@@ -2226,6 +2226,8 @@ Hotstring **Hotstring::shs = NULL;
 HotstringIDType Hotstring::sHotstringCount = 0;
 HotstringIDType Hotstring::sHotstringCountMax = 0;
 UINT Hotstring::sEnabledCount = 0;
+HotstringTrieNode Hotstring::sTrieRoot = {};
+bool Hotstring::sTrieIncomplete = false;
 
 
 void Hotstring::SuspendAll(bool aSuspend)
@@ -2396,6 +2398,94 @@ void Hotstring::DoReplace(LPARAM alParam)
 
 
 
+void Hotstring::AddToTrie(HotstringIDType aID)
+// Called only by the main thread, possibly while the hook thread is walking the trie.
+{
+	Hotstring &hs = *shs[aID];
+	HotstringTrieNode *node = &sTrieRoot;
+	for (LPCTSTR cp = hs.mString + hs.mStringLength - 1; cp >= hs.mString; --cp)
+	{
+		TCHAR ch = (TCHAR)ltolower(*cp); // Fold case even for case-sensitive hotstrings; the hook checks the exact case.
+		HotstringTrieNode *child;
+		for (child = node->mChild; child; child = child->mSibling)
+			if (child->mChar == ch)
+				break;
+		if (!child)
+		{
+			if (  !(child = (HotstringTrieNode *)SimpleHeap::Malloc(sizeof(HotstringTrieNode)))  )
+			{
+				sTrieIncomplete = true;
+				return;
+			}
+			child->mChild = NULL;
+			child->mLeaf = NULL;
+			child->mChar = ch;
+			child->mSibling = node->mChild;
+			MemoryBarrier(); // Ensure the node is complete before the hook can see it.
+			node->mChild = child;
+		}
+		node = child;
+	}
+	auto leaf = (HotstringTrieLeaf *)SimpleHeap::Malloc(sizeof(HotstringTrieLeaf));
+	if (!leaf)
+	{
+		sTrieIncomplete = true;
+		return;
+	}
+	leaf->mID = aID;
+	leaf->mNext = node->mLeaf;
+	MemoryBarrier();
+	node->mLeaf = leaf;
+}
+
+
+
+int Hotstring::FindCandidates(LPCTSTR aBuf, int aBufLength, bool aEndCharTyped, HotstringIDType aCandidate[])
+// Called by the hook thread to find which hotstrings could match the end of aBuf.  Stores their IDs
+// in aCandidate (which must have room for HS_MAX_CANDIDATES) in ascending order, since that is the
+// order of precedence.  Returns the number of candidates, or -1 if every hotstring must be checked.
+// Each candidate's abbreviation matches the buffer only when compared case-insensitively, so the
+// caller must still check it as before.
+{
+	if (sTrieIncomplete)
+		return -1;
+	HotstringIDType count_limit = sHotstringCount; // Ignore any hotstring added after this point.
+	int count = 0;
+	// The first pass finds hotstrings which end at the last character of the buffer, excluding any
+	// which require an end-char.  The second finds those which require an end-char, if one was typed.
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		bool end_char_required = pass == 1;
+		if (end_char_required && !aEndCharTyped)
+			break;
+		HotstringTrieNode *node = &sTrieRoot;
+		for (LPCTSTR cp = aBuf + aBufLength - 1 - pass; cp >= aBuf; --cp)
+		{
+			TCHAR ch = (TCHAR)ltolower(*cp);
+			for (node = node->mChild; node; node = node->mSibling)
+				if (node->mChar == ch)
+					break;
+			if (!node)
+				break;
+			for (HotstringTrieLeaf *leaf = node->mLeaf; leaf; leaf = leaf->mNext)
+			{
+				if (leaf->mID >= count_limit || shs[leaf->mID]->mEndCharRequired != end_char_required)
+					continue;
+				if (count == HS_MAX_CANDIDATES)
+					return -1;
+				// Insert in order.  There are usually very few candidates, so this is fast.
+				int i = count++;
+				for (; i && aCandidate[i - 1] > leaf->mID; --i)
+					aCandidate[i] = aCandidate[i - 1];
+				aCandidate[i] = leaf->mID;
+			}
+		}
+	}
+	return count;
+}
+
+
+
 ResultType Hotstring::AddHotstring(LPCTSTR aName, IObjectPtr aCallback, LPCTSTR aOptions, LPCTSTR aHotstring
 		, LPCTSTR aReplacement, bool aHasContinuationSection, UCHAR aSuspend)
 // Returns OK or FAIL.
@@ -2435,6 +2525,7 @@ ResultType Hotstring::AddHotstring(LPCTSTR aName, IObjectPtr aCallback, LPCTSTR
 		return FAIL;  // The constructor already displayed the error.
 	}
 
+	AddToTrie(sHotstringCount); // Before the count is updated, since the hook ignores IDs >= sHotstringCount.
 	++sHotstringCount;
 	if (!g_script.mIsReadyToExecute) // Caller is LoadIncludedFile(); allow BIF_Hotstring to manage this at runtime.
 		++sEnabledCount; // This works because the script can't be suspended during startup (aSuspend is always FALSE).
@@ -341,6 +341,26 @@ typedef UINT HotstringIDType;
 
 enum CaseConformModes {CASE_CONFORM_NONE, CASE_CONFORM_ALL_CAPS, CASE_CONFORM_FIRST_CAP};
 
+// The hook finds hotstrings via a trie of their abbreviations, reversed and folded to lowercase so that
+// walking it from the end of g_HSBuf yields every hotstring which could possibly match.  Nodes are never
+// removed, and new ones are linked in only after being fully initialized, so the hook thread can walk the
+// trie while the main thread adds to it.
+struct HotstringTrieLeaf
+{
+	HotstringIDType mID;
+	HotstringTrieLeaf *mNext;
+};
+
+struct HotstringTrieNode
+{
+	HotstringTrieNode *mChild; // First node for the character to the left of this one.
+	HotstringTrieNode *mSibling;
+	HotstringTrieLeaf *mLeaf; // Hotstrings whose abbreviation begins at this character.
+	TCHAR mChar;
+};
+
+#define HS_MAX_CANDIDATES 256 // FindCandidates() fails if more than this many hotstrings could match.
+
 
 class Hotstring
 {
@@ -349,6 +369,8 @@ public:
 	static HotstringIDType sHotstringCount;
 	static HotstringIDType sHotstringCountMax;
 	static UINT sEnabledCount; // v1.1.28.00: For performance, such as avoiding calling ToAsciiEx() in the hook.
+	static HotstringTrieNode sTrieRoot;
+	static bool sTrieIncomplete; // An allocation failed, so the hook must check every hotstring.
 
 	IObjectRef mCallback;
 	LPTSTR mName;
@@ -370,6 +392,8 @@ public:
 		, mDetectWhenInsideWord, mDoReset, mSuspendExempt, mConstructedOK;
 
 	static void SuspendAll(bool aSuspend);
+	static void AddToTrie(HotstringIDType aID);
+	static int FindCandidates(LPCTSTR aBuf, int aBufLength, bool aEndCharTyped, HotstringIDType aCandidate[]);
 	ResultType PerformInNewThreadMadeByCaller();
 	void DoReplace(LPARAM alParam);
 	static Hotstring *FindHotstring(LPCTSTR aHotstring, bool aCaseSensitive, bool aDetectWhenInsideWord, HotkeyCriterion *aHotCriterion);
@@ -161,6 +161,55 @@ static FResult ConvertFileOptions(LPCTSTR aOptions, UINT &codepage, bool &transl
 
 
 
+static bool FileReadMapped(HANDLE aFile, size_t aSize, UINT aCodePage, LPTSTR &aText, size_t &aLength)
+// Decodes the first aSize bytes of a disk file directly from a memory-mapped view, which avoids
+// reading the whole file into a temporary buffer.  Returns false if the file can't be mapped,
+// in which case the caller should read it normally.  Otherwise, aText is NULL if out of memory.
+{
+	if (GetFileType(aFile) != FILE_TYPE_DISK)
+		return false;
+	HANDLE mapping = CreateFileMapping(aFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping)
+		return false;
+	LPBYTE view = (LPBYTE)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, aSize);
+	CloseHandle(mapping); // The view keeps the mapping alive.
+	if (!view) // Probably not enough contiguous address space.
+		return false;
+	bool result = true;
+	aText = NULL;
+	__try
+	{
+		LPBYTE data = view;
+		size_t size = aSize;
+		// Handle the byte order mark the same way as the ReadFile() path in FileRead().
+		if (size >= 2 && data[0] == 0xFF && data[1] == 0xFE)
+			aCodePage = CP_UTF16, data += 2, size -= 2;
+		else if (aCodePage != CP_UTF16 && size >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF)
+			aCodePage = CP_UTF8, data += 3, size -= 3;
+		if (aCodePage == CP_UTF16)
+			size &= ~(size_t)1; // Ignore any incomplete final code unit.
+		size_t max_length = TextDecodeMaxLength(data, size, aCodePage);
+		if (aText = tmalloc(max_length + 1))
+		{
+			aLength = TextDecode(data, size, aCodePage, aText);
+			aText[aLength] = '\0';
+			if (max_length - aLength > 0x10000) // Return the unused part of the buffer (e.g. for non-ASCII UTF-8).
+				if (LPTSTR new_text = trealloc(aText, aLength + 1))
+					aText = new_text;
+		}
+	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		// Failed to read part of the file.  Let the caller retry with ReadFile() and report any error.
+		free(aText);
+		result = false;
+	}
+	UnmapViewOfFile(view);
+	return result;
+}
+
+
+
 bif_impl FResult FileRead(StrArg aFilespec, optl<StrArg> aOptions, ResultToken &aResultToken)
 {
 	g->LastError = 0; // Set default for successful early return or non-Win32 errors.
@@ -228,6 +277,19 @@ bif_impl FResult FileRead(StrArg aFilespec, optl<StrArg> aOptions, ResultToken &
 		return OK; // Indicate success (a zero-length file results in an empty string).
 	}
 
+	LPTSTR mapped_text;
+	size_t mapped_length;
+	if (codepage != -1 && FileReadMapped(hfile, (size_t)bytes_to_read, codepage & CP_AHKCP, mapped_text, mapped_length))
+	{
+		CloseHandle(hfile);
+		if (!mapped_text)
+			return FR_E_OUTOFMEM;
+		aResultToken.AcceptMem(mapped_text, mapped_length);
+		if (translate_crlf_to_lf && mapped_length) // See comments in the equivalent section below.
+			StrReplace(aResultToken.marker, _T("\r\n"), _T("\n"), SCS_SENSITIVE, UINT_MAX, -1, NULL, &aResultToken.marker_length);
+		return OK;
+	}
+
 	LPBYTE output_buf = (LPBYTE)malloc(size_t(bytes_to_read + (bytes_to_read & 1) + sizeof(wchar_t)));
 	if (!output_buf)
 	{
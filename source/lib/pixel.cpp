@@ -17,6 +17,8 @@ GNU General Public License for more details.
 #include "stdafx.h" // pre-compiled headers
 #include "script.h"
 #include "script_func_impl.h"
+#include "pixel_match.h"
+#include <memory>
 
 
 
@@ -177,12 +179,10 @@ FResult PixelSearch(BOOL *aFound, ResultToken *aFoundX, ResultToken *aFoundY
 
 	// Allow colors to vary within the spectrum of intensity, rather than having them
 	// wrap around (which doesn't seem to make much sense).  For example, if the user specified
-	// a variation of 5, but the red component of aColorBGR is only 0x01, we don't want red_low to go
-	// below zero, which would cause it to wrap around to a very intense red color:
-	COLORREF pixel; // Used much further down.
-	BYTE red, green, blue; // Used much further down.
+	// a variation of 5, but the red component of aColorBGR is only 0x01, we don't want the low end of
+	// the range to go below zero, which would cause it to wrap around to a very intense red color
+	// (PixelRangeLow and PixelRangeHigh take care of this):
 	BYTE search_red, search_green, search_blue;
-	BYTE red_low, green_low, blue_low, red_high, green_high, blue_high;
 	if (aVariation > 0)
 	{
 		search_red = GetRValue(aColorBGR);
@@ -250,30 +250,19 @@ FResult PixelSearch(BOOL *aFound, ResultToken *aFoundX, ResultToken *aFoundY
 		if (screen_is_16bit)
 			aColorRGB &= 0xF8F8F8F8;
 
-		for (int j = 0; j < screen_pixel_count; ++j)
+		// Note that screen pixels sometimes have a non-zero high-order byte.  That's why it is
+		// excluded from the comparison (by giving it the full range).  Otherwise, reddish/orangish
+		// colors are not properly found.
+		if (!(aColorRGB & 0xFF000000)) // Otherwise, it can't match any pixel.
 		{
-			if (right_to_left && bottom_to_top)
-				i = screen_pixel_count - j - 1;
-			else if (right_to_left)
-				i = j / screen_width * screen_width + screen_width - j % screen_width - 1;
-			else if (bottom_to_top)
-				i = (screen_pixel_count - j - 1) / screen_width * screen_width + j % screen_width;
-			else
-				i = j;
-
-			// Note that screen pixels sometimes have a non-zero high-order byte.  That's why
-			// bit-and with 0x00FFFFFF is done.  Otherwise, reddish/orangish colors are not properly
-			// found:
-			if ((screen_pixel[i] & 0x00FFFFFF) == aColorRGB)
-			{
-				found = true;
-				break;
-			}
+			i = PixelFind((const uint32_t *)screen_pixel, screen_width, screen_height, aColorRGB, aColorRGB | 0xFF000000
+				, right_to_left, bottom_to_top);
+			found = i >= 0;
 		}
 	}
 	else
 	{
-		// It seems more appropriate to do the 16-bit conversion prior to SET_COLOR_RANGE,
+		// It seems more appropriate to do the 16-bit conversion prior to setting the range,
 		// rather than applying 0xF8 to each of the high/low values individually.
 		if (screen_is_16bit)
 		{
@@ -282,43 +271,12 @@ FResult PixelSearch(BOOL *aFound, ResultToken *aFoundX, ResultToken *aFoundY
 			search_blue &= 0xF8;
 		}
 
-#define SET_COLOR_RANGE \
-{\
-	red_low = (aVariation > search_red) ? 0 : search_red - aVariation;\
-	green_low = (aVariation > search_green) ? 0 : search_green - aVariation;\
-	blue_low = (aVariation > search_blue) ? 0 : search_blue - aVariation;\
-	red_high = (aVariation > 0xFF - search_red) ? 0xFF : search_red + aVariation;\
-	green_high = (aVariation > 0xFF - search_green) ? 0xFF : search_green + aVariation;\
-	blue_high = (aVariation > 0xFF - search_blue) ? 0xFF : search_blue + aVariation;\
-}
-			
-		SET_COLOR_RANGE
-
-		for (int j = 0; j < screen_pixel_count; ++j)
-		{
-			if (right_to_left && bottom_to_top)
-				i = screen_pixel_count - j - 1;
-			else if (right_to_left)
-				i = j / screen_width * screen_width + screen_width - j % screen_width - 1;
-			else if (bottom_to_top)
-				i = (screen_pixel_count - j - 1) / screen_width * screen_width + j % screen_width;
-			else
-				i = j;
-
-			// Note that screen pixels sometimes have a non-zero high-order byte.  But it doesn't
-			// matter with the below approach, since that byte is not checked in the comparison.
-			pixel = screen_pixel[i];
-			red = GetBValue(pixel);   // Because pixel is in RGB vs. BGR format, red is retrieved with
-			green = GetGValue(pixel); // GetBValue() and blue is retrieved with GetRValue().
-			blue = GetRValue(pixel);
-			if (red >= red_low && red <= red_high
-				&& green >= green_low && green <= green_high
-				&& blue >= blue_low && blue <= blue_high)
-			{
-				found = true;
-				break;
-			}
-		}
+		// Screen pixels are in RGB vs. BGR format, so the range must be too.
+		COLORREF search_rgb = RGB(search_blue, search_green, search_red);
+		i = PixelFind((const uint32_t *)screen_pixel, screen_width, screen_height
+			, PixelRangeLow(search_rgb, aVariation), PixelRangeHigh(search_rgb, aVariation)
+			, right_to_left, bottom_to_top);
+		found = i >= 0;
 	}
 
 fast_end:
@@ -363,28 +321,190 @@ bif_impl FResult PixelSearch(BOOL &aFound, ResultToken &aFoundX, ResultToken &aF
 
 
 
-bif_impl FResult ImageSearch(ResultToken &aFoundX, ResultToken &aFoundY
-	, int aLeft, int aTop, int aRight, int aBottom, StrArg aImageFile
-	, BOOL &aRetVal)
-// Author: ImageSearch was created by Aurelian Maga.
+// ImageSearch keeps the pixels of recently used image files so that repeated searches for the
+// same image don't need to load and convert it again.  Each thread has its own cache, which is
+// bounded by ImageFileCache::sMaxBytes and freed when the thread exits.
+#define IMAGESEARCH_CACHE_SIZE 32 // Maximum number of images per thread, regardless of their size.
+#define IMAGESEARCH_CACHE_MAX_BYTES (4 * 1024 * 1024) // Default for ImageFileCache::sMaxBytes.
+
+struct ImageSearchPixels
+// Pixels loaded from an image file, shared by the cache and any searches using them, so that an
+// image evicted during a search (such as by ImageSearchAll loading other images) stays valid until
+// the search is done.  Only the thread which owns the cache uses them, so the count isn't atomic.
 {
-	// Many of the following sections are similar to those in PixelSearch(), so they should be
-	// maintained together.
+	LPCOLORREF pixel, mask; // Pixels with the high-order byte cleared, and the icon's mask or NULL.
+	int ref_count;
+
+	void AddRef() { ++ref_count; }
+	void Release()
+	{
+		if (--ref_count)
+			return;
+		free(pixel);
+		free(mask);
+		free(this);
+	}
+};
+
+struct ImageSearchCacheItem
+{
+	LPTSTR path; // Full path of the image file.
+	FILETIME last_write; // Used to detect when the file has changed.
+	DWORD size;
+	int width, height, icon_number; // The options which were passed to LoadPicture().
+	ImageSearchPixels *pixels;
+	LONG pixel_width, pixel_height;
+	size_t bytes; // Memory used by pixels.
+	bool is_16bit;
+};
+
+class ImageFileCache
+{
+	ImageSearchCacheItem mItem[IMAGESEARCH_CACHE_SIZE]; // Most recently used first.
+
+	void Remove(int aIndex)
+	{
+		ImageSearchCacheItem &item = mItem[aIndex];
+		free(item.path);
+		item.pixels->Release();
+		mBytes -= item.bytes;
+		memmove(mItem + aIndex, mItem + aIndex + 1, (--mCount - aIndex) * sizeof(ImageSearchCacheItem));
+	}
+
+public:
+	int mCount = 0;
+	size_t mBytes = 0;
+	static size_t sMaxBytes; // Shared by all threads' caches; 0 disables caching.
+
+	~ImageFileCache() { Trim(0, 0); }
+
+	ImageSearchCacheItem *Find(LPCTSTR aPath, const WIN32_FILE_ATTRIBUTE_DATA &aAttr
+		, int aWidth, int aHeight, int aIconNumber)
+	// Returns the cached pixels of the given file, or NULL if it isn't cached or has changed.
+	{
+		for (int i = 0; i < mCount; ++i)
+		{
+			ImageSearchCacheItem &item = mItem[i];
+			if (item.width != aWidth || item.height != aHeight || item.icon_number != aIconNumber
+				|| _tcsicmp(item.path, aPath))
+				continue;
+			if (CompareFileTime(&item.last_write, &aAttr.ftLastWriteTime) || item.size != aAttr.nFileSizeLow)
+			{
+				Remove(i); // The file has changed.
+				return NULL;
+			}
+			// Move it to the front so that the least recently used item is evicted first.
+			ImageSearchCacheItem found = item;
+			memmove(mItem + 1, mItem, i * sizeof(ImageSearchCacheItem));
+			mItem[0] = found;
+			return mItem;
+		}
+		return NULL;
+	}
+
+	ImageSearchPixels *Add(LPCTSTR aPath, const WIN32_FILE_ATTRIBUTE_DATA &aAttr
+		, int aWidth, int aHeight, int aIconNumber
+		, LPCOLORREF aPixel, LPCOLORREF aMask, LONG aPixelWidth, LONG aPixelHeight, bool aIs16Bit)
+	// Caches the pixels of the given file.  Returns the shared pixels, which now own aPixel and aMask
+	// and have a reference for the caller, or NULL if the image wasn't cached.
+	{
+		size_t max_bytes = sMaxBytes; // Read once, since another thread may change it.
+		size_t bytes = (size_t)aPixelWidth * aPixelHeight * sizeof(COLORREF) * (aMask ? 2 : 1);
+		if (bytes > max_bytes)
+			return NULL;
+		LPTSTR path = _tcsdup(aPath);
+		auto pixels = (ImageSearchPixels *)malloc(sizeof(ImageSearchPixels));
+		if (!path || !pixels)
+		{
+			free(path);
+			free(pixels);
+			return NULL;
+		}
+		// Make room by evicting the least recently used items.
+		Trim(max_bytes - bytes, IMAGESEARCH_CACHE_SIZE - 1);
+		pixels->pixel = aPixel;
+		pixels->mask = aMask;
+		pixels->ref_count = 2; // One for the cache and one for the caller.
+		memmove(mItem + 1, mItem, mCount * sizeof(ImageSearchCacheItem));
+		++mCount;
+		mBytes += bytes;
+		ImageSearchCacheItem &item = mItem[0];
+		item.path = path;
+		item.last_write = aAttr.ftLastWriteTime;
+		item.size = aAttr.nFileSizeLow;
+		item.width = aWidth;
+		item.height = aHeight;
+		item.icon_number = aIconNumber;
+		item.pixels = pixels;
+		item.pixel_width = aPixelWidth;
+		item.pixel_height = aPixelHeight;
+		item.bytes = bytes;
+		item.is_16bit = aIs16Bit;
+		return pixels;
+	}
+
+	void Trim(size_t aMaxBytes, int aMaxCount)
+	// Evicts the least recently used items until the cache is within both limits.  The pixels of
+	// an evicted item are freed once no search is using them.
+	{
+		while (mCount && (mBytes > aMaxBytes || mCount > aMaxCount))
+			Remove(mCount - 1);
+	}
+};
+
+size_t ImageFileCache::sMaxBytes = IMAGESEARCH_CACHE_MAX_BYTES;
+
+static thread_local std::unique_ptr<ImageFileCache> tImageSearchCache; // Created on first use by each thread and freed when it exits.
+
+
+bif_impl FResult ImageSearchCache(optl<__int64> aMaxBytes, IObject *&aRetVal)
+// Returns statistics for the current thread's image cache, after applying the new MaxBytes (if
+// specified) to the caches of all threads.  0 disables caching and frees any cached images.
+{
+	if (aMaxBytes.has_value())
+	{
+		if (*aMaxBytes < 0)
+			return FR_E_ARG(0);
+		ImageFileCache::sMaxBytes = (size_t)*aMaxBytes; // Other threads apply it when they next add an image.
+	}
+	ImageFileCache *cache = tImageSearchCache.get();
+	if (cache)
+		cache->Trim(ImageFileCache::sMaxBytes, IMAGESEARCH_CACHE_SIZE);
+	Object *info = Object::Create();
+	if (!info
+		|| !info->SetOwnProp(_T("MaxBytes"), (__int64)ImageFileCache::sMaxBytes)
+		|| !info->SetOwnProp(_T("Bytes"), (__int64)(cache ? cache->mBytes : 0))
+		|| !info->SetOwnProp(_T("Count"), (__int64)(cache ? cache->mCount : 0)))
+	{
+		if (info)
+			info->Release();
+		return FR_E_OUTOFMEM;
+	}
+	aRetVal = info;
+	return OK;
+}
 
-	// Set default results (output variables), in case of early return:
-	//aFoundX.SetValue(_T(""), 0);  // Init to empty string regardless of whether we succeed here.
-	//aFoundY.SetValue(_T(""), 0);  // Same.
 
-	POINT origin = {0};
-	CoordToScreen(origin, COORD_MODE_PIXEL);
-	aLeft   += origin.x;
-	aTop    += origin.y;
-	aRight  += origin.x;
-	aBottom += origin.y;
 
+struct ImageSearchImage
+{
+	LPCOLORREF pixel, mask; // Pixels with the high-order byte cleared, and the icon's mask or NULL.
+	LONG width, height;
+	bool is_16bit;
+	ImageSearchPixels *cached; // Non-NULL if pixel and mask belong to the cache.
+	COLORREF trans_color;
+	int variation;
+};
+
+
+static FResult ImageSearchLoad(LPCTSTR aImageFile, int aArgIndex, HDC hdc, ImageSearchImage &aImage)
+// Parses the asterisk-options of aImageFile and loads the image it specifies.  aArgIndex is the
+// parameter to blame for invalid options.  If OK is returned, the caller must call ImageSearchFree().
+// Author: ImageSearch was created by Aurelian Maga.
+{
 	// Options are done as asterisk+option to permit future expansion.
 	// Set defaults to be possibly overridden by any specified options:
-	int aVariation = 0;  // This is named aVariation vs. variation for use with the SET_COLOR_RANGE macro.
+	int variation = 0;
 	COLORREF trans_color = CLR_NONE; // The default must be a value that can't occur naturally in an image.
 	int icon_number = 0; // Zero means "load icon or bitmap (doesn't matter)".
 	int width = 0, height = 0;
@@ -430,7 +550,7 @@ bif_impl FResult ImageSearch(ResultToken &aFoundX, ResultToken &aFoundY
 					// It seems _tcstol() automatically handles the optional leading "0x" if present:
 					trans_color = _tcstol(color_name, &endptr, 16);
 					if (*endptr) // Not (entirely) a valid hex number.
-						return FR_E_ARG(6);
+						return FR_E_ARG(aArgIndex);
 				}
 				else
 					trans_color = bgr_to_rgb(trans_color); // v1.0.44.10: See fix/comment above.
@@ -438,18 +558,18 @@ bif_impl FResult ImageSearch(ResultToken &aFoundX, ResultToken &aFoundY
 			}
 			else // Assume it's a number since that's the only other asterisk-option.
 			{
-				aVariation = ATOI(cp); // Seems okay to support hex via ATOI because the space after the number is documented as being mandatory.
-				if (aVariation < 0)
-					aVariation = 0;
-				if (aVariation > 255)
-					aVariation = 255;
+				variation = ATOI(cp); // Seems okay to support hex via ATOI because the space after the number is documented as being mandatory.
+				if (variation < 0)
+					variation = 0;
+				if (variation > 255)
+					variation = 255;
 				// Note: because it's possible for filenames to start with a space (even though Explorer itself
 				// won't let you create them that way), allow exactly one space between end of option and the
 				// filename itself:
 			}
 		} // switch()
 		if (   !(cp = StrChrAny(cp, _T(" \t")))   ) // Find the first space or tab after the option.
-			return FR_E_ARG(6); // Bad option/format.
+			return FR_E_ARG(aArgIndex); // Bad option/format.
 		// Now it's the space or tab (if there is one) after the option letter.  Advance by exactly one character
 		// because only one space or tab is considered the delimiter.  Any others are considered to be part of the
 		// filename (though some or all OSes might simply ignore them or tolerate them as first-try match criteria).
@@ -458,6 +578,19 @@ bif_impl FResult ImageSearch(ResultToken &aFoundX, ResultToken &aFoundY
 		cp = omit_leading_whitespace(cp); // This is done to make it more tolerant of having more than one space/tab between options.
 	}
 
+	// Only files are cached, since a bitmap or icon handle could have been drawn on since the last
+	// search.  The file's last-write time and size are checked in case it has been replaced.
+	TCHAR image_path[MAX_PATH];
+	WIN32_FILE_ATTRIBUTE_DATA image_attr;
+	DWORD image_path_length;
+	bool can_cache = ImageFileCache::sMaxBytes && _tcsnicmp(aImageFile, _T("HICON:"), 6) && _tcsnicmp(aImageFile, _T("HBITMAP:"), 8)
+		&& (image_path_length = GetFullPathName(aImageFile, _countof(image_path), image_path, NULL))
+		&& image_path_length < _countof(image_path)
+		&& GetFileAttributesEx(image_path, GetFileExInfoStandard, &image_attr)
+		&& !(image_attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+	ImageSearchCacheItem *cached = can_cache && tImageSearchCache
+		? tImageSearchCache->Find(image_path, image_attr, width, height, icon_number) : NULL;
+
 	// Update: Transparency is now supported in icons by using the icon's mask.  In addition, an attempt
 	// is made to support transparency in GIF, PNG, and possibly TIF files via the *Trans option, which
 	// assumes that one color in the image is transparent.  In GIFs not loaded via GDIPlus, the transparent
@@ -470,9 +603,11 @@ bif_impl FResult ImageSearch(ResultToken &aFoundX, ResultToken &aFoundY
 	// color of whatever is behind it; thus screen pixel color won't match image's pixel color).
 	// So currently, only BMP and GIF seem to work reliably, though some of the other GDIPlus-supported
 	// formats might work too.
-	int image_type;
-	bool no_delete_bitmap;
-	HBITMAP hbitmap_image = LoadPicture(aImageFile, width, height, image_type, icon_number, false, &no_delete_bitmap);
+	int image_type = IMAGE_BITMAP;
+	bool no_delete_bitmap = true;
+	HBITMAP hbitmap_image = NULL;
+	if (!cached)
+		hbitmap_image = LoadPicture(aImageFile, width, height, image_type, icon_number, false, &no_delete_bitmap);
 	// The comment marked OBSOLETE below is no longer true because the elimination of the high-byte via
 	// 0x00FFFFFF seems to have fixed it.  But "true" is still not passed because that should increase
 	// consistency when GIF/BMP/ICO files are used by a script on both Win9x and other OSs (since the
@@ -480,34 +615,24 @@ bif_impl FResult ImageSearch(ResultToken &aFoundX, ResultToken &aFoundY
 	// OBSOLETE: Must not pass "true" with the above because that causes bitmaps and gifs to be not found
 	// by the search.  In other words, nothing works.  Obsolete comment: Pass "true" so that an attempt
 	// will be made to load icons as bitmaps if GDIPlus is available.
-	if (!hbitmap_image)
-		return FR_E_ARG(6);
+	if (!hbitmap_image && !cached)
+		return FR_E_ARG(aArgIndex);
 
-	HDC hdc = GetDC(NULL);
-	if (!hdc)
+	aImage.trans_color = trans_color;
+	aImage.variation = variation;
+	if (cached)
 	{
-		DWORD error = GetLastError();
-		if (!no_delete_bitmap)
-		{
-			if (image_type == IMAGE_ICON)
-				DestroyIcon((HICON)hbitmap_image);
-			else
-				DeleteObject(hbitmap_image);
-		}
-		return FR_E_WIN32(error);
+		aImage.pixel = cached->pixels->pixel;
+		aImage.mask = cached->pixels->mask;
+		aImage.width = cached->pixel_width;
+		aImage.height = cached->pixel_height;
+		aImage.is_16bit = cached->is_16bit;
+		aImage.cached = cached->pixels;
+		aImage.cached->AddRef(); // Keep the pixels even if the item is evicted before ImageSearchFree().
+		return OK;
 	}
-
-	// From this point on, "goto end" will assume hdc and hbitmap_image are non-NULL, but that the below
-	// might still be NULL.  Therefore, all of the following must be initialized so that the "end"
-	// label can detect them:
-	HDC sdc = NULL;
-	HBITMAP hbitmap_screen = NULL;
-	LPCOLORREF image_pixel = NULL, screen_pixel = NULL, image_mask = NULL;
-	HGDIOBJ sdc_orig_select = NULL;
-	bool found = false; // Must init here for use by "goto end".
-    
-	bool image_is_16bit;
-	LONG image_width, image_height;
+	aImage.mask = NULL;
+	aImage.cached = NULL;
 
 	if (image_type == IMAGE_ICON)
 	{
@@ -525,199 +650,105 @@ bif_impl FResult ImageSearch(ResultToken &aFoundX, ResultToken &aFoundY
 			// second half, the XOR part, is not needed and thus ignored.  Also note that if width/height
 			// required the icon to be scaled, LoadPicture() has already done that directly to the icon,
 			// so ii.hbmMask should already be scaled to match the size of the bitmap created later below.
-			image_mask = getbits(ii.hbmMask, hdc, image_width, image_height, image_is_16bit, 1);
+			aImage.mask = getbits(ii.hbmMask, hdc, aImage.width, aImage.height, aImage.is_16bit, 1);
 			DeleteObject(ii.hbmColor); // DeleteObject() probably handles NULL okay since few MSDN/other examples ever check for NULL.
 			DeleteObject(ii.hbmMask);
 		}
 		if (   !(hbitmap_image = IconToBitmap((HICON)hbitmap_image, true))   )
-			goto end;
+		{
+			DWORD error = GetLastError();
+			free(aImage.mask);
+			return FR_E_WIN32(error);
+		}
 	}
 
-	if (   !(image_pixel = getbits(hbitmap_image, hdc, image_width, image_height, image_is_16bit))   )
-		goto end;
-
-	// Create an empty bitmap to hold all the pixels currently visible on the screen that lie within the search area:
-	int search_width = aRight - aLeft + 1;
-	int search_height = aBottom - aTop + 1;
-	if (   !(sdc = CreateCompatibleDC(hdc)) || !(hbitmap_screen = CreateCompatibleBitmap(hdc, search_width, search_height))   )
-		goto end;
+	aImage.pixel = getbits(hbitmap_image, hdc, aImage.width, aImage.height, aImage.is_16bit);
+	DWORD error = GetLastError();
+	if (!no_delete_bitmap)
+		DeleteObject(hbitmap_image);
+	if (!aImage.pixel)
+	{
+		free(aImage.mask);
+		return FR_E_WIN32(error);
+	}
 
-	if (   !(sdc_orig_select = SelectObject(sdc, hbitmap_screen))   )
-		goto end;
+	// v1.0.44.03: The below is now done even for variation>0 mode so its results are consistent with those of
+	// non-variation mode.  This is relied upon by variation=0 mode but now also by the transparency check
+	// in PixelRangeInit().  Without this change, there are cases where variation=0 would find a match but a
+	// higher variation (for the same search) wouldn't.
+	LONG image_pixel_count = aImage.width * aImage.height;
+	for (LONG i = 0; i < image_pixel_count; ++i)
+		aImage.pixel[i] &= 0x00FFFFFF;
+
+	if (can_cache)
+	{
+		if (!tImageSearchCache)
+			tImageSearchCache.reset(new ImageFileCache); // Leaves it NULL if out of memory.
+		if (tImageSearchCache)
+			aImage.cached = tImageSearchCache->Add(image_path, image_attr, width, height, icon_number
+				, aImage.pixel, aImage.mask, aImage.width, aImage.height, aImage.is_16bit);
+	}
+	return OK;
+}
 
-	// Copy the pixels in the search-area of the screen into the DC to be searched:
-	if (   !(BitBlt(sdc, 0, 0, search_width, search_height, hdc, aLeft, aTop, SRCCOPY))   )
-		goto end;
 
-	LONG screen_width, screen_height;
-	bool screen_is_16bit;
-	if (   !(screen_pixel = getbits(hbitmap_screen, sdc, screen_width, screen_height, screen_is_16bit))   )
-		goto end;
+static void ImageSearchFree(ImageSearchImage &aImage)
+{
+	if (aImage.cached)
+		aImage.cached->Release();
+	else
+	{
+		free(aImage.pixel);
+		free(aImage.mask);
+	}
+}
 
-	LONG image_pixel_count = image_width * image_height;
-	LONG screen_pixel_count = screen_width * screen_height;
-	int i, j, k, x, y; // Declaring as "register" makes no performance difference with current compiler, so let the compiler choose which should be registers.
 
-	// If either is 16-bit, convert *both* to the 16-bit-compatible 32-bit format:
-	if (image_is_16bit || screen_is_16bit)
+static bool ImageSearchPrepare(ImageSearchImage &aImage, bool aScreenIs16Bit, PixelRange &aNeedle)
+// Sets up aNeedle to search for aImage.  Returns false if out of memory.
+{
+	// If either is 16-bit, *both* must be converted to the 16-bit-compatible 32-bit format.  The image's
+	// pixels are converted by PixelRangeInit() so that the cached copy is left unaltered, while the
+	// screen's pixels are converted by the caller.
+	COLORREF trans_color = aImage.trans_color;
+	DWORD pixel_mask = 0x00FFFFFF;
+	if (aImage.is_16bit || aScreenIs16Bit)
 	{
 		if (trans_color != CLR_NONE)
-			trans_color &= 0x00F8F8F8; // Convert indicated trans-color to be compatible with the conversion below.
-		for (i = 0; i < screen_pixel_count; ++i)
-			screen_pixel[i] &= 0x00F8F8F8; // Highest order byte must be masked to zero for consistency with use of 0x00FFFFFF below.
-		for (i = 0; i < image_pixel_count; ++i)
-			image_pixel[i] &= 0x00F8F8F8;  // Same.
+			trans_color &= 0x00F8F8F8; // Convert indicated trans-color to be compatible with the conversion.
+		pixel_mask = 0x00F8F8F8;
 	}
+	// An exact match is simply a variation of zero.  In either mode, the high-order byte of screen pixels is ignored.  This
+	// definitely helps find images more successfully in some cases.  For example, if a PNG file is
+	// displayed in a GUI window, it allows certain bitmap search-images to be found via variation==0
+	// when they otherwise would require variation==1.
+	// aImage.mask, if non-NULL, is used to determine which pixels are transparent within the image
+	// and thus should match any color on the screen.
+	return PixelRangeInit(aNeedle, (const uint32_t *)aImage.pixel, (const uint32_t *)aImage.mask, aImage.width, aImage.height
+		, trans_color, aImage.variation, pixel_mask);
+}
 
-	// v1.0.44.03: The below is now done even for variation>0 mode so its results are consistent with those of
-	// non-variation mode.  This is relied upon by variation=0 mode but now also by the following line in the
-	// variation>0 section:
-	//     || image_pixel[j] == trans_color
-	// Without this change, there are cases where variation=0 would find a match but a higher variation
-	// (for the same search) wouldn't. 
-	for (i = 0; i < image_pixel_count; ++i)
-		image_pixel[i] &= 0x00FFFFFF;
-
-	// Search the specified region for the first occurrence of the image:
-	if (aVariation < 1) // Caller wants an exact match.
-	{
-		// Concerning the following use of 0x00FFFFFF, the use of 0x00F8F8F8 above is related (both have high order byte 00).
-		// The following needs to be done only when shades-of-variation mode isn't in effect because
-		// shades-of-variation mode ignores the high-order byte due to its use of macros such as GetRValue().
-		// This transformation incurs about a 15% performance decrease (percentage is fairly constant since
-		// it is proportional to the search-region size, which tends to be much larger than the search-image and
-		// is therefore the primary determination of how long the loops take). But it definitely helps find images
-		// more successfully in some cases.  For example, if a PNG file is displayed in a GUI window, this
-		// transformation allows certain bitmap search-images to be found via variation==0 when they otherwise
-		// would require variation==1 (possibly the variation==1 success is just a side-effect of it
-		// ignoring the high-order byte -- maybe a much higher variation would be needed if the high
-		// order byte were also subject to the same shades-of-variation analysis as the other three bytes [RGB]).
-		for (i = 0; i < screen_pixel_count; ++i)
-			screen_pixel[i] &= 0x00FFFFFF;
 
-		for (i = 0; i < screen_pixel_count; ++i)
-		{
-			// Unlike the variation-loop, the following one uses a first-pixel optimization to boost performance
-			// by about 10% because it's only 3 extra comparisons and exact-match mode is probably used more often.
-			// Before even checking whether the other adjacent pixels in the region match the image, ensure
-			// the image does not extend past the right or bottom edges of the current part of the search region.
-			// This is done for performance but more importantly to prevent partial matches at the edges of the
-			// search region from being considered complete matches.
-			// The following check is ordered for short-circuit performance.  In addition, image_mask, if
-			// non-NULL, is used to determine which pixels are transparent within the image and thus should
-			// match any color on the screen.
-			if ((screen_pixel[i] == image_pixel[0] // A screen pixel has been found that matches the image's first pixel.
-				|| image_mask && image_mask[0]     // Or: It's an icon's transparent pixel, which matches any color.
-				|| image_pixel[0] == trans_color)  // This should be okay even if trans_color==CLR_NONE, since CLR_NONE should never occur naturally in the image.
-				&& image_height <= screen_height - i/screen_width // Image is short enough to fit in the remaining rows of the search region.
-				&& image_width <= screen_width - i%screen_width)  // Image is narrow enough not to exceed the right-side boundary of the search region.
-			{
-				// Check if this candidate region -- which is a subset of the search region whose height and width
-				// matches that of the image -- is a pixel-for-pixel match of the image.
-				for (found = true, x = 0, y = 0, j = 0, k = i; j < image_pixel_count; ++j)
-				{
-					if (!(found = (screen_pixel[k] == image_pixel[j] // At least one pixel doesn't match, so this candidate is discarded.
-						|| image_mask && image_mask[j]      // Or: It's an icon's transparent pixel, which matches any color.
-						|| image_pixel[j] == trans_color))) // This should be okay even if trans_color==CLR_NONE, since CLR none should never occur naturally in the image.
-						break;
-					if (++x < image_width) // We're still within the same row of the image, so just move on to the next screen pixel.
-						++k;
-					else // We're starting a new row of the image.
-					{
-						x = 0; // Return to the leftmost column of the image.
-						++y;   // Move one row downward in the image.
-						// Move to the next row within the current-candidate region (not the entire search region).
-						// This is done by moving vertically downward from "i" (which is the upper-left pixel of the
-						// current-candidate region) by "y" rows.
-						k = i + y*screen_width; // Verified correct.
-					}
-				}
-				if (found) // Complete match found.
-					break;
-			}
-		}
-	}
-	else // Allow colors to vary by aVariation shades; i.e. approximate match is okay.
-	{
-		// The following section is part of the first-pixel-check optimization that improves performance by
-		// 15% or more depending on where and whether a match is found.  This section and one the follows
-		// later is commented out to reduce code size.
-		// Set high/low range for the first pixel of the image since it is the pixel most often checked
-		// (i.e. for performance).
-		//BYTE search_red1 = GetBValue(image_pixel[0]);  // Because it's RGB vs. BGR, the B value is fetched, not R (though it doesn't matter as long as everything is internally consistent here).
-		//BYTE search_green1 = GetGValue(image_pixel[0]);
-		//BYTE search_blue1 = GetRValue(image_pixel[0]); // Same comment as above.
-		//BYTE red_low1 = (aVariation > search_red1) ? 0 : search_red1 - aVariation;
-		//BYTE green_low1 = (aVariation > search_green1) ? 0 : search_green1 - aVariation;
-		//BYTE blue_low1 = (aVariation > search_blue1) ? 0 : search_blue1 - aVariation;
-		//BYTE red_high1 = (aVariation > 0xFF - search_red1) ? 0xFF : search_red1 + aVariation;
-		//BYTE green_high1 = (aVariation > 0xFF - search_green1) ? 0xFF : search_green1 + aVariation;
-		//BYTE blue_high1 = (aVariation > 0xFF - search_blue1) ? 0xFF : search_blue1 + aVariation;
-		// Above relies on the fact that the 16-bit conversion higher above was already done because like
-		// in PixelSearch, it seems more appropriate to do the 16-bit conversion prior to setting the range
-		// of high and low colors (vs. than applying 0xF8 to each of the high/low values individually).
-
-		BYTE red, green, blue;
-		BYTE search_red, search_green, search_blue;
-		BYTE red_low, green_low, blue_low, red_high, green_high, blue_high;
-
-		// The following loop is very similar to its counterpart above that finds an exact match, so maintain
-		// them together and see above for more detailed comments about it.
-		for (i = 0; i < screen_pixel_count; ++i)
-		{
-			// The following is commented out to trade code size reduction for performance (see comment above).
-			//red = GetBValue(screen_pixel[i]);   // Because it's RGB vs. BGR, the B value is fetched, not R (though it doesn't matter as long as everything is internally consistent here).
-			//green = GetGValue(screen_pixel[i]);
-			//blue = GetRValue(screen_pixel[i]);
-			//if ((red >= red_low1 && red <= red_high1
-			//	&& green >= green_low1 && green <= green_high1
-			//	&& blue >= blue_low1 && blue <= blue_high1 // All three color components are a match, so this screen pixel matches the image's first pixel.
-			//		|| image_mask && image_mask[0]         // Or: It's an icon's transparent pixel, which matches any color.
-			//		|| image_pixel[0] == trans_color)      // This should be okay even if trans_color==CLR_NONE, since CLR none should never occur naturally in the image.
-			//	&& image_height <= screen_height - i/screen_width // Image is short enough to fit in the remaining rows of the search region.
-			//	&& image_width <= screen_width - i%screen_width)  // Image is narrow enough not to exceed the right-side boundary of the search region.
-			
-			// Instead of the above, only this abbreviated check is done:
-			if (image_height <= screen_height - i/screen_width    // Image is short enough to fit in the remaining rows of the search region.
-				&& image_width <= screen_width - i%screen_width)  // Image is narrow enough not to exceed the right-side boundary of the search region.
-			{
-				// Since the first pixel is a match, check the other pixels.
-				for (found = true, x = 0, y = 0, j = 0, k = i; j < image_pixel_count; ++j)
-				{
-   					search_red = GetBValue(image_pixel[j]);
-	   				search_green = GetGValue(image_pixel[j]);
-		   			search_blue = GetRValue(image_pixel[j]);
-					SET_COLOR_RANGE
-   					red = GetBValue(screen_pixel[k]);
-	   				green = GetGValue(screen_pixel[k]);
-		   			blue = GetRValue(screen_pixel[k]);
-
-					if (!(found = red >= red_low && red <= red_high
-						&& green >= green_low && green <= green_high
-                        && blue >= blue_low && blue <= blue_high
-							|| image_mask && image_mask[j]     // Or: It's an icon's transparent pixel, which matches any color.
-							|| image_pixel[j] == trans_color)) // This should be okay even if trans_color==CLR_NONE, since CLR_NONE should never occur naturally in the image.
-						break; // At least one pixel doesn't match, so this candidate is discarded.
-					if (++x < image_width) // We're still within the same row of the image, so just move on to the next screen pixel.
-						++k;
-					else // We're starting a new row of the image.
-					{
-						x = 0; // Return to the leftmost column of the image.
-						++y;   // Move one row downward in the image.
-						k = i + y*screen_width; // Verified correct.
-					}
-				}
-				if (found) // Complete match found.
-					break;
-			}
-		}
-	}
+static LPCOLORREF ImageSearchCapture(HDC hdc, int aLeft, int aTop, int aRight, int aBottom
+	, LONG &aWidth, LONG &aHeight, bool &aIs16Bit)
+// Returns the pixels currently visible in the given region of the screen, or NULL on failure, in
+// which case GetLastError() indicates the cause.  The caller must free() the result.
+{
+	LPCOLORREF screen_pixel = NULL;
+	HBITMAP hbitmap_screen = NULL;
+	HGDIOBJ sdc_orig_select = NULL;
+
+	// Create an empty bitmap to hold all the pixels currently visible on the screen that lie within the search area:
+	int search_width = aRight - aLeft + 1;
+	int search_height = aBottom - aTop + 1;
+	HDC sdc = CreateCompatibleDC(hdc);
+	if (   sdc && (hbitmap_screen = CreateCompatibleBitmap(hdc, search_width, search_height))
+		&& (sdc_orig_select = SelectObject(sdc, hbitmap_screen))
+		// Copy the pixels in the search-area of the screen into the DC to be searched:
+		&& BitBlt(sdc, 0, 0, search_width, search_height, hdc, aLeft, aTop, SRCCOPY)   )
+		screen_pixel = getbits(hbitmap_screen, sdc, aWidth, aHeight, aIs16Bit);
 
-end:
 	DWORD error = GetLastError();
-	ReleaseDC(NULL, hdc);
-	if (!no_delete_bitmap && hbitmap_image)
-		DeleteObject(hbitmap_image);
 	if (sdc)
 	{
 		if (sdc_orig_select) // i.e. the original call to SelectObject() didn't fail.
@@ -726,15 +757,74 @@ end:
 	}
 	if (hbitmap_screen)
 		DeleteObject(hbitmap_screen);
-	if (image_pixel)
-		free(image_pixel);
-	if (image_mask)
-		free(image_mask);
-	if (screen_pixel)
-		free(screen_pixel);
-	else // One of the GDI calls failed.
+	SetLastError(error);
+	return screen_pixel;
+}
+
+
+static void ImageSearchConvertTo16Bit(LPCOLORREF aPixel, LONG aCount)
+{
+	for (LONG i = 0; i < aCount; ++i)
+		aPixel[i] &= 0x00F8F8F8; // Highest order byte must be masked to zero for consistency with the image.
+}
+
+
+
+bif_impl FResult ImageSearch(ResultToken &aFoundX, ResultToken &aFoundY
+	, int aLeft, int aTop, int aRight, int aBottom, StrArg aImageFile
+	, BOOL &aRetVal)
+{
+	// Many of the following sections are similar to those in PixelSearch(), so they should be
+	// maintained together.
+
+	POINT origin = {0};
+	CoordToScreen(origin, COORD_MODE_PIXEL);
+	aLeft   += origin.x;
+	aTop    += origin.y;
+	aRight  += origin.x;
+	aBottom += origin.y;
+
+	HDC hdc = GetDC(NULL);
+	if (!hdc)
+		return FR_E_WIN32;
+
+	ImageSearchImage image;
+	auto fr = ImageSearchLoad(aImageFile, 6, hdc, image);
+	if (fr != OK)
+	{
+		ReleaseDC(NULL, hdc);
+		return fr;
+	}
+
+	LONG screen_width, screen_height;
+	bool screen_is_16bit;
+	LPCOLORREF screen_pixel = ImageSearchCapture(hdc, aLeft, aTop, aRight, aBottom, screen_width, screen_height, screen_is_16bit);
+	DWORD error = GetLastError();
+	ReleaseDC(NULL, hdc);
+	if (!screen_pixel)
+	{
+		ImageSearchFree(image);
 		return FR_E_WIN32(error);
+	}
+
+	if (image.is_16bit || screen_is_16bit)
+		ImageSearchConvertTo16Bit(screen_pixel, screen_width * screen_height);
+
+	LONG i = -1;
+	PixelRange needle;
+	if (ImageSearchPrepare(image, screen_is_16bit, needle))
+	{
+		i = PixelRangeFind(needle, (const uint32_t *)screen_pixel, screen_width, screen_height, CpuHasAVX2());
+		PixelRangeFree(needle);
+	}
+	else
+		fr = FR_E_OUTOFMEM;
+	ImageSearchFree(image);
+	free(screen_pixel);
+	if (fr != OK)
+		return fr;
 
+	bool found = i >= 0;
 	if (found)
 	{
 		// Calculate xpos and ypos of where the match was found and adjust coords to
@@ -746,3 +836,144 @@ end:
 	aRetVal = found;
 	return OK;
 }
+
+
+
+bif_impl FResult ImageSearchAll(int aLeft, int aTop, int aRight, int aBottom, ExprTokenType &aImages
+	, optl<int> aMaxPerImage, IObject *&aRetVal)
+// Captures the region once and searches it for every occurrence of each image.  aImages is either
+// a single image (with options, as for ImageSearch) or an Array of them.  Returns an Array of objects
+// with properties X, Y and Image (the 1-based index of the image within aImages), ordered by image
+// and then by position.  aMaxPerImage limits the number of matches reported for each image.
+{
+	int max_per_image = aMaxPerImage.value_or(0);
+	if (max_per_image < 0)
+		return FR_E_ARG(5);
+
+	// These arrays are allocated on the heap since the number of images is unlimited.
+	LPTSTR *image_file;
+	int image_count;
+	if (auto obj = TokenToObject(aImages))
+	{
+		auto arr = dynamic_cast<Array *>(obj);
+		if (!arr || !(image_count = arr->Length()))
+			return FR_E_ARG(4);
+		if (  !(image_file = (LPTSTR *)malloc(image_count * sizeof(LPTSTR)))  )
+			return FR_E_OUTOFMEM;
+		if (!arr->ToStrings(image_file, image_count, image_count))
+		{
+			free(image_file);
+			return FR_E_ARG(4); // Array contains something other than a string.
+		}
+	}
+	else
+	{
+		image_count = 1;
+		if (  !(image_file = (LPTSTR *)malloc(sizeof(LPTSTR)))  )
+			return FR_E_OUTOFMEM;
+		*image_file = TokenToString(aImages);
+	}
+
+	POINT origin = {0};
+	CoordToScreen(origin, COORD_MODE_PIXEL);
+	aLeft   += origin.x;
+	aTop    += origin.y;
+	aRight  += origin.x;
+	aBottom += origin.y;
+
+	HDC hdc = GetDC(NULL);
+	if (!hdc)
+	{
+		free(image_file);
+		return FR_E_WIN32;
+	}
+
+	// Load all images first so that invalid options or files are reported before the screen is captured.
+	auto image = (ImageSearchImage *)malloc(image_count * sizeof(ImageSearchImage));
+	FResult fr = image ? OK : FR_E_OUTOFMEM;
+	int loaded = 0;
+	for (; loaded < image_count && fr == OK; ++loaded)
+		if (  (fr = ImageSearchLoad(image_file[loaded], 4, hdc, image[loaded])) != OK  )
+			break;
+	free(image_file);
+
+	LONG screen_width, screen_height;
+	bool screen_is_16bit;
+	LPCOLORREF screen_pixel = NULL, screen_pixel_16bit = NULL;
+	if (fr == OK)
+	{
+		screen_pixel = ImageSearchCapture(hdc, aLeft, aTop, aRight, aBottom, screen_width, screen_height, screen_is_16bit);
+		if (!screen_pixel)
+			fr = FR_E_WIN32(GetLastError());
+	}
+	ReleaseDC(NULL, hdc);
+
+	Array *result = NULL;
+	if (fr == OK && !(result = Array::Create()))
+		fr = FR_E_OUTOFMEM;
+
+	LONG screen_pixel_count = fr == OK ? screen_width * screen_height : 0;
+	if (fr == OK && screen_is_16bit)
+		ImageSearchConvertTo16Bit(screen_pixel, screen_pixel_count);
+
+	for (int n = 0; n < image_count && fr == OK; ++n)
+	{
+		// A 16-bit image must be compared against a converted copy of the screen, but other images
+		// must still see the original pixels.
+		LPCOLORREF haystack = screen_pixel;
+		if (image[n].is_16bit && !screen_is_16bit)
+		{
+			if (!screen_pixel_16bit)
+			{
+				if (  !(screen_pixel_16bit = (LPCOLORREF)malloc(screen_pixel_count * sizeof(COLORREF)))  )
+				{
+					fr = FR_E_OUTOFMEM;
+					break;
+				}
+				memcpy(screen_pixel_16bit, screen_pixel, screen_pixel_count * sizeof(COLORREF));
+				ImageSearchConvertTo16Bit(screen_pixel_16bit, screen_pixel_count);
+			}
+			haystack = screen_pixel_16bit;
+		}
+		PixelRange needle;
+		if (!ImageSearchPrepare(image[n], screen_is_16bit, needle))
+		{
+			fr = FR_E_OUTOFMEM;
+			break;
+		}
+		// All matches are gathered in a single pass, so that the haystack is divided among threads
+		// and the needle's anchors are chosen only once per image.
+		std::vector<int32_t> found;
+		if (!PixelRangeFindAll(needle, (const uint32_t *)haystack, screen_width, screen_height, CpuHasAVX2(), max_per_image, found))
+			fr = FR_E_OUTOFMEM;
+		PixelRangeFree(needle);
+		for (size_t f = 0; f < found.size() && fr == OK; ++f)
+		{
+			LONG i = found[f];
+			auto match = Object::Create();
+			bool ok = match
+				&& match->SetOwnProp(_T("X"), (__int64)((aLeft + i%screen_width) - origin.x))
+				&& match->SetOwnProp(_T("Y"), (__int64)((aTop + i/screen_width) - origin.y))
+				&& match->SetOwnProp(_T("Image"), (__int64)(n + 1))
+				&& result->Append(ExprTokenType(match));
+			if (match)
+				match->Release();
+			if (!ok)
+				fr = FR_E_OUTOFMEM;
+		}
+	}
+
+	while (loaded--)
+		ImageSearchFree(image[loaded]);
+	free(image);
+	free(screen_pixel);
+	free(screen_pixel_16bit);
+	if (fr != OK)
+	{
+		if (result)
+			result->Release();
+		return fr;
+	}
+	aRetVal = result;
+	return OK;
+}
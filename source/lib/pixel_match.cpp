@@ -0,0 +1,514 @@
+/*
+AutoHotkey
+
+Copyright 2003-2009 Chris Mallett (support@autohotkey.com)
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+
+// This file doesn't use the precompiled header, since it must not depend on Windows.
+#include "pixel_match.h"
+#include <immintrin.h> // SSE2/AVX2 intrinsics for the pixel matchers.
+#include <cstdlib>
+#include <climits>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <new>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC permits AVX2 intrinsics anywhere; the caller checks that the CPU supports them.
+#define PIXEL_TARGET_AVX2
+static inline unsigned LowestBit(unsigned aMask) { unsigned long bit; _BitScanForward(&bit, aMask); return bit; }
+static inline unsigned HighestBit(unsigned aMask) { unsigned long bit; _BitScanReverse(&bit, aMask); return bit; }
+#else
+// GCC and Clang permit AVX2 intrinsics only in functions compiled for AVX2, which therefore must
+// contain nothing that runs on CPUs without it.
+#define PIXEL_TARGET_AVX2 __attribute__((target("avx2")))
+static inline unsigned LowestBit(unsigned aMask) { return (unsigned)__builtin_ctz(aMask); }
+static inline unsigned HighestBit(unsigned aMask) { return 31 - (unsigned)__builtin_clz(aMask); }
+#endif
+
+// Multiplier of the rolling hash used to find candidate rows for exact matches.
+#define PIXEL_HASH_BASE 0x01000193
+
+
+bool PixelRangeInit(PixelRange &aRange, const uint32_t *aPixel, const uint32_t *aMask, int32_t aWidth, int32_t aHeight
+	, uint32_t aTransColor, int aVariation, uint32_t aPixelMask)
+// Sets up aRange to match an image.  Each pixel of aPixel is first masked with aPixelMask, which
+// must clear the high-order byte; aTransColor must already have been masked the same way.  Pixels
+// which are transparent due to aMask or aTransColor match any color.
+// Returns false if out of memory.  The caller must call PixelRangeFree() if true is returned.
+{
+	int32_t count = aWidth * aHeight;
+	if (  !(aRange.low = (uint32_t *)malloc(count * 2 * sizeof(uint32_t)))  )
+		return false;
+	aRange.high = aRange.low + count;
+	aRange.width = aWidth;
+	aRange.height = aHeight;
+	aRange.anchor[0] = aRange.anchor[1] = 0;
+	aRange.hash_row = -1;
+	aRange.exact = aVariation == 0;
+	for (int32_t j = 0; j < count; ++j)
+	{
+		uint32_t pixel = aPixel[j] & aPixelMask;
+		if ((aMask && aMask[j]) || pixel == aTransColor) // This should be okay even if aTransColor==CLR_NONE, since CLR_NONE should never occur naturally in the image.
+		{
+			aRange.low[j] = 0;
+			aRange.high[j] = 0xFFFFFFFF;
+			aRange.exact = false;
+		}
+		else
+		{
+			aRange.low[j] = PixelRangeLow(pixel, aVariation);
+			aRange.high[j] = PixelRangeHigh(pixel, aVariation);
+		}
+	}
+	return true;
+}
+
+void PixelRangeFree(PixelRange &aRange)
+{
+	free(aRange.low);
+	aRange.low = aRange.high = NULL;
+}
+
+
+// Returns a bit for each of the 4 (or 8) pixels which lies within aLow..aHigh.
+static inline unsigned PixelsInRange(__m128i aPixels, __m128i aLow, __m128i aHigh)
+{
+	__m128i ok = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(aPixels, aLow), aPixels)
+		, _mm_cmpeq_epi8(_mm_min_epu8(aPixels, aHigh), aPixels));
+	return (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(ok, _mm_set1_epi32(-1))));
+}
+
+PIXEL_TARGET_AVX2
+static inline unsigned PixelsInRange(__m256i aPixels, __m256i aLow, __m256i aHigh)
+{
+	__m256i ok = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(aPixels, aLow), aPixels)
+		, _mm256_cmpeq_epi8(_mm256_min_epu8(aPixels, aHigh), aPixels));
+	return (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(ok, _mm256_set1_epi32(-1))));
+}
+
+static inline bool PixelInRange(uint32_t aPixel, uint32_t aLow, uint32_t aHigh)
+{
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		uint32_t c = (aPixel >> shift) & 0xFF;
+		if (c < ((aLow >> shift) & 0xFF) || c > ((aHigh >> shift) & 0xFF))
+			return false;
+	}
+	return true;
+}
+
+
+// Number of haystack pixels sampled to estimate how common each color of the needle is.
+#define PIXEL_SAMPLE_COUNT 1024
+// Maximum number of needle pixels considered as anchors.
+#define PIXEL_ANCHOR_CANDIDATES 64
+
+static void PixelRangeChooseAnchors(PixelRange &aNeedle, const uint32_t *aHaystack, int32_t aHaystackCount)
+// Chooses the two pixels of aNeedle which are compared first at each position, preferring those
+// whose colors are least common in a sample of the haystack.  Anchoring on the top-left pixel alone
+// makes nearly every position a candidate when that pixel is a common background color.  If even
+// the rarest anchor matches much of the haystack, exact searches compare a rolling hash of one row
+// of the needle instead.
+{
+	uint32_t sample[PIXEL_SAMPLE_COUNT];
+	int32_t sample_count = aHaystackCount < PIXEL_SAMPLE_COUNT ? aHaystackCount : PIXEL_SAMPLE_COUNT;
+	uint32_t seed = 1;
+	for (int32_t i = 0; i < sample_count; ++i)
+	{
+		// Positions are pseudo-random so that a regular pattern in the haystack can't skew the sample.
+		seed = seed * 1103515245 + 12345;
+		sample[i] = aHaystack[sample_count < aHaystackCount ? (seed >> 8) % (uint32_t)aHaystackCount : i];
+	}
+
+	int32_t count = aNeedle.width * aNeedle.height;
+	int32_t step = count / PIXEL_ANCHOR_CANDIDATES + 1;
+	static const uint8_t sBitCount[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+	int32_t best[2] = { -1, -1 }, best_hits[2] = { INT32_MAX, INT32_MAX };
+	// Candidates are spread across the needle: every step'th pixel, then those in between.  Pixels
+	// with the same range as a previous candidate are skipped, so that the few pixels which differ
+	// from the background of a mostly uniform needle are still considered.
+	int32_t candidate[PIXEL_ANCHOR_CANDIDATES], candidate_count = 0;
+	for (int32_t j = 0, k = 0; candidate_count < PIXEL_ANCHOR_CANDIDATES; k += step)
+	{
+		if (k >= count && (k = ++j) == step)
+			break;
+		// Skip transparent pixels, since they match everything.
+		if (aNeedle.low[k] == 0 && aNeedle.high[k] == 0xFFFFFFFF)
+			continue;
+		int32_t c = 0;
+		while (c < candidate_count && (aNeedle.low[candidate[c]] != aNeedle.low[k] || aNeedle.high[candidate[c]] != aNeedle.high[k]))
+			++c;
+		if (c < candidate_count)
+			continue;
+		candidate[candidate_count++] = k;
+		const __m128i low4 = _mm_set1_epi32(aNeedle.low[k]), high4 = _mm_set1_epi32(aNeedle.high[k]);
+		int32_t hits = 0, i = 0;
+		for (; i + 4 <= sample_count && hits < best_hits[1]; i += 4)
+			hits += sBitCount[PixelsInRange(_mm_loadu_si128((const __m128i *)(sample + i)), low4, high4)];
+		for (; i < sample_count; ++i)
+			hits += PixelInRange(sample[i], aNeedle.low[k], aNeedle.high[k]);
+		if (hits < best_hits[0])
+		{
+			best[1] = best[0], best_hits[1] = best_hits[0];
+			best[0] = k, best_hits[0] = hits;
+		}
+		else if (hits < best_hits[1])
+			best[1] = k, best_hits[1] = hits;
+	}
+	if (best[0] < 0)
+		return; // Every pixel is transparent, so any anchor will do.
+	aNeedle.anchor[0] = best[0];
+	aNeedle.anchor[1] = best[1] < 0 ? best[0] : best[1];
+
+	aNeedle.hash_row = -1;
+	if (aNeedle.exact && best_hits[0] * 8 > sample_count)
+	{
+		aNeedle.hash_row = best[0] / aNeedle.width;
+		const uint32_t *row = aNeedle.low + aNeedle.hash_row * aNeedle.width;
+		uint32_t hash = 0, power = 1;
+		for (int32_t x = 0; x < aNeedle.width; ++x)
+		{
+			hash = hash * PIXEL_HASH_BASE + row[x];
+			if (x)
+				power *= PIXEL_HASH_BASE;
+		}
+		aNeedle.row_hash = hash;
+		aNeedle.hash_power = power; // PIXEL_HASH_BASE to the power of width - 1.
+	}
+}
+
+
+static bool PixelRangeMatchesAt(const PixelRange &aNeedle, const uint32_t *aHaystack, int32_t aHaystackWidth)
+// Returns true if every pixel of aNeedle matches the pixels of aHaystack at the given position.
+// aHaystack points at the position of the needle's top-left pixel.
+{
+	const uint32_t *low = aNeedle.low, *high = aNeedle.high;
+	for (int32_t y = 0; y < aNeedle.height; ++y, aHaystack += aHaystackWidth, low += aNeedle.width, high += aNeedle.width)
+	{
+		int32_t x = 0;
+		for (; x + 4 <= aNeedle.width; x += 4)
+		{
+			if (PixelsInRange(_mm_loadu_si128((const __m128i *)(aHaystack + x))
+				, _mm_loadu_si128((const __m128i *)(low + x)), _mm_loadu_si128((const __m128i *)(high + x))) != 0xF)
+				return false;
+		}
+		for (; x < aNeedle.width; ++x)
+			if (!PixelInRange(aHaystack[x], low[x], high[x]))
+				return false;
+	}
+	return true;
+}
+
+
+struct PixelRangeScan
+// The parts of a needle which are compared first at each position.  Candidate positions are found
+// by comparing the needle's anchor pixel against several haystack pixels at once (or by comparing
+// row hashes), then verifying each candidate in full, starting with the second anchor pixel.
+{
+	const PixelRange &needle;
+	int32_t haystack_width;
+	int32_t anchor_offset, check_offset; // Offsets of the anchors within the haystack.
+	uint32_t anchor_low, anchor_high, check_low, check_high;
+
+	PixelRangeScan(const PixelRange &aNeedle, int32_t aHaystackWidth) : needle(aNeedle), haystack_width(aHaystackWidth)
+	{
+		const int32_t anchor = aNeedle.anchor[0], check = aNeedle.anchor[1];
+		anchor_offset = anchor / aNeedle.width * aHaystackWidth + anchor % aNeedle.width;
+		check_offset = check / aNeedle.width * aHaystackWidth + check % aNeedle.width;
+		anchor_low = aNeedle.low[anchor], anchor_high = aNeedle.high[anchor];
+		check_low = aNeedle.low[check], check_high = aNeedle.high[check];
+	}
+
+	bool MatchesAt(const uint32_t *aPos) const
+	{
+		return PixelInRange(aPos[check_offset], check_low, check_high)
+			&& PixelRangeMatchesAt(needle, aPos, haystack_width);
+	}
+};
+
+
+PIXEL_TARGET_AVX2
+static int32_t PixelRangeScanRowAVX2(const PixelRangeScan &aScan, const uint32_t *aRow, int32_t &aX, int32_t aXCount)
+// Compares the anchor pixel at 8 positions at a time, starting at aX.  Returns the first matching
+// position in aRow, or -1 with aX set to the first position not yet compared.
+{
+	const uint32_t *scan = aRow + aScan.anchor_offset;
+	const __m256i low8 = _mm256_set1_epi32(aScan.anchor_low), high8 = _mm256_set1_epi32(aScan.anchor_high);
+	for (; aX + 8 <= aXCount; aX += 8)
+	{
+		unsigned mask = PixelsInRange(_mm256_loadu_si256((const __m256i *)(scan + aX)), low8, high8);
+		for (; mask; mask &= mask - 1)
+		{
+			unsigned bit = LowestBit(mask);
+			if (aScan.MatchesAt(aRow + aX + bit))
+			{
+				_mm256_zeroupper();
+				return aX + bit;
+			}
+		}
+	}
+	_mm256_zeroupper();
+	return -1;
+}
+
+
+static int32_t PixelRangeScanRow(const PixelRangeScan &aScan, const uint32_t *aRow, int32_t aX, int32_t aXCount, bool aUseAVX2)
+// Returns the first position from aX to aXCount-1 at which the needle matches with its top-left
+// pixel in aRow, or -1 if none.
+{
+	if (aX >= aXCount)
+		return -1;
+	const PixelRange &needle = aScan.needle;
+	if (needle.hash_row >= 0)
+	{
+		// The high-order byte of screen pixels is ignored, as in PixelInRange().
+		const uint32_t *hash_row = aRow + needle.hash_row * aScan.haystack_width;
+		uint32_t hash = 0;
+		for (int32_t i = aX; i < aX + needle.width; ++i)
+			hash = hash * PIXEL_HASH_BASE + (hash_row[i] & 0x00FFFFFF);
+		for (int32_t x = aX;;)
+		{
+			if (hash == needle.row_hash && aScan.MatchesAt(aRow + x))
+				return x;
+			if (++x == aXCount)
+				return -1;
+			hash = (hash - (hash_row[x - 1] & 0x00FFFFFF) * needle.hash_power) * PIXEL_HASH_BASE
+				+ (hash_row[x - 1 + needle.width] & 0x00FFFFFF);
+		}
+	}
+	int32_t x = aX;
+	if (aUseAVX2)
+	{
+		int32_t found = PixelRangeScanRowAVX2(aScan, aRow, x, aXCount);
+		if (found >= 0)
+			return found;
+	}
+	const uint32_t *scan = aRow + aScan.anchor_offset;
+	const __m128i low4 = _mm_set1_epi32(aScan.anchor_low), high4 = _mm_set1_epi32(aScan.anchor_high);
+	for (; x + 4 <= aXCount; x += 4)
+	{
+		unsigned mask = PixelsInRange(_mm_loadu_si128((const __m128i *)(scan + x)), low4, high4);
+		for (; mask; mask &= mask - 1)
+		{
+			unsigned bit = LowestBit(mask);
+			if (aScan.MatchesAt(aRow + x + bit))
+				return x + bit;
+		}
+	}
+	for (; x < aXCount; ++x)
+		if (PixelInRange(scan[x], aScan.anchor_low, aScan.anchor_high) && aScan.MatchesAt(aRow + x))
+			return x;
+	return -1;
+}
+
+
+static int32_t PixelRangeFindInRows(const PixelRange &aNeedle, const uint32_t *aHaystack, int32_t aHaystackWidth
+	, int32_t aFirstRow, int32_t aFirstX, int32_t aEndRow, bool aUseAVX2, std::atomic<int32_t> *aBestSoFar
+	, std::vector<int32_t> *aAll = NULL, size_t aMaxCount = 0)
+// Searches for aNeedle at each position whose top-left pixel is in rows aFirstRow..aEndRow-1, in order,
+// starting at column aFirstX of the first row.
+// Returns the index of the haystack pixel at the top-left of the first match, or -1 if none.
+// If aBestSoFar is non-NULL, gives up once no match in these rows could precede a match found by
+// another thread.
+// If aAll is non-NULL, the index of each match is appended to it instead.  Once it contains
+// aMaxCount matches (if non-zero), the index of the last is returned; otherwise -1 is returned.
+// This may throw std::bad_alloc.
+{
+	const PixelRangeScan s(aNeedle, aHaystackWidth);
+	int32_t x_count = aHaystackWidth - aNeedle.width + 1; // Number of positions per row.
+	for (int32_t y = aFirstRow; y < aEndRow; ++y, aFirstX = 0)
+	{
+		const uint32_t *row = aHaystack + y * aHaystackWidth;
+		if (aBestSoFar && aBestSoFar->load(std::memory_order_relaxed) < (int32_t)(row - aHaystack))
+			break;
+		for (int32_t x = aFirstX; (x = PixelRangeScanRow(s, row, x, x_count, aUseAVX2)) >= 0; ++x)
+		{
+			int32_t found = (int32_t)(row - aHaystack) + x;
+			if (!aAll)
+				return found;
+			aAll->push_back(found);
+			if (aAll->size() == aMaxCount)
+				return found;
+		}
+	}
+	return -1;
+}
+
+
+// Regions with fewer candidate pixels than this are searched on the calling thread.
+#define PIXEL_SEARCH_PARALLEL_MIN_PIXELS (1024 * 1024)
+
+static int32_t PixelSearchBandCount(int32_t aRowCount, int32_t aHaystackWidth)
+// Returns the number of bands of rows into which a search of aRowCount rows is divided.
+{
+	int32_t band_count = (int32_t)std::thread::hardware_concurrency();
+	if (band_count > aRowCount)
+		band_count = aRowCount;
+	if (band_count < 1 || (int64_t)aRowCount * aHaystackWidth < PIXEL_SEARCH_PARALLEL_MIN_PIXELS)
+		return 1;
+	return band_count;
+}
+
+template<typename SearchBand>
+static void PixelSearchBands(int32_t aBandCount, SearchBand aSearchBand)
+// Calls aSearchBand(band) for each band from 0 to aBandCount-1, each on its own thread if possible.
+{
+	std::vector<std::thread> worker;
+	try
+	{
+		worker.reserve(aBandCount - 1);
+		while ((int32_t)worker.size() < aBandCount - 1)
+			worker.emplace_back(aSearchBand, (int32_t)worker.size() + 1);
+	}
+	catch (...) {} // Any bands without a thread are searched below.
+	aSearchBand(0);
+	for (int32_t band = (int32_t)worker.size() + 1; band < aBandCount; ++band)
+		aSearchBand(band);
+	for (auto &t : worker)
+		t.join();
+}
+
+static void PixelSearchBestSoFar(std::atomic<int32_t> &aBest, int32_t aFound)
+{
+	// Bands are in order, so the lowest index found is the first match.
+	int32_t prev = aBest.load();
+	while (aFound < prev && !aBest.compare_exchange_weak(prev, aFound));
+}
+
+int32_t PixelRangeFind(PixelRange &aNeedle, const uint32_t *aHaystack, int32_t aHaystackWidth, int32_t aHaystackHeight
+	, bool aUseAVX2)
+// Returns the index of the haystack pixel at the top-left of the first (in row-major order) match
+// of aNeedle, or -1 if there is none.  Large haystacks are divided into bands of rows, each searched
+// by its own thread.  aUseAVX2 must be false unless the CPU supports AVX2.
+{
+	if (aNeedle.width > aHaystackWidth || aNeedle.height > aHaystackHeight || aNeedle.width < 1 || aNeedle.height < 1)
+		return -1;
+	PixelRangeChooseAnchors(aNeedle, aHaystack, aHaystackWidth * aHaystackHeight);
+	int32_t row_count = aHaystackHeight - aNeedle.height + 1; // Number of rows which can contain the top-left pixel.
+	int32_t band_count = PixelSearchBandCount(row_count, aHaystackWidth);
+	if (band_count == 1)
+		return PixelRangeFindInRows(aNeedle, aHaystack, aHaystackWidth, 0, 0, row_count, aUseAVX2, NULL);
+	std::atomic<int32_t> best(INT32_MAX);
+	PixelSearchBands(band_count, [&](int32_t aBand)
+	{
+		int32_t first_row = (int32_t)((int64_t)row_count * aBand / band_count);
+		int32_t end_row = (int32_t)((int64_t)row_count * (aBand + 1) / band_count);
+		int32_t found = PixelRangeFindInRows(aNeedle, aHaystack, aHaystackWidth, first_row, 0, end_row, aUseAVX2, &best);
+		if (found >= 0)
+			PixelSearchBestSoFar(best, found);
+	});
+	int32_t found = best.load();
+	return found == INT32_MAX ? -1 : found;
+}
+
+bool PixelRangeFindAll(PixelRange &aNeedle, const uint32_t *aHaystack, int32_t aHaystackWidth, int32_t aHaystackHeight
+	, bool aUseAVX2, size_t aMaxCount, std::vector<int32_t> &aFound)
+// Appends to aFound the index of the haystack pixel at the top-left of each match of aNeedle, in
+// row-major order, stopping after aMaxCount matches if it is non-zero.  The haystack is divided into
+// bands as for PixelRangeFind(), but searched only once for all matches.
+// Returns false if out of memory.
+{
+	if (aNeedle.width > aHaystackWidth || aNeedle.height > aHaystackHeight || aNeedle.width < 1 || aNeedle.height < 1)
+		return true;
+	PixelRangeChooseAnchors(aNeedle, aHaystack, aHaystackWidth * aHaystackHeight);
+	int32_t row_count = aHaystackHeight - aNeedle.height + 1;
+	int32_t band_count = PixelSearchBandCount(row_count, aHaystackWidth);
+	std::vector<std::vector<int32_t>> band_found;
+	try
+	{
+		band_found.resize(band_count);
+	}
+	catch (const std::bad_alloc &)
+	{
+		return false;
+	}
+	// When a band reaches aMaxCount, the index of its last match is recorded here so that any
+	// later bands can stop, since none of their matches would be returned.
+	std::atomic<int32_t> best(INT32_MAX);
+	std::atomic<bool> out_of_memory(false);
+	PixelSearchBands(band_count, [&](int32_t aBand)
+	{
+		int32_t first_row = (int32_t)((int64_t)row_count * aBand / band_count);
+		int32_t end_row = (int32_t)((int64_t)row_count * (aBand + 1) / band_count);
+		try
+		{
+			int32_t last = PixelRangeFindInRows(aNeedle, aHaystack, aHaystackWidth, first_row, 0, end_row, aUseAVX2
+				, aMaxCount ? &best : NULL, &band_found[aBand], aMaxCount);
+			if (last >= 0)
+				PixelSearchBestSoFar(best, last);
+		}
+		catch (const std::bad_alloc &)
+		{
+			out_of_memory = true;
+		}
+	});
+	if (out_of_memory)
+		return false;
+	try
+	{
+		for (auto &found : band_found)
+		{
+			size_t count = found.size();
+			if (aMaxCount && count > aMaxCount - aFound.size())
+				count = aMaxCount - aFound.size();
+			aFound.insert(aFound.end(), found.begin(), found.begin() + count);
+		}
+	}
+	catch (const std::bad_alloc &)
+	{
+		return false;
+	}
+	return true;
+}
+
+
+int32_t PixelFind(const uint32_t *aHaystack, int32_t aWidth, int32_t aHeight, uint32_t aLow, uint32_t aHigh
+	, bool aRightToLeft, bool aBottomToTop)
+// Returns the index of the first pixel which lies within aLow..aHigh, scanning the rows in the
+// given direction, or -1 if there is none.
+{
+	const __m128i low4 = _mm_set1_epi32(aLow), high4 = _mm_set1_epi32(aHigh);
+	for (int32_t r = 0; r < aHeight; ++r)
+	{
+		const uint32_t *row = aHaystack + (aBottomToTop ? aHeight - 1 - r : r) * aWidth;
+		int32_t x;
+		if (aRightToLeft)
+		{
+			for (x = aWidth; x >= 4; x -= 4)
+			{
+				unsigned mask = PixelsInRange(_mm_loadu_si128((const __m128i *)(row + x - 4)), low4, high4);
+				if (mask)
+					return (int32_t)(row - aHaystack) + x - 4 + HighestBit(mask);
+			}
+			while (x--)
+				if (PixelInRange(row[x], aLow, aHigh))
+					return (int32_t)(row - aHaystack) + x;
+		}
+		else
+		{
+			for (x = 0; x + 4 <= aWidth; x += 4)
+			{
+				unsigned mask = PixelsInRange(_mm_loadu_si128((const __m128i *)(row + x)), low4, high4);
+				if (mask)
+					return (int32_t)(row - aHaystack) + x + LowestBit(mask);
+			}
+			for (; x < aWidth; ++x)
+				if (PixelInRange(row[x], aLow, aHigh))
+					return (int32_t)(row - aHaystack) + x;
+		}
+	}
+	return -1;
+}
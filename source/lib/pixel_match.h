@@ -0,0 +1,78 @@
+/*
+AutoHotkey
+
+Copyright 2003-2009 Chris Mallett (support@autohotkey.com)
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////////
+// Pixel matching
+// The functions below operate only on arrays of 32-bit pixels in memory, independent of how the
+// pixels were captured.  Each pixel to be matched is described by an inclusive range for each of
+// its bytes, which covers exact matching (low == high), shades of variation, and transparency
+// (0 to 0xFF) alike.  The high-order byte of screen pixels is ignored by giving it the full range.
+//
+// They have no Windows dependencies, so that they can be built and benchmarked on any x86 or x64
+// platform; see benchmarks/pixel_match_bench.cpp.
+///////////////////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct PixelRange
+{
+	uint32_t *low, *high; // One element per pixel.
+	int32_t width, height;
+	int32_t anchor[2]; // Pixels compared before the others; see PixelRangeChooseAnchors().
+	int32_t hash_row; // Row whose hash is compared before any pixels, or -1 for none.
+	uint32_t row_hash, hash_power;
+	bool exact; // True if every pixel is opaque and must match exactly.
+};
+
+
+inline uint32_t PixelRangeLow(uint32_t aColor, int aVariation)
+{
+	uint32_t low = 0;
+	for (int shift = 0; shift < 24; shift += 8)
+	{
+		int c = (aColor >> shift) & 0xFF;
+		low |= (uint32_t)(c > aVariation ? c - aVariation : 0) << shift;
+	}
+	return low;
+}
+
+inline uint32_t PixelRangeHigh(uint32_t aColor, int aVariation)
+{
+	uint32_t high = 0xFF000000;
+	for (int shift = 0; shift < 24; shift += 8)
+	{
+		int c = (aColor >> shift) & 0xFF;
+		high |= (uint32_t)(c + aVariation < 0xFF ? c + aVariation : 0xFF) << shift;
+	}
+	return high;
+}
+
+
+bool PixelRangeInit(PixelRange &aRange, const uint32_t *aPixel, const uint32_t *aMask, int32_t aWidth, int32_t aHeight
+	, uint32_t aTransColor, int aVariation, uint32_t aPixelMask);
+void PixelRangeFree(PixelRange &aRange);
+
+int32_t PixelRangeFind(PixelRange &aNeedle, const uint32_t *aHaystack, int32_t aHaystackWidth, int32_t aHaystackHeight
+	, bool aUseAVX2);
+bool PixelRangeFindAll(PixelRange &aNeedle, const uint32_t *aHaystack, int32_t aHaystackWidth, int32_t aHaystackHeight
+	, bool aUseAVX2, size_t aMaxCount, std::vector<int32_t> &aFound);
+
+int32_t PixelFind(const uint32_t *aHaystack, int32_t aWidth, int32_t aHeight, uint32_t aLow, uint32_t aHigh
+	, bool aRightToLeft, bool aBottomToTop);
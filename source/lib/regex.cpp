@@ -22,6 +22,7 @@ GNU General Public License for more details.
 #include "lib_pcre/pcre/pcre.h" // linkage rather than as functions inside an external DLL.
 
 #include "script_func_impl.h"
+#include <memory>
 
 
 
@@ -246,11 +247,11 @@ int RegExCallout(pcret_callout_block *cb)
 {
 	// Continuing execution on the hook thread wouldn't be safe, but there's no need to check
 	// the following since cb->callout_data is non-null only when the regex is being evaluated
-	// by RegExMatch/RegExReplace:
+	// by RegExMatch/RegExReplace/RegExMatchAll:
 	//if (GetCurrentThreadId() != g_MainThreadID)
 	//	return 0;
 
-	if (!cb->callout_data) // Callout not coming from RegExMatch/RegExReplace.
+	if (!cb->callout_data) // Callout not coming from RegExMatch/RegExReplace/RegExMatchAll.
 		return 0;
 	RegExCalloutData &cd = *(RegExCalloutData *)cb->callout_data;
 
@@ -341,115 +342,161 @@ int RegExCallout(pcret_callout_block *cb)
 	return (int)number_to_return;
 }
 
-pcret *get_compiled_regex(LPCTSTR aRegEx, pcret_extra *&aExtra, int *aOptionsLength, ResultToken *aResultToken)
-// Returns the compiled RegEx, or NULL on failure.
-// This function is called by things other than built-in functions so it should be kept general-purpose.
-// Upon failure, if aResultToken!=NULL:
-//   - An exception is thrown with a descriptive message on failure.
-//   - *aResultToken is set up to contain an empty string.
-// Upon success, the following output parameters are set based on the options that were specified:
-//    aGetPositionsNotSubstrings
-//    aExtra
-// L14: aOptionsLength is used by callouts to adjust cb->pattern_position to be relative to beginning of actual user-specified NeedleRegEx instead of string seen by PCRE.
-{	
-	if (!pcret_callout)
-	{	// Ensure this is initialized, even for ::RegExMatch() (to allow (?C) in window title regexes).
-		pcret_callout = &RegExCallout;
+struct pcre_cache_entry
+{
+	LPTSTR re_raw;      // The RegEx's literal string pattern such as "abc.*123", including options.
+	pcret *re_compiled; // The RegEx in compiled form.
+	pcret_extra *extra; // NULL unless a study() was done (and NULL even then if study() didn't find anything).
+	// int pcre_options; // Not currently needed in the cache since options are implicitly inside re_compiled.
+	int options_length; // Lexikos: See aOptionsLength comment in get_compiled_regex().
+	int pin_count;      // Number of callers still using re_compiled; see unpin_compiled_regex().
+	bool evicted;       // Removed from the cache while pinned; freed when unpinned.
+	UINT hash;
+	pcre_cache_entry *next_in_bucket, *newer, *older;
+};
+
+class RegExCache
+// Hash table of compiled RegExes, with a list in most-recently-used order for eviction.
+{
+	pcre_cache_entry **mBucket = nullptr;
+	UINT mBucketMask = 0; // Bucket count - 1; the bucket count is a power of 2.
+	pcre_cache_entry *mNewest = nullptr, *mOldest = nullptr;
+
+	void Unlink(pcre_cache_entry *aEntry)
+	{
+		if (mBucket) // Otherwise, see Add().
+		{
+			pcre_cache_entry **link = &mBucket[aEntry->hash & mBucketMask];
+			while (*link && *link != aEntry)
+				link = &(*link)->next_in_bucket;
+			if (*link)
+				*link = aEntry->next_in_bucket;
+		}
+		(aEntry->newer ? aEntry->newer->older : mNewest) = aEntry->older;
+		(aEntry->older ? aEntry->older->newer : mOldest) = aEntry->newer;
+		--mCount;
 	}
 
-	// While reading from or writing to the cache, don't allow another thread entry.  This is because
-	// that thread (or this one) might write to the cache while the other one is reading/writing, which
-	// could cause loss of data integrity (the hook thread can enter here via #HotIf WinActive/Exist & SetTitleMatchMode RegEx).
-	// Together, Enter/LeaveCriticalSection reduce performance by only 1.4% in the tightest possible script
-	// loop that hits the first cache entry every time.  So that's the worst case except when there's an actual
-	// collision, in which case performance suffers more because internally, EnterCriticalSection() does a
-	// wait/semaphore operation, which is more costly.
-	// Finally, the code size of all critical-section features together is less than 512 bytes (uncompressed),
-	// so like performance, that's not a concern either.
-	EnterCriticalSection(&g_CriticalRegExCache); // Request ownership of the critical section. If another thread already owns it, this thread will block until the other thread finishes.
-
-	// SET UP THE CACHE.
-	// This is a very crude cache for linear search. Of course, hashing would be better in the sense that it
-	// would allow the cache to get much larger while still being fast (I believe PHP caches up to 4096 items).
-	// Binary search might not be such a good idea in this case due to the time required to find the right spot
-	// to insert a new cache item (however, items aren't inserted often, so it might perform quite well until
-	// the cache contained thousands of RegEx's, which is unlikely to ever happen in most scripts).
-	struct pcre_cache_entry
+	void Rehash(UINT aBucketCount)
 	{
-		// For simplicity (and thus performance), the entire RegEx pattern including its options is cached
-		// is stored in re_raw and that entire string becomes the RegEx's unique identifier for the purpose
-		// of finding an entry in the cache.  Technically, this isn't optimal because some options like Study
-		// and aGetPositionsNotSubstrings don't alter the nature of the compiled RegEx.  However, the CPU time
-		// required to strip off some options prior to doing a cache search seems likely to offset much of the
-		// cache's benefit.  So for this reason, as well as rarity and code size issues, this policy seems best.
-		LPTSTR re_raw;      // The RegEx's literal string pattern such as "abc.*123".
-		pcret *re_compiled; // The RegEx in compiled form.
-		pcret_extra *extra; // NULL unless a study() was done (and NULL even then if study() didn't find anything).
-		// int pcre_options; // Not currently needed in the cache since options are implicitly inside re_compiled.
-		int options_length; // Lexikos: See aOptionsLength comment at beginning of this function.
-	};
+		auto bucket = (pcre_cache_entry **)calloc(aBucketCount, sizeof(pcre_cache_entry *));
+		if (!bucket)
+			return; // Keep using the current buckets, just with longer chains.
+		free(mBucket);
+		mBucket = bucket;
+		mBucketMask = aBucketCount - 1;
+		for (auto entry = mOldest; entry; entry = entry->newer)
+		{
+			entry->next_in_bucket = mBucket[entry->hash & mBucketMask];
+			mBucket[entry->hash & mBucketMask] = entry;
+		}
+	}
 
-	#define PCRE_CACHE_SIZE 100 // Going too high would be counterproductive due to the slowness of linear search (and also the memory utilization of so many compiled RegEx's).
-	static pcre_cache_entry sCache[PCRE_CACHE_SIZE] = {{0}};
-	static int sLastInsert, sLastFound = -1; // -1 indicates "cache empty".
-	int insert_pos; // v1.0.45.03: This is used to avoid updating sLastInsert until an insert actually occurs (it might not occur if a compile error occurs in the regex, or something else stops it early).
+public:
+	int mCount = 0;
+	__int64 mHits = 0, mMisses = 0;
+	static int sCapacity; // Shared by all threads' caches.
 
-	// CHECK IF THIS REGEX IS ALREADY IN THE CACHE.
-	if (sLastFound == -1) // Cache is empty, so insert this RegEx at the first position.
-		insert_pos = 0;  // A section further below will change sLastFound to be 0.
-	else
+	~RegExCache()
+	{
+		Trim(0); // Any RegEx still pinned is freed when unpinned.
+		free(mBucket);
+	}
+
+	static UINT Hash(LPCTSTR aRegEx)
+	{
+		UINT hash = 2166136261U; // FNV-1a.
+		for (; *aRegEx; ++aRegEx)
+			hash = (hash ^ (TBYTE)*aRegEx) * 16777619U;
+		return hash;
+	}
+
+	static void Free(pcre_cache_entry *aEntry)
+	{
+		free(aEntry->re_raw);
+		pcret_free(aEntry->re_compiled);
+		if (aEntry->extra)
+			pcret_free_study(aEntry->extra);
+		free(aEntry);
+	}
+
+	pcre_cache_entry *Find(LPCTSTR aRegEx, UINT aHash)
 	{
-		// Search the cache to see if it contains the caller-specified RegEx in compiled form.
-		// First check if the last-found item is a match, since often it will be (such as cases
-		// where a script-loop executes only one RegEx, and also for SetTitleMatchMode RegEx).
-		if (!_tcscmp(aRegEx, sCache[sLastFound].re_raw)) // Match found (case sensitive).
-			goto match_found; // And no need to update sLastFound because it's already set right.
-
-		// Since above didn't find a match, search outward in both directions from the last-found match.
-		// A bidirectional search is done because consecutively-called regex's tend to be adjacent to each other
-		// in the array, so performance is improved on average (since most of the time when repeating a previously
-		// executed regex, that regex will already be in the cache -- so optimizing the finding behavior is
-		// more important than optimizing the never-found-because-not-cached behavior).
-		bool go_right;
-		int i, item_to_check, left, right;
-		int last_populated_item = (sCache[PCRE_CACHE_SIZE-1].re_compiled) // When the array is full...
-			? PCRE_CACHE_SIZE - 1  // ...all items must be checked except the one already done earlier.
-			: sLastInsert;         // ...else only the items actually populated need to be checked.
-
-		for (go_right = true, left = sLastFound, right = sLastFound, i = 0
-			; i < last_populated_item  // This limits it to exactly the number of items remaining to be checked.
-			; ++i, go_right = !go_right)
+		if (mBucket)
 		{
-			if (go_right) // Proceed rightward in the array.
-			{
-				right = (right == last_populated_item) ? 0 : right + 1; // Increment or wrap around back to the left side.
-				item_to_check = right;
-			}
-			else // Proceed leftward.
-			{
-				left = (left == 0) ? last_populated_item : left - 1; // Decrement or wrap around back to the right side.
-				item_to_check = left;
-			}
-			if (!_tcscmp(aRegEx, sCache[item_to_check].re_raw)) // Match found (case sensitive).
+			for (auto entry = mBucket[aHash & mBucketMask]; entry; entry = entry->next_in_bucket)
 			{
-				sLastFound = item_to_check;
-				goto match_found;
+				if (entry->hash != aHash || _tcscmp(aRegEx, entry->re_raw)) // Case sensitive.
+					continue;
+				if (entry != mNewest) // Move it to the front of the list.
+				{
+					entry->newer->older = entry->older;
+					(entry->older ? entry->older->newer : mOldest) = entry->newer;
+					entry->older = mNewest;
+					entry->newer = nullptr;
+					mNewest = mNewest->newer = entry;
+				}
+				++mHits;
+				return entry;
 			}
 		}
+		++mMisses;
+		return nullptr;
+	}
 
-		// Since above didn't goto, no match was found nor is one possible.  So just indicate the insert position
-		// for where this RegEx will be put into the cache.
-		// The following formula is for both cache-full and cache-partially-full.  When the cache is full,
-		// it might not be the best possible formula; but it seems pretty good because it takes a round-robin
-		// approach to overwriting/discarding old cache entries.  A discarded entry might have just been
-		// used -- or even be sLastFound itself -- but on average, this approach seems pretty good because a
-		// script loop that uses 50 unique RegEx's will quickly stabilize in the cache so that all 50 of them
-		// stay compiled/cached until the loop ends.
-		insert_pos = (sLastInsert == PCRE_CACHE_SIZE-1) ? 0 : sLastInsert + 1; // Formula works for both full and partially-full array.
+	void Add(pcre_cache_entry *aEntry, UINT aHash)
+	{
+		Trim(sCapacity - 1); // Make room.
+		if ((UINT)mCount >= mBucketMask) // Keep chains short on average, and allocate the initial buckets.
+			Rehash(mBucket ? (mBucketMask + 1) * 2 : 64);
+		aEntry->hash = aHash;
+		aEntry->evicted = false;
+		if (mBucket)
+		{
+			aEntry->next_in_bucket = mBucket[aHash & mBucketMask];
+			mBucket[aHash & mBucketMask] = aEntry;
+		}
+		else // Out of memory, so it can't be found, but it is still freed by Trim().
+			aEntry->next_in_bucket = nullptr;
+		aEntry->newer = nullptr;
+		aEntry->older = mNewest;
+		(mNewest ? mNewest->newer : mOldest) = aEntry;
+		mNewest = aEntry;
+		++mCount;
+	}
+
+	void Trim(int aCapacity)
+	// Evicts the least recently used RegExes until at most aCapacity remain.
+	{
+		while (mCount > aCapacity && mOldest)
+		{
+			auto entry = mOldest;
+			Unlink(entry);
+			if (entry->pin_count)
+				entry->evicted = true; // unpin_compiled_regex() will free it.
+			else
+				Free(entry);
+		}
+	}
+};
+
+int RegExCache::sCapacity = 4096; // Same as PHP.  Lookups are hashed, so only memory grows with it.
+
+// Created on first use by each thread and freed when the thread exits, such as when the hook
+// thread is no longer needed.
+static thread_local std::unique_ptr<RegExCache> tRegExCache;
+
+
+
+pcret *compile_regex(LPCTSTR aRegEx, pcret_extra *&aExtra, int &aOptionsLength, ResultToken *aResultToken)
+// Parses the options of aRegEx and compiles the rest, without using the cache.
+// Returns the compiled RegEx, which the caller must free, or NULL on failure.
+// See get_compiled_regex() for a description of the parameters.
+{
+	if (!pcret_callout)
+	{	// Ensure this is initialized, even for ::RegExMatch() (to allow (?C) in window title regexes).
+		pcret_callout = &RegExCallout;
 	}
-	// Since the above didn't goto:
-	// - This RegEx isn't yet in the cache.  So compile it and put it in the cache, then return it to caller.
-	// - Above is responsible for having set insert_pos to the cache position where the new RegEx will be stored.
 
 	// The following macro is for maintainability, to enforce the definition of "default" in multiple places.
 	// PCRE_NEWLINE_CRLF is the default in AutoHotkey rather than PCRE_NEWLINE_LF because *multiline* haystacks
@@ -597,52 +644,111 @@ break_both:
 	else // No studying desired.
 		aExtra = NULL; // aExtra is an output parameter for caller.
 
+	// Lexikos: See aOptionsLength comment at get_compiled_regex().
+	aOptionsLength = (int)(pat - aRegEx);
+	return re_compiled; // Indicate success.
+
+error: // Since NULL is returned here, caller should ignore the contents of the output parameters.
+	return NULL; // Indicate failure.
+}
+
+
+
+pcret *get_compiled_regex(LPCTSTR aRegEx, pcret_extra *&aExtra, int *aOptionsLength, ResultToken *aResultToken
+	, pcre_cache_entry **aPinned = NULL)
+// Returns the compiled RegEx, or NULL on failure.
+// This function is called by things other than built-in functions so it should be kept general-purpose.
+// Upon failure, if aResultToken!=NULL:
+//   - An exception is thrown with a descriptive message on failure.
+//   - *aResultToken is set up to contain an empty string.
+// Upon success, the following output parameters are set based on the options that were specified:
+//    aGetPositionsNotSubstrings
+//    aExtra
+// L14: aOptionsLength is used by callouts to adjust cb->pattern_position to be relative to beginning of actual user-specified NeedleRegEx instead of string seen by PCRE.
+// If aPinned!=NULL, the RegEx stays valid until the caller passes *aPinned to unpin_compiled_regex(),
+// even if it is evicted from the cache in the meantime (such as by a callout which uses other RegExes).
+// Otherwise, the RegEx is valid only until the next call on this thread.
+{	
+	// Each thread has its own cache, so no locking is needed and threads never wait for each other
+	// (the hook thread can enter here via #HotIf WinActive/Exist & SetTitleMatchMode RegEx).
+	// This also means the pcret_extra of a cached RegEx, which BIF_RegEx modifies to pass callout
+	// data, is never shared between threads.
+	RegExCache *cache = tRegExCache.get();
+	if (!cache)
+	{
+		if (!(cache = new RegExCache))
+			return NULL;
+		tRegExCache.reset(cache);
+	}
+
+	// CHECK IF THIS REGEX IS ALREADY IN THE CACHE.
+	// For simplicity (and thus performance), the entire RegEx pattern including its options is cached
+	// and that entire string becomes the RegEx's unique identifier.  Technically, this isn't optimal
+	// because some options like Study don't alter the nature of the compiled RegEx.  However, the CPU
+	// time required to strip off some options prior to doing a cache search seems likely to offset much
+	// of the cache's benefit.
+	UINT hash = RegExCache::Hash(aRegEx);
+	if (auto entry = cache->Find(aRegEx, hash))
+	{
+		aExtra = entry->extra;
+		if (aOptionsLength) // Lexikos: See aOptionsLength comment at beginning of this function.
+			*aOptionsLength = entry->options_length;
+		if (aPinned)
+			++(*aPinned = entry)->pin_count;
+		return entry->re_compiled; // Indicate success.
+	}
+
+	// Since the above didn't return, this RegEx isn't yet in the cache.  So compile it and put it in
+	// the cache, then return it to caller.
+	int options_length;
+	pcret *re_compiled = compile_regex(aRegEx, aExtra, options_length, aResultToken);
+	if (!re_compiled)
+		return NULL; // Caller should ignore the contents of the output parameters.
+
 	// ADD THE NEWLY-COMPILED REGEX TO THE CACHE.
-	// An earlier stage has set insert_pos to be the desired insert-position in the cache.
-	pcre_cache_entry &this_entry = sCache[insert_pos]; // For performance and convenience.
-	if (this_entry.re_compiled) // An existing cache item is being overwritten, so free it's attributes.
+	auto entry = (pcre_cache_entry *)malloc(sizeof(pcre_cache_entry));
+	if (!entry || !(entry->re_raw = _tcsdup(aRegEx))) // _strdup() is very tiny and basically just calls _tcslen+malloc+_tcscpy.
 	{
-		// Free the old cache entry's attributes in preparation for overwriting them with the new one's.
-		free(this_entry.re_raw);           // Free the uncompiled pattern.
-		pcret_free(this_entry.re_compiled); // Free the compiled pattern.
-		if (this_entry.extra)
-			pcret_free_study(this_entry.extra);
+		free(entry);
+		pcret_free(re_compiled);
+		if (aExtra)
+			pcret_free_study(aExtra);
+		if (aResultToken)
+			aResultToken->MemoryError();
+		return NULL;
 	}
-	//else the insert-position is an empty slot, which is usually the case because most scripts contain fewer than
-	// PCRE_CACHE_SIZE unique regex's.  Nothing extra needs to be done.
-	this_entry.re_raw = _tcsdup(aRegEx); // _strdup() is very tiny and basically just calls _tcslen+malloc+_tcscpy.
-	this_entry.re_compiled = re_compiled;
-	this_entry.extra = aExtra;
-	// "this_entry.pcre_options" doesn't exist because it isn't currently needed in the cache.  This is
+	entry->re_compiled = re_compiled;
+	entry->extra = aExtra;
+	// "entry->pcre_options" doesn't exist because it isn't currently needed in the cache.  This is
 	// because the RE's options are implicitly stored inside re_compiled.
 
-	// Lexikos: See aOptionsLength comment at beginning of this function.
-	this_entry.options_length = (int)(pat - aRegEx);
+	entry->options_length = options_length;
 
 	if (aOptionsLength) 
-		*aOptionsLength = this_entry.options_length;
-
-	sLastInsert = insert_pos; // v1.0.45.03: Must be done only *after* the insert succeeded because some things rely on sLastInsert being synonymous with the last populated item in the cache (when the cache isn't yet full).
-	sLastFound = sLastInsert; // Relied upon in the case where sLastFound==-1. But it also sets things up to start the search at this item next time, because it's a bit more likely to be found here such as tight loops containing only one RegEx.
-	// Remember that although sLastFound==sLastInsert in this case, it isn't always so -- namely when a previous
-	// call found an existing match in the cache without having to compile and insert the item.
+		*aOptionsLength = entry->options_length;
 
-	LeaveCriticalSection(&g_CriticalRegExCache);
+	entry->pin_count = aPinned ? 1 : 0;
+	if (aPinned)
+		*aPinned = entry;
+	cache->Add(entry, hash); // Evicts the least recently used RegEx if the cache is full.
 	return re_compiled; // Indicate success.
+}
 
-match_found: // RegEx was found in the cache at position sLastFound, so return the cached info back to the caller.
-	aExtra = sCache[sLastFound].extra;
-	if (aOptionsLength) // Lexikos: See aOptionsLength comment at beginning of this function.
-		*aOptionsLength = sCache[sLastFound].options_length; 
 
-	LeaveCriticalSection(&g_CriticalRegExCache);
-	return sCache[sLastFound].re_compiled; // Indicate success.
 
-error: // Since NULL is returned here, caller should ignore the contents of the output parameters.
-	LeaveCriticalSection(&g_CriticalRegExCache);
-	return NULL; // Indicate failure.
+void unpin_compiled_regex(pcre_cache_entry *aEntry)
+// Allows a RegEx pinned by get_compiled_regex() to be evicted from the cache again.
+{
+	if (!--aEntry->pin_count && aEntry->evicted)
+		RegExCache::Free(aEntry);
 }
 
+struct RegExPin
+{
+	pcre_cache_entry *entry = nullptr;
+	~RegExPin() { if (entry) unpin_compiled_regex(entry); }
+};
+
 
 
 LPCTSTR RegExMatch(LPCTSTR aHaystack, LPCTSTR aNeedleRegEx)
@@ -861,8 +967,18 @@ void RegExReplace(ResultToken &aResultToken, ExprTokenType *aParam[], int aParam
 					//    new_result_length - haystack_portion_length - (aOffset[1] - aOffset[0])
 					// Above is the length difference between the current replacement text and what it's
 					// replacing (it's negative when replacement is smaller than what it replaces).
-					REGEX_REALLOC((int)PredictReplacementSize((new_result_length - match_end_offset) / replacement_count // See above.
-						, replacement_count, limit, aHaystackLength, new_result_length+2, match_end_offset)); // +2 in case of empty_string_is_not_a_match (which needs room for up to two extra characters).  The function will also do another +1 to convert length to size (for terminator).
+					size_t predicted_size = PredictReplacementSize((new_result_length - match_end_offset) / replacement_count // See above.
+						, replacement_count, limit, aHaystackLength, new_result_length+2, match_end_offset); // +2 in case of empty_string_is_not_a_match (which needs room for up to two extra characters).  The function will also do another +1 to convert length to size (for terminator).
+					// If the prediction turns out to be too low again and again (such as when later replacements
+					// are longer than earlier ones), growing by only that much each time would make the total
+					// cost of copying quadratic.  So grow by at least half the current size, which keeps it
+					// linear even for strings of hundreds of megabytes.
+					size_t min_size = (size_t)result_size + result_size / 2;
+					if (predicted_size < min_size)
+						predicted_size = min_size;
+					if (predicted_size > INT_MAX)
+						predicted_size = INT_MAX; // PCRE limits lengths to int anyway.
+					REGEX_REALLOC((int)predicted_size);
 					// The above will return if an alloc error occurs.
 				}
 				//else result_size is not only large enough, but also non-zero.  Other sections rely on it always
@@ -1089,9 +1205,10 @@ BIF_DECL(BIF_RegEx)
 	pcret_extra *extra;
 	pcret *re;
 	int options_length;
+	RegExPin pin; // Keeps re valid even if a callout causes it to be evicted from the cache.
 
 	// COMPILE THE REGEX OR GET IT FROM CACHE.
-	if (   !(re = get_compiled_regex(needle, extra, &options_length, &aResultToken))   ) // Compiling problem.
+	if (   !(re = get_compiled_regex(needle, extra, &options_length, &aResultToken, &pin.entry))   ) // Compiling problem.
 		return; // It already set aResultToken for us.
 
 	// Since compiling succeeded, get info about other parameters.
@@ -1202,3 +1319,528 @@ BIF_DECL(BIF_RegEx)
 	else // Out-of-memory or there were no captured patterns.
 		output_var->Assign();
 }
+
+
+
+class RegExMatchEnum : public EnumBase
+// Enumerates the matches of a RegEx for RegExMatchAll().  Unlike a script loop calling RegExMatch()
+// with an advancing StartingPos, this looks up the RegEx only once, reuses one offset array, and
+// creates a RegExMatchInfo only for loops which actually retrieve it.
+{
+	LPTSTR mHaystack; // A copy, since the caller's string might be changed or freed during the loop.
+	int mHaystackLength;
+	int mStartingOffset;
+	int mExecOptions = 0; // PCRE_NOTEMPTY_ATSTART after an empty match, to ensure progress.
+	pcret *mRE;
+	pcret_extra mExtra; // A copy, so that PCRE_EXTRA_MARK can point at mMark without affecting other users of the cached RegEx.
+	pcre_cache_entry *mPinned; // Keeps mRE valid for the lifetime of the enumerator.
+	LPTSTR mMark;
+	int mPatternCount;
+	int *mOffset;
+	RegExCalloutData mCalloutData; // Supports (?C) callouts, as in RegExMatch().
+
+public:
+	RegExMatchEnum(LPTSTR aHaystack, int aHaystackLength, int aStartingOffset
+		, pcret *aRE, pcret_extra *aExtra, pcre_cache_entry *aPinned, int aPatternCount, int *aOffset
+		, LPTSTR aNeedle, int aOptionsLength)
+		: mHaystack(aHaystack), mHaystackLength(aHaystackLength), mStartingOffset(aStartingOffset)
+		, mRE(aRE), mPinned(aPinned), mPatternCount(aPatternCount), mOffset(aOffset)
+	{
+		if (aExtra)
+			mExtra = *aExtra;
+		else
+			mExtra.flags = 0;
+		mExtra.flags |= PCRE_EXTRA_CALLOUT_DATA | PCRE_EXTRA_MARK;
+		mExtra.callout_data = &mCalloutData;
+		mExtra.mark = UorA(wchar_t **, UCHAR **) &mMark;
+		mCalloutData.re = aRE;
+		mCalloutData.re_text = aNeedle;
+		mCalloutData.options_length = aOptionsLength;
+		mCalloutData.pattern_count = aPatternCount;
+		mCalloutData.extra = &mExtra;
+		mCalloutData.result_token = nullptr; // Set by Next().
+	}
+
+	~RegExMatchEnum()
+	{
+		free(mHaystack);
+		free(mCalloutData.re_text);
+		free(mOffset);
+		unpin_compiled_regex(mPinned);
+	}
+
+	ResultType Next(Var *aVar0, Var *aVar1) override
+	{
+		if (mStartingOffset > mHaystackLength)
+			return CONDITION_FALSE; // Already finished.
+		FuncResult callout_result; // Receives any error raised by a callout, or its exit result.
+		mCalloutData.result_token = &callout_result;
+		int captured_pattern_count = pcret_exec(mRE, &mExtra, mHaystack, mHaystackLength
+			, mStartingOffset, mExecOptions, mOffset, mPatternCount * 3);
+		if (captured_pattern_count < 0)
+		{
+			mStartingOffset = mHaystackLength + 1; // Don't search again.
+			if (captured_pattern_count == PCRE_ERROR_NOMATCH)
+				return CONDITION_FALSE;
+			if (callout_result.Exited()) // A callout exited/raised an error.
+				return callout_result.Result();
+			TCHAR err_info[MAX_INTEGER_SIZE];
+			ITOA(captured_pattern_count, err_info);
+			return g_script.RuntimeError(ERR_PCRE_EXEC, err_info);
+		}
+		// Resume at the end of this match.  If it was empty, require the next one to be non-empty
+		// if it is found at the same position (as RegExReplace does).
+		mStartingOffset = mOffset[1];
+		mExecOptions = mOffset[0] == mOffset[1] ? PCRE_NOTEMPTY_ATSTART : 0;
+
+		Var *match_var = aVar1 ? aVar1 : aVar0; // for Match in ... or for Pos, Match in ...
+		if (aVar1 && aVar0)
+			aVar0->Assign(mOffset[0] + 1);
+		if (match_var)
+		{
+			IObject *match_object;
+			if (!RegExCreateMatchArray(mHaystack, mRE, &mExtra, mOffset, mPatternCount, captured_pattern_count, match_object))
+				return MemoryError();
+			match_var->AssignSkipAddRef(match_object);
+		}
+		return CONDITION_TRUE;
+	}
+};
+
+
+BIF_DECL(BIF_RegExMatchAll)
+// RegExMatchAll(Haystack, NeedleRegEx [, StartingPos]): Returns an enumerator of RegExMatchInfo objects.
+{
+	if (ParamIndexToObject(0))
+		_f_throw_param(0, _T("String"));
+	if (ParamIndexToObject(1))
+		_f_throw_param(1, _T("String"));
+	LPTSTR needle = ParamIndexToString(1, _f_number_buf);
+
+	pcret_extra *extra;
+	pcre_cache_entry *pinned;
+	int options_length;
+	pcret *re = get_compiled_regex(needle, extra, &options_length, &aResultToken, &pinned);
+	if (!re)
+		return; // It already set aResultToken for us.
+	RegExPin pin; // Released unless ownership passes to the enumerator.
+	pin.entry = pinned;
+
+	TCHAR haystack_buf[MAX_NUMBER_SIZE];
+	size_t temp_length;
+	LPTSTR haystack = ParamIndexToString(0, haystack_buf, &temp_length);
+	int haystack_length = (int)temp_length;
+
+	int starting_offset = 0;
+	if (!ParamIndexIsOmitted(2))
+	{
+		Throw_if_Param_NaN(2);
+		starting_offset = ParamIndexToInt(2); // Same convention as RegExMatch.
+		if (starting_offset <= 0)
+		{
+			starting_offset += haystack_length;
+			if (starting_offset < 0)
+				starting_offset = 0;
+		}
+		else if (starting_offset > haystack_length)
+			starting_offset = haystack_length;
+		else
+			--starting_offset;
+	}
+
+	int pattern_count;
+	pcret_fullinfo(re, extra, PCRE_INFO_CAPTURECOUNT, &pattern_count);
+	++pattern_count; // Include the entire-pattern match.
+	LPTSTR haystack_copy = tmalloc(haystack_length + 1);
+	LPTSTR needle_copy = _tcsdup(needle); // Passed to callouts.
+	int *offset = (int *)malloc(pattern_count * 3 * sizeof(int));
+	if (!haystack_copy || !needle_copy || !offset)
+	{
+		free(haystack_copy);
+		free(needle_copy);
+		free(offset);
+		_f_throw_oom;
+	}
+	tmemcpy(haystack_copy, haystack, haystack_length + 1);
+	pin.entry = NULL; // The enumerator now owns the pin.
+	_f_return(new RegExMatchEnum(haystack_copy, haystack_length, starting_offset, re, extra, pinned, pattern_count, offset
+		, needle_copy, options_length));
+}
+
+
+
+BIF_DECL(BIF_RegExCache)
+// RegExCache([Capacity]): Returns statistics for the current thread's RegEx cache, after applying
+// the new Capacity (if specified) to the caches of all threads.
+{
+	if (!ParamIndexIsOmitted(0))
+	{
+		Throw_if_Param_NaN(0);
+		__int64 capacity = ParamIndexToInt64(0);
+		if (capacity < 1 || capacity > INT_MAX)
+			_f_throw_param(0);
+		RegExCache::sCapacity = (int)capacity; // Other threads apply it when they next add a RegEx.
+	}
+	RegExCache *cache = tRegExCache.get();
+	if (cache)
+		cache->Trim(RegExCache::sCapacity);
+	Object *info = Object::Create();
+	if (!info
+		|| !info->SetOwnProp(_T("Capacity"), (__int64)RegExCache::sCapacity)
+		|| !info->SetOwnProp(_T("Count"), (__int64)(cache ? cache->mCount : 0))
+		|| !info->SetOwnProp(_T("Hits"), cache ? cache->mHits : 0)
+		|| !info->SetOwnProp(_T("Misses"), cache ? cache->mMisses : 0))
+	{
+		if (info)
+			info->Release();
+		_f_throw_oom;
+	}
+	_f_return(info);
+}
+
+
+
+
+
+
+//
+// RegExSet
+//
+
+struct RegExSetLiteral
+{
+	LPTSTR text;
+	int length;
+	int pattern; // Index of the pattern which requires this literal.
+	bool caseless;
+	RegExSetLiteral *next; // Next literal in the same bucket.
+};
+
+struct RegExSetData
+// The compiled patterns of a RegExSet, plus a table of literals which must occur in the haystack for
+// each pattern to match.  A single scan of the haystack for these literals rules out most patterns,
+// so that only the remaining ones need to be executed.
+{
+	struct Pattern
+	{
+		pcret *re;
+		pcret_extra *extra;
+		bool has_literal;
+	};
+	Pattern *pattern;
+	int count;
+	int literal_count;
+	RegExSetLiteral *literal;
+	// Literals of one character are looked up by that character, others by their first two.
+	// Characters are folded to lowercase so that caseless literals can share the table.
+	#define RXS_BUCKET1(c) (ctolower(c) & 0xFF)
+	#define RXS_BUCKET2(c0, c1) (((ctolower(c0) & 0x3F) << 6) | (ctolower(c1) & 0x3F))
+	RegExSetLiteral *bucket1[0x100];
+	RegExSetLiteral *bucket2[0x1000];
+};
+
+
+static int regex_required_literal(LPCTSTR aRegEx, LPTSTR aBuf, int aBufSize, bool &aCaseless)
+// Finds a run of literal characters which any match of aRegEx must begin with, so that there's no
+// need to execute the RegEx if they don't occur in the haystack.  Returns the length of the literal
+// stored in aBuf, or 0 if none could be found.  This is conservative: anything that isn't obviously
+// literal, such as escapes other than punctuation, ends the literal.
+{
+	// Parse the options the same way as compile_regex().
+	LPCTSTR pat = aRegEx + _tcsspn(aRegEx, _T("imsxADJUXCS \t\a\n\r"));
+	if (*pat == ')')
+		++pat;
+	else
+		pat = aRegEx; // No options.
+	aCaseless = false;
+	for (LPCTSTR cp = aRegEx; cp < pat; ++cp)
+		if (*cp == 'x') // Whitespace and # would have special meaning.
+			return 0;
+		else if (*cp == 'i')
+			aCaseless = true;
+
+	// A top-level alternation means that no particular literal is required.
+	int depth = 0;
+	for (LPCTSTR cp = pat; *cp; ++cp)
+	{
+		switch (*cp)
+		{
+		case '\\':
+			if (cp[1] == 'Q') // Rare, so don't bother finding the end of the quoted section.
+				return 0;
+			if (cp[1])
+				++cp;
+			break;
+		case '[':
+			// Skip the class, allowing for a leading ']' or '^]' and escaped characters.
+			cp += cp[1] == '^' ? 2 : 1;
+			if (*cp == ']')
+				++cp;
+			for (; *cp && *cp != ']'; ++cp)
+				if (*cp == '\\' && cp[1])
+					++cp;
+			if (!*cp)
+				return 0; // Invalid, but let PCRE report it.
+			break;
+		case '(': ++depth; break;
+		case ')': --depth; break;
+		case '|':
+			if (depth <= 0)
+				return 0;
+		}
+	}
+
+	// Skip zero-width assertions which commonly begin a pattern.
+	for (;;)
+	{
+		if (*pat == '^')
+			++pat;
+		else if (*pat == '\\' && (pat[1] == 'b' || pat[1] == 'A' || pat[1] == 'G'))
+			pat += 2;
+		else
+			break;
+	}
+
+	int length = 0;
+	while (length < aBufSize)
+	{
+		TCHAR ch;
+		if (*pat == '\\' && pat[1] && (TBYTE)pat[1] < 0x80 && !cisalnum(pat[1])) // Escaped punctuation.
+			ch = pat[1], pat += 2;
+		else if (*pat && !_tcschr(_T("\\.^$|?*+()[]{}"), *pat))
+			ch = *pat++;
+		else
+			break;
+		// ctolower() only folds ASCII, whereas PCRE also matches K and S with the Kelvin sign and long s.
+		if (aCaseless && ((TBYTE)ch >= 0x80 || _tcschr(_T("KkSs"), ch)))
+			break;
+		if (*pat == '?' || *pat == '*' || *pat == '{') // This character is optional or its count is unknown.
+			break;
+		aBuf[length++] = ch;
+		if (*pat == '+') // The following characters won't be adjacent to this one.
+			break;
+	}
+	return length;
+}
+
+
+static bool regex_set_literal_at(RegExSetLiteral *aLiteral, LPCTSTR aText, int aLength)
+{
+	if (aLiteral->length > aLength)
+		return false;
+	if (!aLiteral->caseless)
+		return !tmemcmp(aLiteral->text, aText, aLiteral->length);
+	for (int i = 0; i < aLiteral->length; ++i)
+		if (ctolower(aLiteral->text[i]) != ctolower(aText[i]))
+			return false;
+	return true;
+}
+
+
+static void regex_set_prefilter(RegExSetData &aData, LPCTSTR aHaystack, int aLength, char *aCandidate)
+// Sets aCandidate[i] for each pattern i whose required literal occurs in aHaystack.
+{
+	int remaining = aData.literal_count;
+	for (int i = 0; i < aLength && remaining; ++i)
+	{
+		LPCTSTR text = aHaystack + i;
+		RegExSetLiteral *lit = aData.bucket1[RXS_BUCKET1(*text)];
+		if (i + 1 < aLength)
+		{
+			// Single-character literals are rare, so check the two-character bucket first.
+			for (auto lit2 = aData.bucket2[RXS_BUCKET2(text[0], text[1])]; lit2; lit2 = lit2->next)
+				if (!aCandidate[lit2->pattern] && regex_set_literal_at(lit2, text, aLength - i))
+				{
+					aCandidate[lit2->pattern] = 1;
+					--remaining;
+				}
+		}
+		for (; lit; lit = lit->next)
+			if (!aCandidate[lit->pattern] && regex_set_literal_at(lit, text, 1))
+			{
+				aCandidate[lit->pattern] = 1;
+				--remaining;
+			}
+	}
+}
+
+
+static void regex_set_free(RegExSetData *aData)
+{
+	if (!aData)
+		return;
+	for (int i = 0; i < aData->count; ++i)
+	{
+		pcret_free(aData->pattern[i].re);
+		if (aData->pattern[i].extra)
+			pcret_free_study(aData->pattern[i].extra);
+	}
+	for (int i = 0; i < aData->literal_count; ++i)
+		free(aData->literal[i].text);
+	free(aData->pattern);
+	free(aData->literal);
+	free(aData);
+}
+
+
+RegExSetObject *RegExSetObject::Create()
+{
+	auto obj = new RegExSetObject();
+	obj->SetBase(sPrototype);
+	return obj;
+}
+
+
+RegExSetObject::~RegExSetObject()
+{
+	regex_set_free(mData);
+}
+
+
+void RegExSetObject::Invoke(ResultToken &aResultToken, int aID, int aFlags, ExprTokenType *aParam[], int aParamCount)
+{
+	switch (aID)
+	{
+	case M___New: SetPatterns(aResultToken, aParam, aParamCount); return;
+	case M_MatchAny: Match(aResultToken, aParam, aParamCount, false); return;
+	case M_Matches: Match(aResultToken, aParam, aParamCount, true); return;
+	case P_Count: _o_return(mData ? mData->count : 0);
+	}
+}
+
+
+void RegExSetObject::SetPatterns(ResultToken &aResultToken, ExprTokenType *aParam[], int aParamCount)
+{
+	// The patterns are compiled here rather than being put in the RegEx cache, since a large set
+	// would otherwise evict everything else, or itself.
+	auto data = (RegExSetData *)calloc(1, sizeof(RegExSetData));
+	if (data)
+	{
+		data->pattern = (RegExSetData::Pattern *)malloc(aParamCount * sizeof(RegExSetData::Pattern));
+		data->literal = (RegExSetLiteral *)malloc(aParamCount * sizeof(RegExSetLiteral));
+	}
+	if (!data || !data->pattern || !data->literal)
+	{
+		regex_set_free(data);
+		_o_throw_oom;
+	}
+	TCHAR literal_buf[64];
+	for (int i = 0; i < aParamCount; ++i)
+	{
+		if (ParamIndexToObject(i))
+		{
+			regex_set_free(data);
+			_o_throw_param(i, _T("String"));
+		}
+		LPTSTR regex = ParamIndexToString(i, _f_number_buf);
+		auto &pattern = data->pattern[i];
+		int options_length;
+		if (  !(pattern.re = compile_regex(regex, pattern.extra, options_length, &aResultToken))  )
+		{
+			regex_set_free(data);
+			return; // It already set aResultToken for us.
+		}
+		++data->count;
+
+		bool caseless;
+		int length = regex_required_literal(regex, literal_buf, _countof(literal_buf), caseless);
+		pattern.has_literal = false;
+		if (!length)
+			continue;
+		auto &lit = data->literal[data->literal_count];
+		if (  !(lit.text = tmalloc(length))  )
+			continue; // Just treat it as having no literal.
+		tmemcpy(lit.text, literal_buf, length);
+		lit.length = length;
+		lit.pattern = i;
+		lit.caseless = caseless;
+		auto &bucket = length == 1 ? data->bucket1[RXS_BUCKET1(lit.text[0])]
+			: data->bucket2[RXS_BUCKET2(lit.text[0], lit.text[1])];
+		lit.next = bucket;
+		bucket = &lit;
+		++data->literal_count;
+		pattern.has_literal = true;
+	}
+	regex_set_free(mData);
+	mData = data;
+}
+
+
+void RegExSetObject::Match(ResultToken &aResultToken, ExprTokenType *aParam[], int aParamCount, bool aFindAll)
+{
+	if (ParamIndexToObject(0))
+		_o_throw_param(0, _T("String"));
+	TCHAR haystack_buf[MAX_NUMBER_SIZE];
+	size_t temp_length;
+	LPTSTR haystack = ParamIndexToString(0, haystack_buf, &temp_length);
+	int haystack_length = (int)temp_length;
+
+	int starting_offset = 0;
+	if (!ParamIndexIsOmitted(1))
+	{
+		Throw_if_Param_NaN(1);
+		starting_offset = ParamIndexToInt(1); // Same convention as RegExMatch.
+		if (starting_offset <= 0)
+		{
+			starting_offset += haystack_length;
+			if (starting_offset < 0)
+				starting_offset = 0;
+		}
+		else if (starting_offset > haystack_length)
+			starting_offset = haystack_length;
+		else
+			--starting_offset;
+	}
+
+	Array *result = NULL;
+	if (aFindAll && !(result = Array::Create()))
+		_o_throw_oom;
+	int count = mData ? mData->count : 0; // mData is NULL if __New failed.
+	char *candidate = count ? (char *)calloc(count, 1) : NULL;
+	if (count && !candidate)
+	{
+		if (result)
+			result->Release();
+		_o_throw_oom;
+	}
+	if (count)
+		regex_set_prefilter(*mData, haystack + starting_offset, haystack_length - starting_offset, candidate);
+
+	// Execute each pattern which wasn't ruled out above, in order.
+	int found = 0;
+	int offset[3];
+	for (int i = 0; i < count; ++i)
+	{
+		auto &pattern = mData->pattern[i];
+		if (pattern.has_literal && !candidate[i])
+			continue;
+		int exec_result = pcret_exec(pattern.re, pattern.extra, haystack, haystack_length
+			, starting_offset, 0, offset, _countof(offset));
+		if (exec_result == PCRE_ERROR_NOMATCH)
+			continue;
+		if (exec_result < 0) // Some kind of error.  0 just means offset[] was too small, which is fine.
+		{
+			free(candidate);
+			if (result)
+				result->Release();
+			TCHAR err_info[MAX_INTEGER_SIZE];
+			ITOA(exec_result, err_info);
+			_o_throw(ERR_PCRE_EXEC, err_info);
+		}
+		if (!aFindAll)
+		{
+			found = i + 1;
+			break;
+		}
+		if (!result->Append(i + 1))
+		{
+			free(candidate);
+			result->Release();
+			_o_throw_oom;
+		}
+	}
+	free(candidate);
+	if (result)
+		_o_return(result);
+	_o_return(found); // 0 if no pattern matched.
+}
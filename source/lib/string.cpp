@@ -19,6 +19,8 @@ GNU General Public License for more details.
 #include "globaldata.h"
 #include "script_func_impl.h"
 #include <shlwapi.h> // StrCmpLogicalW
+#include <algorithm>
+#include <thread>
 
 
 
@@ -719,64 +721,115 @@ BIF_DECL(BIF_SplitPath)
 
 
 
-int SortWithOptions(const void *a1, const void *a2)
-// Decided to just have one sort function since there are so many permutations.  The performance
-// will be a little bit worse, but it seems simpler to implement and maintain.
-// This function's input parameters are pointers to the elements of the array.  Since those elements
-// are themselves pointers, the input parameters are therefore pointers to pointers (handles).
+// Sort options are kept in a context passed to each comparison rather than in globals, so that
+// Sort() is reentrant (a callback can call Sort) and so that comparisons can run on worker threads.
+struct SortContext
 {
-	LPTSTR sort_item1 = *(LPTSTR *)a1;
-	LPTSTR sort_item2 = *(LPTSTR *)a2;
-	if (g_SortColumnOffset > 0)
+	StringCaseSenseType case_sense = SCS_INSENSITIVE;
+	bool numeric = false;
+	bool reverse = false;
+	int column_offset = 0; // Zero-based.
+	IObject *func = nullptr;
+	ResultType func_result = OK;
+};
+
+
+// For all modes other than Random and a custom function, the part of each item which is compared
+// (its column or naked filename) and its numeric value are found once up front rather than on every
+// comparison.  Ties are broken by the position of the item, so the sort is stable.
+struct SortKey
+{
+	LPTSTR item;
+	LPTSTR key;
+	double number;
+};
+
+struct SortKeyLess
+{
+	const SortContext &ctx;
+	bool numeric; // ctx.numeric, unless overridden by another mode.
+
+	static int ItemOrder(const SortKey &a, const SortKey &b)
+	// Returns 0 for an item compared with itself, which std::sort requires of a strict weak ordering.
 	{
-		// Adjust each string (even for numerical sort) to be the right column position,
-		// or the position of its zero terminator if the column offset goes beyond its length:
-		size_t length = _tcslen(sort_item1);
-		sort_item1 += (size_t)g_SortColumnOffset > length ? length : g_SortColumnOffset;
-		length = _tcslen(sort_item2);
-		sort_item2 += (size_t)g_SortColumnOffset > length ? length : g_SortColumnOffset;
+		return (a.item < b.item) ? -1 : (a.item > b.item) ? 1 : 0;
 	}
-	if (g_SortNumeric) // Takes precedence over g_SortCaseSensitive
+
+	int Compare(const SortKey &a, const SortKey &b) const
 	{
-		// For now, assume both are numbers.  If one of them isn't, it will be sorted as a zero.
-		// Thus, all non-numeric items should wind up in a sequential, unsorted group.
-		// Resolve only once since parts of the ATOF() macro are inline:
-		double item1_minus_2 = ATOF(sort_item1) - ATOF(sort_item2);
-		if (!item1_minus_2) // Exactly equal.
-			return (sort_item1 > sort_item2) ? 1 : -1; // Stable sort.
-		// Otherwise, it's either greater or less than zero:
-		int result = (item1_minus_2 > 0.0) ? 1 : -1;
-		return g_SortReverse ? -result : result;
+		if (numeric) // Takes precedence over case_sense.
+		{
+			// For now, assume both are numbers.  If one of them isn't, it will be sorted as a zero.
+			// Thus, all non-numeric items should wind up in a sequential, unsorted group.
+			if (a.number == b.number) // Exactly equal.
+				return ItemOrder(a, b); // Stable sort.
+			int result = (a.number > b.number) ? 1 : -1;
+			return ctx.reverse ? -result : result;
+		}
+		// Otherwise, it's a non-numeric sort.
+		// v1.0.43.03: Added support the new locale-insensitive mode.
+		int result = (ctx.case_sense != SCS_INSENSITIVE_LOGICAL)
+			? tcscmp2(a.key, b.key, ctx.case_sense) // Resolve large macro only once for code size reduction.
+			: StrCmpLogicalW(a.key, b.key);
+		if (!result)
+			result = ItemOrder(a, b); // Stable sort.
+		return ctx.reverse ? -result : result;
 	}
-	// Otherwise, it's a non-numeric sort.
-	// v1.0.43.03: Added support the new locale-insensitive mode.
-	int result = (g_SortCaseSensitive != SCS_INSENSITIVE_LOGICAL)
-		? tcscmp2(sort_item1, sort_item2, g_SortCaseSensitive) // Resolve large macro only once for code size reduction.
-		: StrCmpLogicalW(sort_item1, sort_item2);
-	if (!result)
-		result = (sort_item1 > sort_item2) ? 1 : -1; // Stable sort.
-	return g_SortReverse ? -result : result;
-}
+
+	bool operator()(const SortKey &a, const SortKey &b) const
+	{
+		return Compare(a, b) < 0;
+	}
+};
 
 
+// Inputs smaller than this are sorted on the calling thread, since the cost of starting threads
+// would outweigh the gain.  Each thread's share of the work is also kept at least this large.
+#define SORT_PARALLEL_MIN_ITEMS 32768
 
-int SortByNakedFilename(const void *a1, const void *a2)
-// See comments in prior function for details.
+template<typename T, typename Less>
+static void ParallelMergeSort(T *aItem, T *aBuf, size_t aCount, int aDepth, const Less &aLess)
+// Sorts the two halves on separate threads (recursively, aDepth levels deep), then merges them via aBuf.
 {
-	LPTSTR sort_item1 = *(LPTSTR *)a1;
-	LPTSTR sort_item2 = *(LPTSTR *)a2;
-	LPTSTR cp;
-	if (cp = _tcsrchr(sort_item1, '\\'))  // Assign
-		sort_item1 = cp + 1;
-	if (cp = _tcsrchr(sort_item2, '\\'))  // Assign
-		sort_item2 = cp + 1;
-	// v1.0.43.03: Added support the new locale-insensitive mode.
-	int result = (g_SortCaseSensitive != SCS_INSENSITIVE_LOGICAL)
-		? tcscmp2(sort_item1, sort_item2, g_SortCaseSensitive) // Resolve large macro only once for code size reduction.
-		: StrCmpLogicalW(sort_item1, sort_item2);
-	if (!result)
-		result = (sort_item1 > sort_item2) ? 1 : -1; // Stable sort.
-	return g_SortReverse ? -result : result;
+	if (aDepth <= 0 || aCount < SORT_PARALLEL_MIN_ITEMS * 2)
+	{
+		std::sort(aItem, aItem + aCount, aLess);
+		return;
+	}
+	size_t half = aCount / 2;
+	std::thread worker;
+	try
+	{
+		worker = std::thread([=, &aLess] { ParallelMergeSort(aItem, aBuf, half, aDepth - 1, aLess); });
+	}
+	catch (...) // Couldn't start a thread, so just do the work on this one.
+	{
+		ParallelMergeSort(aItem, aBuf, half, 0, aLess);
+	}
+	ParallelMergeSort(aItem + half, aBuf + half, aCount - half, aDepth - 1, aLess);
+	if (worker.joinable())
+		worker.join();
+	std::merge(aItem, aItem + half, aItem + half, aItem + aCount, aBuf, aLess);
+	std::copy(aBuf, aBuf + aCount, aItem);
+}
+
+template<typename T, typename Less>
+static void ParallelSort(T *aItem, size_t aCount, const Less &aLess)
+// Comparisons are performed concurrently, so aLess must not depend on any thread-specific state.
+{
+	int depth = 0;
+	for (size_t threads = std::thread::hardware_concurrency(), count = aCount
+		; threads > 1 && count >= SORT_PARALLEL_MIN_ITEMS * 2
+		; threads = (threads + 1) / 2, count /= 2)
+		++depth;
+	T *buf = depth ? (T *)malloc(aCount * sizeof(T)) : nullptr;
+	if (!buf) // Input too small, single core, or insufficient memory for the merge buffer.
+	{
+		std::sort(aItem, aItem + aCount, aLess);
+		return;
+	}
+	ParallelMergeSort(aItem, buf, aCount, depth, aLess);
+	free(buf);
 }
 
 
@@ -799,10 +852,11 @@ int SortRandom(const void *a1, const void *a2)
 	return ((sort_rand_type *)a1)->rand - ((sort_rand_type *)a2)->rand;
 }
 
-int SortUDF(const void *a1, const void *a2)
+int SortUDF(void *aContext, const void *a1, const void *a2)
 // See comments in prior function for details.
 {
-	if (!g_SortFuncResult || g_SortFuncResult == EARLY_EXIT)
+	auto &ctx = *(SortContext *)aContext;
+	if (!ctx.func_result || ctx.func_result == EARLY_EXIT)
 		return 0;
 
 	// The following isn't necessary because by definition, the current thread isn't paused because it's the
@@ -813,8 +867,8 @@ int SortUDF(const void *a1, const void *a2)
 	LPTSTR aStr2 = *(LPTSTR *)a2;
 	ExprTokenType param[] = { aStr1, aStr2, __int64(aStr2 - aStr1) };
 	__int64 i64;
-	g_SortFuncResult = CallMethod(g_SortFunc, g_SortFunc, nullptr, param, _countof(param), &i64);
-	// An alternative to g_SortFuncResult using 'throw' to abort qsort() produced slightly
+	ctx.func_result = CallMethod(ctx.func, ctx.func, nullptr, param, _countof(param), &i64);
+	// An alternative to func_result using 'throw' to abort qsort() produced slightly
 	// smaller code, but in release builds the program crashed with code 0xC0000409 and the
 	// catch() block never executed.
 
@@ -834,20 +888,14 @@ BIF_DECL(BIF_Sort)
 	// Set defaults in case of early goto:
 	LPTSTR mem_to_free = NULL;
 	LPTSTR *item = NULL; // The index/pointer list used for the sort.
-	IObject *sort_func_orig = g_SortFunc; // Because UDFs can be interrupted by other threads -- and because UDFs can themselves call Sort with some other UDF (unlikely to be sure) -- backup & restore original g_SortFunc so that the "collapsing in reverse order" behavior will automatically ensure proper operation.
-	ResultType sort_func_result_orig = g_SortFuncResult;
-	g_SortFunc = NULL; // Now that original has been saved above, reset to detect whether THIS sort uses a UDF.
-	g_SortFuncResult = OK;
+	SortKey *sort_key = NULL;
+	SortContext ctx;
 
 	_f_param_string(aContents, 0);
 	_f_param_string_opt(aOptions, 1);
 
 	// Resolve options.  First set defaults for options:
 	TCHAR delimiter = '\n';
-	g_SortCaseSensitive = SCS_INSENSITIVE;
-	g_SortNumeric = false;
-	g_SortReverse = false;
-	g_SortColumnOffset = 0;
 	bool trailing_delimiter_indicates_trailing_blank_item = false, terminate_last_item_with_delimiter = false
 		, trailing_crlf_added_temporarily = false, sort_by_naked_filename = false, sort_random = false
 		, omit_dupes = false;
@@ -863,7 +911,7 @@ BIF_DECL(BIF_Sort)
 				if (!_tcsnicmp(cp+2, _T("Logical") + 1, 6)) // CLogical.  Using "Logical" + 1 instead of "ogical" was confirmed to eliminate one string from the binary (due to string pooling).
 				{
 					cp += 7;
-					g_SortCaseSensitive = SCS_INSENSITIVE_LOGICAL;
+					ctx.case_sense = SCS_INSENSITIVE_LOGICAL;
 				}
 				else
 				{
@@ -871,21 +919,21 @@ BIF_DECL(BIF_Sort)
 						cp += 6;
 					else // CL
 						++cp;
-					g_SortCaseSensitive = SCS_INSENSITIVE_LOCALE;
+					ctx.case_sense = SCS_INSENSITIVE_LOCALE;
 				}
 			}
 			else if (!_tcsnicmp(cp+1, _T("Off"), 3)) // COff.  Using ctoupper() here significantly increased code size.
 			{
 				cp += 3;
-				g_SortCaseSensitive = SCS_INSENSITIVE;
+				ctx.case_sense = SCS_INSENSITIVE;
 			}
 			else if (cp[1] == '0') // C0
-				g_SortCaseSensitive = SCS_INSENSITIVE;
+				ctx.case_sense = SCS_INSENSITIVE;
 			else // C  C1  COn
 			{
 				if (!_tcsnicmp(cp+1, _T("On"), 2)) // COn.  Using ctoupper() here significantly increased code size.
 					cp += 2;
-				g_SortCaseSensitive = SCS_SENSITIVE;
+				ctx.case_sense = SCS_SENSITIVE;
 			}
 			break;
 		case 'D':
@@ -896,15 +944,15 @@ BIF_DECL(BIF_Sort)
 				delimiter = *cp;
 			break;
 		case 'N':
-			g_SortNumeric = true;
+			ctx.numeric = true;
 			break;
 		case 'P':
 			// Use atoi() vs. ATOI() to avoid interpreting something like 0x01C as hex
 			// when in fact the C was meant to be an option letter:
-			g_SortColumnOffset = _ttoi(cp + 1);
-			if (g_SortColumnOffset < 1)
-				g_SortColumnOffset = 1;
-			--g_SortColumnOffset;  // Convert to zero-based.
+			ctx.column_offset = _ttoi(cp + 1);
+			if (ctx.column_offset < 1)
+				ctx.column_offset = 1;
+			--ctx.column_offset;  // Convert to zero-based.
 			break;
 		case 'R':
 			if (!_tcsnicmp(cp, _T("Random"), 6))
@@ -913,7 +961,7 @@ BIF_DECL(BIF_Sort)
 				cp += 5; // Point it to the last char so that the loop's ++cp will point to the character after it.
 			}
 			else
-				g_SortReverse = true;
+				ctx.reverse = true;
 			break;
 		case 'U':  // Unique.
 			omit_dupes = true;
@@ -930,12 +978,12 @@ BIF_DECL(BIF_Sort)
 
 	if (!ParamIndexIsOmitted(2))
 	{
-		if (  !(g_SortFunc = ParamIndexToObject(2))  )
+		if (  !(ctx.func = ParamIndexToObject(2))  )
 		{
 			aResultToken.ParamError(2, aParam[2]);
 			goto end;
 		}
-		g_SortFunc->AddRef(); // Must be done in case the parameter was SYM_VAR and that var gets reassigned.
+		ctx.func->AddRef(); // Must be done in case the parameter was SYM_VAR and that var gets reassigned.
 	}
 	
 	if (!*aContents) // Input is empty, nothing to sort, return empty string.
@@ -944,7 +992,7 @@ BIF_DECL(BIF_Sort)
 		goto end;
 	}
 	
-	size_t item_count;
+	size_t item_count, i;
 
 	// Check how many delimiters are present:
 	for (item_count = 1, cp = aContents; *cp; ++cp)  // Start at 1 since item_count is delimiter_count+1
@@ -999,10 +1047,10 @@ BIF_DECL(BIF_Sort)
 	// memory for trailing_crlf_added_temporarily even though technically it's done only to make room to
 	// append the extra CRLF at the end.
 	// v2.0: Never modify the caller's aContents, since it may be a quoted literal string or variable.
-	//if (g_SortFunc || trailing_crlf_added_temporarily) // Do this here rather than earlier with the options parsing in case the function-option is present twice (unlikely, but it would be a memory leak due to strdup below).  Doing it here also avoids allocating if it isn't necessary.
+	//if (ctx.func || trailing_crlf_added_temporarily) // Do this here rather than earlier with the options parsing in case the function-option is present twice (unlikely, but it would be a memory leak due to strdup below).  Doing it here also avoids allocating if it isn't necessary.
 	{
 		// Comment is obsolete because if aContents is in a deref buffer, it has been privatized by ExpandArgs():
-		// When g_SortFunc!=NULL, the copy of the string is needed because aContents may be in the deref buffer,
+		// When ctx.func!=NULL, the copy of the string is needed because aContents may be in the deref buffer,
 		// and that deref buffer is about to be overwritten by the execution of the script's UDF body.
 		if (   !(mem_to_free = tmalloc(aContents_length + 3))   ) // +1 for terminator and +2 in case of trailing_crlf_added_temporarily.
 		{
@@ -1040,7 +1088,7 @@ BIF_DECL(BIF_Sort)
 
 	// Scan aContents and do the following:
 	// 1) Replace each delimiter with a terminator so that the individual items can be seen
-	//    as real strings by the SortWithOptions() and when copying the sorted results back
+	//    as real strings by the comparisons and when copying the sorted results back
 	//    into the result.
 	// 2) Store a marker/pointer to each item (string) in aContents so that we know where
 	//    each item begins for sorting and recopying purposes.
@@ -1092,19 +1140,51 @@ BIF_DECL(BIF_Sort)
 
 	// Now aContents has been divided up based on delimiter.  Sort the array of pointers
 	// so that they indicate the correct ordering to copy aContents into output_var:
-	if (g_SortFunc) // Takes precedence other sorting methods.
+	if (ctx.func) // Takes precedence other sorting methods.
 	{
-		qsort((void *)item, item_count, item_size, SortUDF);
-		if (!g_SortFuncResult || g_SortFuncResult == EARLY_EXIT)
+		qsort_s((void *)item, item_count, item_size, SortUDF, &ctx);
+		if (!ctx.func_result || ctx.func_result == EARLY_EXIT)
 		{
-			aResultToken.SetExitResult(g_SortFuncResult);
+			aResultToken.SetExitResult(ctx.func_result);
 			goto end;
 		}
 	}
 	else if (sort_random) // Takes precedence over all remaining options.
 		qsort((void *)item, item_count, item_size, SortRandom);
 	else
-		qsort((void *)item, item_count, item_size, sort_by_naked_filename ? SortByNakedFilename : SortWithOptions);
+	{
+		if (  !(sort_key = (SortKey *)malloc(item_count * sizeof(SortKey)))  )
+		{
+			aResultToken.MemoryError();
+			goto end;
+		}
+		for (i = 0; i < item_count; ++i)
+		{
+			SortKey &k = sort_key[i];
+			k.item = k.key = item[i];
+			if (sort_by_naked_filename)
+			{
+				if (cp = _tcsrchr(k.item, '\\'))  // Assign
+					k.key = cp + 1;
+			}
+			else if (ctx.column_offset > 0)
+			{
+				// Adjust each string (even for numerical sort) to be the right column position,
+				// or the position of its zero terminator if the column offset goes beyond its length:
+				size_t length = _tcslen(k.item);
+				k.key += (size_t)ctx.column_offset > length ? length : ctx.column_offset;
+			}
+			if (ctx.numeric && !sort_by_naked_filename)
+			{
+				k.number = ATOF(k.key);
+				if (k.number != k.number) // NaN, which would make the ordering inconsistent.
+					k.number = 0;
+			}
+		}
+		ParallelSort(sort_key, item_count, SortKeyLess { ctx, ctx.numeric && !sort_by_naked_filename });
+		for (i = 0; i < item_count; ++i)
+			item[i] = sort_key[i].item;
+	}
 
 	// Allocate space to store the result.
 	if (!TokenSetResult(aResultToken, NULL, aContents_length))
@@ -1112,7 +1192,7 @@ BIF_DECL(BIF_Sort)
 	aResultToken.symbol = SYM_STRING;
 
 	// Set default in case original last item is still the last item, or if last item was omitted due to being a dupe:
-	size_t i, item_count_minus_1 = item_count - 1;
+	size_t item_count_minus_1 = item_count - 1;
 	DWORD omit_dupe_count = 0;
 	bool keep_this_item;
 	LPTSTR source, dest;
@@ -1127,12 +1207,12 @@ BIF_DECL(BIF_Sort)
 		if (omit_dupes && item_prev)
 		{
 			// Update to the comment below: Exact dupes will still be removed when sort_by_naked_filename
-			// or g_SortColumnOffset is in effect because duplicate lines would still be adjacent to
+			// or ctx.column_offset is in effect because duplicate lines would still be adjacent to
 			// each other even in these modes.  There doesn't appear to be any exceptions, even if
 			// some items in the list are sorted as blanks due to being shorter than the specified 
-			// g_SortColumnOffset.
+			// ctx.column_offset.
 			// As documented, special dupe-checking modes are not offered when sort_by_naked_filename
-			// is in effect, or g_SortColumnOffset is greater than 1.  That's because the need for such
+			// is in effect, or ctx.column_offset is greater than 1.  That's because the need for such
 			// a thing seems too rare (and the result too strange) to justify the extra code size.
 			// However, adjacent dupes are still removed when any of the above modes are in effect,
 			// or when the "random" mode is in effect.  This might have some usefulness; for example,
@@ -1140,15 +1220,15 @@ BIF_DECL(BIF_Sort)
 			// the dupe-removal feature would remove duplicate songs if they happen to be sorted
 			// to lie adjacent to each other, which would be useful to prevent the same song from
 			// playing twice in a row.
-			if (g_SortNumeric && !g_SortColumnOffset)
-				// if g_SortColumnOffset is zero, fall back to the normal dupe checking in case its
+			if (ctx.numeric && !ctx.column_offset)
+				// if ctx.column_offset is zero, fall back to the normal dupe checking in case its
 				// ever useful to anyone.  This is done because numbers in an offset column are not supported
 				// since the extra code size doensn't seem justified given the rarity of the need.
 				keep_this_item = (ATOF(*item_curr) != ATOF(item_prev)); // ATOF() ignores any trailing \r in CRLF mode, so no extra logic is needed for that.
-			else if (g_SortCaseSensitive == SCS_INSENSITIVE_LOGICAL)
+			else if (ctx.case_sense == SCS_INSENSITIVE_LOGICAL)
 				keep_this_item = StrCmpLogicalW(*item_curr, item_prev);
 			else
-				keep_this_item = tcscmp2(*item_curr, item_prev, g_SortCaseSensitive); // v1.0.43.03: Added support for locale-insensitive mode.
+				keep_this_item = tcscmp2(*item_curr, item_prev, ctx.case_sense); // v1.0.43.03: Added support for locale-insensitive mode.
 				// Permutations of sorting case sensitive vs. eliminating duplicates based on case sensitivity:
 				// 1) Sort is not case sens, but dupes are: Won't work because sort didn't necessarily put
 				//    same-case dupes adjacent to each other.
@@ -1157,7 +1237,7 @@ BIF_DECL(BIF_Sort)
 				// 3) Both are case sensitive: seems okay
 				// 4) Both are not case sensitive: seems okay
 				//
-				// In light of the above, using the g_SortCaseSensitive flag to control the behavior of
+				// In light of the above, using the ctx.case_sense flag to control the behavior of
 				// both sorting and dupe-removal seems best.
 		}
 		if (keep_this_item)
@@ -1202,12 +1282,11 @@ BIF_DECL(BIF_Sort)
 	// changed since it was originally set by the above call TokenSetResult.
 
 end:
+	free(sort_key);
 	free(item);
 	free(mem_to_free);
-	if (g_SortFunc)
-		g_SortFunc->Release();
-	g_SortFunc = sort_func_orig;
-	g_SortFuncResult = sort_func_result_orig;
+	if (ctx.func)
+		ctx.func->Release();
 }
 
 
@@ -1314,6 +1393,7 @@ BIF_DECL(BIF_InStr)
 	_f_param_string(haystack, 0, (size_t *)&haystack_length);
 	size_t needle_length;
 	_f_param_string(needle, 1, &needle_length);
+	needle_length = _tcslen(needle); // The search has always stopped at the needle's first binary zero, if any.
 	if (!needle_length) // Although arguably legitimate, this is more likely an error, so throw.
 		_f_throw_param(1);
 
@@ -1365,7 +1445,8 @@ BIF_DECL(BIF_InStr)
 	// Since above didn't return:
 	int i;
 	for (i = 1, found_pos = haystack + offset; ; ++i, found_pos += needle_length)
-		if (!(found_pos = tcsstr2(found_pos, needle, string_case_sense)) || i == occurrence_number)
+		if (!(found_pos = tmemstr(found_pos, haystack_length - (found_pos - haystack), needle, needle_length, string_case_sense))
+			|| i == occurrence_number)
 			break;
 	_f_return_i(found_pos ? (found_pos - haystack + 1) : 0);
 }
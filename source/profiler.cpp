@@ -0,0 +1,266 @@
+#include "stdafx.h" // pre-compiled headers
+#include "defines.h"
+#include "globaldata.h" // for g_script and g_Debugger.
+#include "TextIO.h"
+#include "profiler.h"
+
+#ifdef CONFIG_PROFILER
+
+#include <algorithm> // For std::sort.
+#include <vector>
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+Profiler g_Profiler;
+
+
+void Profiler::Enable(LPCTSTR aOutputBase)
+{
+	mEnabled = true;
+	if (aOutputBase && *aOutputBase)
+		mOutputBase = aOutputBase;
+}
+
+
+bool Profiler::Start()
+// Called on the main thread after the script has loaded, before it begins executing.
+{
+	TCHAR buf[MAX_PATH];
+	if (!mOutputBase)
+	{
+		sntprintf(buf, _countof(buf), _T("%s.profile"), g_script.mFileSpec);
+		mOutputBase = SimpleHeap::Alloc(buf);
+	}
+	else
+	{
+		// Resolve it now in case the script changes the working directory.
+		DWORD length = GetFullPathName(mOutputBase, _countof(buf), buf, NULL);
+		if (length && length < _countof(buf))
+			mOutputBase = SimpleHeap::Alloc(buf);
+	}
+
+	// Size the line counters to cover every line of every file.
+	mFileCount = Line::sSourceFileCount;
+	UINT **line_count;
+	if (  !(mMaxLine = (LineNumberType *)calloc(mFileCount, sizeof(LineNumberType)))
+		|| !(line_count = (UINT **)calloc(mFileCount, sizeof(UINT *)))  )
+		return false;
+	for (Line *line = g_script.mFirstLine; line; line = line->mNextLine)
+		if (line->mFileIndex < mFileCount && mMaxLine[line->mFileIndex] < line->mLineNumber)
+			mMaxLine[line->mFileIndex] = line->mLineNumber;
+	for (int i = 0; i < mFileCount; ++i)
+		if (  !(line_count[i] = (UINT *)calloc(mMaxLine[i] + 1, sizeof(UINT)))  )
+			return false;
+
+	QueryPerformanceFrequency(&mFrequency);
+	// GetCurrentThread() returns a pseudo-handle, which would refer to the sampler thread itself.
+	mMainThread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT, FALSE, GetCurrentThreadId());
+	mStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!mMainThread || !mStopEvent)
+		return false;
+	mThread = CreateThread(NULL, 0, SamplerThread, this, 0, NULL);
+	if (!mThread)
+		return false;
+	// Sample at a priority above the script's so that busy scripts don't starve the sampler.
+	SetThreadPriority(mThread, THREAD_PRIORITY_HIGHEST);
+	mLineCount = line_count; // Enables PROFILE_LINE.
+	return true;
+}
+
+
+void Profiler::Stop()
+{
+	if (!mThread)
+		return;
+	SetEvent(mStopEvent);
+	WaitForSingleObject(mThread, INFINITE);
+	CloseHandle(mThread);
+	CloseHandle(mStopEvent);
+	CloseHandle(mMainThread);
+	mThread = NULL;
+	WriteReports();
+}
+
+
+DWORD WINAPI Profiler::SamplerThread(LPVOID aParam)
+{
+	auto &profiler = *(Profiler *)aParam;
+
+	// A high resolution timer (Windows 10 1803+) allows sampling at intervals shorter than
+	// the system timer resolution without affecting the resolution for the whole system.
+	HANDLE timer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (!timer)
+		timer = CreateWaitableTimer(NULL, FALSE, NULL);
+	if (!timer)
+		return 0;
+	LARGE_INTEGER due_time;
+	due_time.QuadPart = -10000LL * SAMPLE_INTERVAL; // Relative time in 100-nanosecond units.
+	SetWaitableTimer(timer, &due_time, SAMPLE_INTERVAL, NULL, NULL, FALSE);
+
+	HANDLE handles[] = { profiler.mStopEvent, timer };
+	LARGE_INTEGER prev_time, now;
+	QueryPerformanceCounter(&prev_time);
+	while (WaitForMultipleObjects(_countof(handles), handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+	{
+		if (SuspendThread(profiler.mMainThread) == (DWORD)-1)
+			break;
+		// SuspendThread() is asynchronous; GetThreadContext() waits for the thread to actually stop.
+		CONTEXT context;
+		context.ContextFlags = CONTEXT_CONTROL;
+		GetThreadContext(profiler.mMainThread, &context);
+		bool captured = profiler.Capture();
+		ResumeThread(profiler.mMainThread);
+
+		QueryPerformanceCounter(&now);
+		double elapsed = (double)(now.QuadPart - prev_time.QuadPart) * 1000 / profiler.mFrequency.QuadPart;
+		prev_time = now;
+		if (captured)
+			profiler.Record(elapsed);
+	}
+	CloseHandle(timer);
+	return 0;
+}
+
+
+bool Profiler::Capture()
+// Copies the main thread's current line and call stack into mFrame.  Since the main thread is
+// suspended at an arbitrary point, this must not allocate memory or take any lock, and it must
+// tolerate the stack being in the middle of a push or reallocation.  The latter is rare enough
+// that discarding the sample is fine.
+{
+	__try
+	{
+		auto &stack = g_Debugger.mStack;
+		auto bottom = stack.mBottom, top = stack.mTop;
+		mSampleLine = g_script.mCurrLine;
+		mFrameCount = 0;
+		if (top - bottom >= MAX_SAMPLE_DEPTH)
+			bottom = top - (MAX_SAMPLE_DEPTH - 1); // Keep only the innermost frames.
+		for (auto se = bottom; se <= top; ++se)
+		{
+			Frame &frame = mFrame[mFrameCount++];
+			frame.is_udf = se->type == DbgStack::SE_UDF;
+			LPCTSTR name = se->Name();
+			int i;
+			for (i = 0; i < MAX_FRAME_NAME - 1 && name[i]; ++i)
+				// Semicolons separate frames in the collapsed stack format, and line breaks separate stacks.
+				frame.name[i] = name[i] == ';' ? ':' : name[i] < ' ' ? ' ' : name[i];
+			frame.name[i] = '\0';
+		}
+		return true;
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		return false;
+	}
+}
+
+
+void Profiler::Record(double aTime)
+{
+	++mSampleCount;
+	mTotalTime += aTime;
+	if (!mFrameCount) // No script thread is running.
+	{
+		mIdleTime += aTime;
+		return;
+	}
+
+	if (mSampleLine)
+	{
+		auto &line = mLines[mSampleLine];
+		++line.samples;
+		line.time += aTime;
+	}
+
+	String stack;
+	int top_udf = -1;
+	for (int i = 0; i < mFrameCount; ++i)
+	{
+		if (i)
+			stack += ';';
+		stack += mFrame[i].name;
+		if (!mFrame[i].is_udf)
+			continue;
+		top_udf = i;
+		// Count recursive calls only once toward inclusive time.
+		int j;
+		for (j = 0; j < i && !(mFrame[j].is_udf && !_tcscmp(mFrame[j].name, mFrame[i].name)); ++j);
+		if (j == i)
+			mFuncs[mFrame[i].name].inclusive += aTime;
+	}
+	++mStacks[stack];
+	// Time spent in built-in functions is attributed to the function which called them.
+	if (top_udf != -1)
+		mFuncs[mFrame[top_udf].name].exclusive += aTime;
+}
+
+
+bool Profiler::WriteReports()
+{
+	TCHAR path[MAX_PATH];
+	TextFile tf;
+
+	sntprintf(path, _countof(path), _T("%s.folded"), mOutputBase);
+	if (!tf.Open(path, TextStream::WRITE, CP_UTF8))
+		return false;
+	std::vector<std::pair<String, UINT>> stacks(mStacks.begin(), mStacks.end());
+	std::sort(stacks.begin(), stacks.end());
+	for (auto &stack : stacks)
+		tf.Format(_T("%s %u\n"), stack.first.c_str(), stack.second);
+	tf.Close();
+
+	sntprintf(path, _countof(path), _T("%s.txt"), mOutputBase);
+	if (!tf.Open(path, TextStream::WRITE | TextStream::EOL_CRLF | TextStream::BOM_UTF8, CP_UTF8))
+		return false;
+	double busy_time = mTotalTime - mIdleTime;
+	double percent = busy_time > 0 ? 100 / busy_time : 0;
+	tf.Format(_T("Profile of %s\n"), g_script.mFileSpec);
+	tf.Format(_T("%u samples over %.0f ms, of which %.0f ms were spent running script threads.\n")
+		, mSampleCount, mTotalTime, busy_time);
+	tf.Write(_T("Times are wall-clock and include waiting, such as within Sleep or MsgBox.\n"));
+
+	std::vector<std::pair<String, FuncTime>> funcs(mFuncs.begin(), mFuncs.end());
+	std::sort(funcs.begin(), funcs.end(), [](const auto &a, const auto &b) { return a.second.exclusive > b.second.exclusive; });
+	tf.Write(_T("\nFunctions by exclusive time (including built-in functions they call):\n\n"));
+	tf.Write(_T("  Exclusive ms      %   Inclusive ms      %   Function\n"));
+	for (size_t i = 0; i < funcs.size() && i < REPORT_TOP_COUNT; ++i)
+	{
+		auto &ft = funcs[i].second;
+		tf.Format(_T("  %12.1f %6.1f %14.1f %6.1f   %s\n"), ft.exclusive, ft.exclusive * percent
+			, ft.inclusive, ft.inclusive * percent, funcs[i].first.c_str());
+	}
+
+	std::vector<std::pair<Line *, LineTime>> lines(mLines.begin(), mLines.end());
+	std::sort(lines.begin(), lines.end(), [](const auto &a, const auto &b) { return a.second.time > b.second.time; });
+	tf.Write(_T("\nLines by sampled time:\n\n"));
+	tf.Write(_T("    Samples         ms      %   Executions   Line\n"));
+	for (size_t i = 0; i < lines.size() && i < REPORT_TOP_COUNT; ++i)
+	{
+		auto line = lines[i].first;
+		auto &lt = lines[i].second;
+		tf.Format(_T("  %9u %10.1f %6.1f %12u   %s (%u)\n"), lt.samples, lt.time, lt.time * percent
+			, line->mFileIndex < mFileCount && line->mLineNumber <= mMaxLine[line->mFileIndex]
+				? mLineCount[line->mFileIndex][line->mLineNumber] : 0
+			, Line::sSourceFile[line->mFileIndex], line->mLineNumber);
+	}
+
+	// Executions are counted per source line, so collect them from the counters directly.
+	struct LineCount { UINT count; int file; LineNumberType line; };
+	std::vector<LineCount> counts;
+	for (int f = 0; f < mFileCount; ++f)
+		for (LineNumberType n = 0; n <= mMaxLine[f]; ++n)
+			if (mLineCount[f][n])
+				counts.push_back({ mLineCount[f][n], f, n });
+	std::sort(counts.begin(), counts.end(), [](const auto &a, const auto &b) { return a.count > b.count; });
+	tf.Write(_T("\nLines by executions:\n\n"));
+	tf.Write(_T("   Executions   Line\n"));
+	for (size_t i = 0; i < counts.size() && i < REPORT_TOP_COUNT; ++i)
+		tf.Format(_T("  %11u   %s (%u)\n"), counts[i].count, Line::sSourceFile[counts[i].file], counts[i].line);
+	tf.Close();
+	return true;
+}
+
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+
+#ifndef CONFIG_PROFILER
+
+#define PROFILE_LINE(line)
+
+#else
+
+#include "script.h" // For Line.
+#include <string>
+#include <unordered_map>
+
+// Sampling profiler, enabled by the /Profile switch or the #Profile directive.
+//
+// A background thread periodically suspends the main thread and records g_script.mCurrLine
+// and the names on g_Debugger.mStack, weighting each sample by the time since the previous
+// one.  This gives inclusive and exclusive time per function without timing individual lines.
+// Line executions are counted exactly, since that only costs an increment per line.
+//
+// On exit, two reports are written: <base>.folded contains one line per distinct call stack
+// in the collapsed format accepted by flame graph tools, and <base>.txt contains tables of the
+// most expensive functions and lines.  <base> defaults to the script's path plus ".profile".
+class Profiler
+{
+public:
+	void Enable(LPCTSTR aOutputBase); // aOutputBase may be nullptr to use the default.
+	bool IsEnabled() { return mEnabled; }
+	bool Start();
+	void Stop(); // Stops sampling and writes the reports.  Does nothing if not started.
+
+	void CountLine(Line *aLine)
+	{
+		if (aLine->mFileIndex < mFileCount && aLine->mLineNumber <= mMaxLine[aLine->mFileIndex])
+			++mLineCount[aLine->mFileIndex][aLine->mLineNumber];
+	}
+
+	UINT **mLineCount = nullptr; // [file index][line number]: number of times the line was executed.
+
+private:
+	enum { SAMPLE_INTERVAL = 1, MAX_SAMPLE_DEPTH = 128, MAX_FRAME_NAME = 64, REPORT_TOP_COUNT = 30 };
+
+	typedef std::basic_string<TCHAR> String;
+
+	struct Frame
+	{
+		TCHAR name[MAX_FRAME_NAME];
+		bool is_udf;
+	};
+
+	struct FuncTime
+	{
+		double inclusive = 0, exclusive = 0;
+	};
+
+	struct LineTime
+	{
+		UINT samples = 0;
+		double time = 0;
+	};
+
+	bool mEnabled = false;
+	LPCTSTR mOutputBase = nullptr;
+	int mFileCount = 0;
+	LineNumberType *mMaxLine = nullptr;
+	HANDLE mMainThread = NULL, mThread = NULL, mStopEvent = NULL;
+	LARGE_INTEGER mFrequency;
+
+	// The most recent sample.  Filled in by Capture() while the main thread is suspended.
+	Frame mFrame[MAX_SAMPLE_DEPTH];
+	int mFrameCount = 0;
+	Line *mSampleLine = nullptr;
+
+	UINT mSampleCount = 0;
+	double mTotalTime = 0, mIdleTime = 0;
+	std::unordered_map<String, UINT> mStacks;
+	std::unordered_map<String, FuncTime> mFuncs;
+	std::unordered_map<Line *, LineTime> mLines;
+
+	static DWORD WINAPI SamplerThread(LPVOID aParam);
+	bool Capture();
+	void Record(double aTime);
+	bool WriteReports();
+};
+
+extern Profiler g_Profiler;
+
+#define PROFILE_LINE(line) \
+{ \
+	if (g_Profiler.mLineCount) \
+		g_Profiler.CountLine(line); \
+}
+
+#endif
@@ -22,7 +22,9 @@ GNU General Public License for more details.
 #include "application.h" // for MsgSleep()
 #include "TextIO.h"
 #include "simple_threading_api.h"
+#include "simple_threading.h"
 #include "websocket_api.h"
+#include "profiler.h"
 
 #define NA MAX_FUNCTION_PARAMS
 #define BIFn(name, minp, maxp, bif, ...) {_T(#name), bif, minp, maxp, FID_##name, __VA_ARGS__}
@@ -40,6 +42,10 @@ FuncEntry g_BIF[] =
 	BIF1(ATan, 1, 1),
 	BIF1(CaretGetPos, 0, 2, {1, 2}),
 	BIFn(Ceil, 1, 1, BIF_FloorCeil),
+	BIF1(ChannelClose, 1, 1),
+	BIF1(ChannelCreate, 0, 1),
+	BIF1(ChannelReceive, 2, 3, {2}),
+	BIF1(ChannelSend, 2, 3),
 	BIF1(Chr, 1, 1),
 	BIF1(Click, 0, 6),
 #ifdef ENABLE_DLLCALL
@@ -66,6 +72,7 @@ FuncEntry g_BIF[] =
 	BIF1(HasBase, 2, 2),
 	BIFn(HasMethod, 1, 3, BIF_GetMethod),
 	BIF1(HasProp, 2, 2),
+	BIF1(HttpRequest, 2, 2),
 	BIF1(InStr, 2, 5),
 	BIFi(IsAlnum, 1, 2, BIF_IsTypeish, VAR_TYPE_ALNUM),
 	BIFi(IsAlpha, 1, 2, BIF_IsTypeish, VAR_TYPE_ALPHA),
@@ -107,7 +114,9 @@ FuncEntry g_BIF[] =
 	BIFn(RegCreateKey, 0, 1, BIF_Reg),
 	BIFn(RegDelete, 0, 2, BIF_Reg),
 	BIFn(RegDeleteKey, 0, 1, BIF_Reg),
+	BIF1(RegExCache, 0, 1),
 	BIFn(RegExMatch, 2, 4, BIF_RegEx, {3}),
+	BIF1(RegExMatchAll, 2, 3),
 	BIFn(RegExReplace, 2, 6, BIF_RegEx, {4}),
 	BIFn(RegRead, 0, 3, BIF_Reg),
 	BIFn(RegWrite, 0, 4, BIF_Reg),
@@ -135,20 +144,31 @@ FuncEntry g_BIF[] =
 	BIFn(StrUpper, 1, 1, BIF_StrCase),
 	BIF1(SubStr, 2, 3),
 	BIF1(Tan, 1, 1),
-	BIF1(HttpRequest, 2, 2),
 	BIF1(ThreadCount, 0, 0),
 	BIF1(ThreadCreate, 1, 1),
 	BIF1(ThreadDestroy, 1, 1),
 	BIF1(ThreadGetVar, 1, 1),
+	BIF1(ThreadPause, 1, 1),
+	BIF1(ThreadResume, 1, 1),
 	BIF1(ThreadSetVar, 2, 2),
+	BIF1(ThreadSubmit, 1, 2),
+	BIF1(ThreadTaskResult, 1, 2),
+	BIF1(ThreadTaskWait, 1, 2),
+	BIF1(ThreadWait, 1, 2),
+	BIF1(ThreadWaitVar, 1, 2),
 	BIFn(Trim, 1, 2, BIF_Trim),
 	BIF1(Type, 1, 1),
 	BIF1(VarSetStrCapacity, 1, 2, {1}),
 	BIF1(VerCompare, 2, 2),
+	BIF1(WebSocketClose, 1, 1),
 	BIF1(WebSocketConnect, 1, 1),
 	BIF1(WebSocketDisconnect, 0, 0),
-	BIF1(WebSocketReceive, 0, 0),
-	BIF1(WebSocketSend, 1, 1),
+	BIF1(WebSocketFlush, 0, 1),
+	BIF1(WebSocketOnMessage, 1, 2),
+	BIF1(WebSocketOpen, 1, 1),
+	BIF1(WebSocketReceive, 0, 1),
+	BIF1(WebSocketSend, 1, 3),
+	BIF1(WebSocketSendBuffer, 1, 3),
 	BIFn(WinActive, 0, 4, BIF_WinExistActive),
 	BIFn(WinExist, 0, 4, BIF_WinExistActive),
 };
@@ -319,7 +339,7 @@ Script::Script()
 	: mFirstLine(NULL), mLastLine(NULL), mCurrLine(NULL)
 	, mThisHotkeyName(_T("")), mPriorHotkeyName(_T("")), mThisHotkeyStartTime(0), mPriorHotkeyStartTime(0)
 	, mEndChar(0), mThisHotkeyModifiersLR(0)
-	, mOnClipboardChangeIsRunning(false)
+	, mOnClipboardChangeIsRunning(false), mOnWebSocketMessageIsRunning(false)
 	, mFirstLabel(NULL), mLastLabel(NULL)
 	, mLastHotFunc(nullptr), mUnusedHotFunc(nullptr)
 	, mFirstTimer(NULL), mLastTimer(NULL), mTimerEnabledCount(0), mTimerCount(0)
@@ -376,7 +396,6 @@ Script::Script()
 		if (_tcsicmp(g_BIV_A[i-1].name, g_BIV_A[i].name) >= 0)
 			ScriptError(_T("DEBUG: g_BIV_A out of order."), g_BIV_A[i].name);
 #endif
-	InitializeCriticalSection(&g_CriticalRegExCache); // v1.0.45.04: Must be done early so that it's unconditional, so that DeleteCriticalSection() in the script destructor can also be unconditional.
 	OleInitialize(NULL);
 }
 
@@ -474,7 +493,6 @@ Script::~Script() // Destructor.
 	UnregisterClass(WINDOW_CLASS_GUI, g_hInstance);
 #endif
 
-	DeleteCriticalSection(&g_CriticalRegExCache); // g_CriticalRegExCache is used elsewhere for thread-safety.
 	OleUninitialize();
 }
 
@@ -1048,6 +1066,7 @@ bool Script::IsPersistent()
 		|| g_persistent // Persistent() has been used somewhere in the script.
 		|| g_script.mTimerEnabledCount // At least one script timer is currently enabled.
 		|| mOnClipboardChange.Count() // The script is monitoring clipboard changes.
+		|| mOnWebSocketMessage.Count() // The script is waiting for WebSocket messages.
 		|| g_input // At least one active InputHook.
 		|| IsWindowVisible(g_hWnd))
 		return true;
@@ -1336,6 +1355,10 @@ void Script::TerminateApp(ExitReasons aExitReason, int aExitCode)
 #ifdef CONFIG_DEBUGGER // L34: Exit debugger *after* the above to allow debugging of any invoked __Delete handlers.
 	g_Debugger.Exit(aExitReason);
 #endif
+#ifdef CONFIG_PROFILER
+	g_Profiler.Stop(); // Write the reports, including any time spent in __Delete handlers above.
+#endif
+	SimpleThreading::Shutdown(); // Stop any workers, including those blocked waiting on a channel or variable.
 
 	// PostQuitMessage() might be needed to prevent hang-on-exit.  Once this is done, no message boxes or
 	// other dialogs can be displayed.  MSDN: "The exit value returned to the system must be the wParam
@@ -3780,6 +3803,16 @@ inline ResultType Script::IsDirective(LPTSTR aBuf)
 		return CONDITION_TRUE;
 	}
 	
+#ifdef CONFIG_PROFILER
+	if (IS_DIRECTIVE_MATCH(_T("#Profile")))
+	{
+		// The /Profile switch takes precedence, since it is more likely to be a one-off.
+		if (!g_Profiler.IsEnabled())
+			g_Profiler.Enable(parameter ? SimpleHeap::Alloc(strip_quote_marks(parameter)) : NULL);
+		return CONDITION_TRUE;
+	}
+#endif
+
 	if (IS_DIRECTIVE_MATCH(_T("#InputLevel")))
 	{
 		// All hotkeys declared after this directive are assigned the specified InputLevel.
@@ -7632,8 +7665,12 @@ Line *Script::PreparseCommands(Line *aStartingLine)
 
 		// Finalize and optimize postfix expressions.
 		for (int i = 0; i < line->mArgc; ++i)
-			if (line->mArg[i].postfix && !line->FinalizeExpression(line->mArg[i]))
-				return nullptr;
+			if (line->mArg[i].postfix)
+			{
+				if (!line->FinalizeExpression(line->mArg[i]))
+					return nullptr;
+				line->OptimizeExpression(line->mArg[i]);
+			}
 
 		// Check for unreachable code.
 		if (g_Warn_Unreachable)
@@ -9504,6 +9541,299 @@ ResultType Line::FinalizeExpression(ArgStruct &aArg)
 }
 
 
+static bool FoldConstantOperation(ExprTokenType &aOp, ExprTokenType *aLeft, ExprTokenType &aRight)
+// Evaluates the operator aOp at load time, where aLeft (NULL if aOp is unary) and aRight are
+// literals.  Returns false if the operation should be left until run time, which includes any
+// case where ExpandExpression() would throw an error or the result isn't certain to be the same.
+// Otherwise, aOp is replaced with the result.
+{
+	SymbolType op = aOp.symbol;
+	if (!aLeft)
+	{
+		switch (op)
+		{
+		case SYM_LOWNOT:
+		case SYM_HIGHNOT:
+			aOp.SetValue(!TokenToBOOL(aRight));
+			return true;
+		case SYM_NEGATIVE:
+			if (aRight.symbol == SYM_INTEGER)
+				aOp.SetValue(-aRight.value_int64);
+			else if (aRight.symbol == SYM_FLOAT)
+				aOp.SetValue(-aRight.value_double);
+			else
+				return false;
+			return true;
+		case SYM_POSITIVE:
+			if (!IS_NUMERIC(aRight.symbol))
+				return false;
+			aOp.CopyValueFrom(aRight);
+			return true;
+		case SYM_BITNOT:
+			if (aRight.symbol != SYM_INTEGER)
+				return false;
+			aOp.SetValue(~aRight.value_int64);
+			return true;
+		}
+		return false;
+	}
+
+	ExprTokenType &left = *aLeft, &right = aRight;
+	if (op == SYM_CONCAT)
+	{
+		if (left.symbol == SYM_FLOAT || right.symbol == SYM_FLOAT)
+			return false; // Leave the formatting of floats to run time.
+		TCHAR left_buf[MAX_NUMBER_SIZE], right_buf[MAX_NUMBER_SIZE];
+		size_t left_length, right_length;
+		LPTSTR left_string = TokenToString(left, left_buf, &left_length);
+		LPTSTR right_string = TokenToString(right, right_buf, &right_length);
+		LPTSTR result = SimpleHeap::Alloc<TCHAR>(left_length + right_length + 1);
+		tmemcpy(result, left_string, left_length);
+		tmemcpy(result + left_length, right_string, right_length);
+		result[left_length + right_length] = '\0';
+		aOp.SetValue(result, left_length + right_length);
+		return true;
+	}
+	if (!IS_NUMERIC(left.symbol) || !IS_NUMERIC(right.symbol))
+		return false; // String comparisons and type errors are left to run time.
+
+	__int64 result_int64;
+	if (left.symbol == SYM_INTEGER && right.symbol == SYM_INTEGER && op != SYM_DIVIDE)
+	{
+		__int64 left_int64 = left.value_int64, right_int64 = right.value_int64;
+		switch (op)
+		{
+		case SYM_ADD:			result_int64 = left_int64 + right_int64; break;
+		case SYM_SUBTRACT:		result_int64 = left_int64 - right_int64; break;
+		case SYM_MULTIPLY:		result_int64 = left_int64 * right_int64; break;
+		case SYM_EQUALCASE:
+		case SYM_EQUAL:			result_int64 = left_int64 == right_int64; break;
+		case SYM_NOTEQUALCASE:
+		case SYM_NOTEQUAL:		result_int64 = left_int64 != right_int64; break;
+		case SYM_GT:			result_int64 = left_int64 > right_int64; break;
+		case SYM_LT:			result_int64 = left_int64 < right_int64; break;
+		case SYM_GTOE:			result_int64 = left_int64 >= right_int64; break;
+		case SYM_LTOE:			result_int64 = left_int64 <= right_int64; break;
+		case SYM_BITAND:		result_int64 = left_int64 & right_int64; break;
+		case SYM_BITOR:			result_int64 = left_int64 | right_int64; break;
+		case SYM_BITXOR:		result_int64 = left_int64 ^ right_int64; break;
+		case SYM_BITSHIFTLEFT:
+		case SYM_BITSHIFTRIGHT:
+		case SYM_BITSHIFTRIGHT_LOGICAL:
+			if (right_int64 < 0 || right_int64 > 63)
+				return false;
+			if (op == SYM_BITSHIFTRIGHT_LOGICAL)
+				result_int64 = (unsigned __int64)left_int64 >> right_int64;
+			else
+				result_int64 = op == SYM_BITSHIFTLEFT ? left_int64 << right_int64 : left_int64 >> right_int64;
+			break;
+		case SYM_INTEGERDIVIDE:
+			if (right_int64 == 0 || right_int64 == -1 && left_int64 == _I64_MIN)
+				return false;
+			result_int64 = left_int64 / right_int64;
+			break;
+		default: // SYM_POWER, which is rare enough with literal operands to leave to run time.
+			return false;
+		}
+		aOp.SetValue(result_int64);
+		return true;
+	}
+	
+	double left_double = TokenToDouble(left), right_double = TokenToDouble(right);
+	switch (op)
+	{
+	case SYM_ADD:		aOp.SetValue(left_double + right_double); return true;
+	case SYM_SUBTRACT:	aOp.SetValue(left_double - right_double); return true;
+	case SYM_MULTIPLY:	aOp.SetValue(left_double * right_double); return true;
+	case SYM_DIVIDE:
+		if (right_double == 0.0)
+			return false;
+		aOp.SetValue(left_double / right_double);
+		return true;
+	case SYM_EQUALCASE:
+	case SYM_EQUAL:			result_int64 = left_double == right_double; break;
+	case SYM_NOTEQUALCASE:
+	case SYM_NOTEQUAL:		result_int64 = left_double != right_double; break;
+	case SYM_GT:			result_int64 = left_double > right_double; break;
+	case SYM_LT:			result_int64 = left_double < right_double; break;
+	case SYM_GTOE:			result_int64 = left_double >= right_double; break;
+	case SYM_LTOE:			result_int64 = left_double <= right_double; break;
+	default: // SYM_POWER, or an integer operator with a float operand (a type error).
+		return false;
+	}
+	aOp.SetValue(result_int64);
+	return true;
+}
+
+
+
+static SymbolType IncrementSymbol(Var *aTarget, ExprTokenType &aSource, ExprTokenType &aDelta, ExprTokenType &aOp)
+// Returns SYM_PRE_INCREMENT or SYM_PRE_DECREMENT if assigning "aSource aOp aDelta" to aTarget is
+// equivalent to ++aTarget or --aTarget, otherwise 0.  Both evaluate the var's numeric value (including
+// numeric strings) the same way and fail the same way if it is unset or not a number.
+{
+	if (aSource.symbol != SYM_VAR || aSource.var != aTarget || aSource.var_usage != VARREF_READ
+		|| aTarget->Type() != VAR_NORMAL // Not VAR_VIRTUAL, which ++ can't read as SYM_VAR.
+		|| aDelta.symbol != SYM_INTEGER || (aDelta.value_int64 != 1 && aDelta.value_int64 != -1)
+		|| aOp.symbol != SYM_ADD && aOp.symbol != SYM_SUBTRACT)
+		return (SymbolType)0;
+	return (aDelta.value_int64 == 1) == (aOp.symbol == SYM_ADD) ? SYM_PRE_INCREMENT : SYM_PRE_DECREMENT;
+}
+
+
+
+void Line::OptimizeExpression(ArgStruct &aArg)
+// Simplifies a postfix expression which has already been validated by FinalizeExpression():
+//  1) Operators with only literal operands are evaluated, so 60*60*1000 or "abc" . "def" becomes
+//     a single token.
+//  2) Numeric string literals which are operands of arithmetic operators are converted to pure
+//     numbers, so they aren't passed to IsNumeric() each time the expression is evaluated.
+//  3) x := x + 1 and x := x - 1 are evaluated the same way as ++x and --x.
+// Each of these must produce exactly the same result as the original expression, or leave it as is.
+{
+	ExprTokenType *postfix = aArg.postfix;
+	int count = 0;
+	while (postfix[count].symbol != SYM_INVALID)
+		++count;
+	if (count < 2)
+		return;
+
+	// A token which ends the right branch of a short-circuit operator isn't the whole operand of the
+	// operator which follows it, so it must not be combined with that operator.  Since tokens are
+	// removed below, the index of each token is tracked so that circuit_token can be adjusted.
+	auto is_branch_end = (bool *)_alloca(count * sizeof(bool));
+	auto old_index = (int *)_alloca(count * sizeof(int));
+	auto new_index = (int *)_alloca(count * sizeof(int));
+	memset(is_branch_end, 0, count * sizeof(bool));
+	for (int i = 0; i < count; ++i)
+		if (SYM_USES_CIRCUIT_TOKEN(postfix[i].symbol))
+			is_branch_end[postfix[i].circuit_token - postfix] = true;
+
+	#define IS_LITERAL(sym) ((sym) == SYM_STRING || IS_NUMERIC(sym))
+	// Returns true if postfix[i] is a single-token operand, such as 1, "a" or x.
+	auto is_whole_operand = [&](int i) {
+		return i >= 0 && !is_branch_end[old_index[i]]
+			&& (IS_LITERAL(postfix[i].symbol) || postfix[i].symbol == SYM_VAR);
+	};
+	// Converts a numeric string literal to a pure number, using the same conversion as ExpandExpression().
+	// Floats are left as strings for integer operators so that the type error shows the original value.
+	auto to_number = [&](ExprTokenType &aToken, bool aAllowFloat) {
+		if (aToken.symbol != SYM_STRING)
+			return;
+		switch (IsNumeric(aToken.marker, true, false, true))
+		{
+		case PURE_INTEGER:
+			aToken.SetValue(TokenToInt64(aToken));
+			break;
+		case PURE_FLOAT:
+			if (aAllowFloat)
+				aToken.SetValue(TokenToDouble(aToken));
+			break;
+		}
+	};
+
+	int out = 0;
+	for (int in = 0; in < count; ++in)
+	{
+		if (out != in)
+			postfix[out].CopyExprFrom(postfix[in]);
+		old_index[out] = in;
+		new_index[in] = out;
+		ExprTokenType &this_token = postfix[out];
+		SymbolType symbol = this_token.symbol;
+
+		bool is_unary = symbol == SYM_NEGATIVE || symbol == SYM_POSITIVE || symbol == SYM_BITNOT
+			|| symbol == SYM_HIGHNOT || symbol == SYM_LOWNOT;
+		bool is_binary = IS_RELATIONAL_OPERATOR(symbol) || IS_INTEGER_OPERATOR(symbol)
+			|| symbol >= SYM_ADD && symbol <= SYM_POWER || symbol == SYM_CONCAT;
+		bool is_arithmetic = symbol >= SYM_ADD && symbol <= SYM_POWER || IS_INTEGER_OPERATOR(symbol)
+			|| is_unary && symbol != SYM_HIGHNOT && symbol != SYM_LOWNOT
+			|| IS_ASSIGNMENT_EXCEPT_POST_AND_PRE(symbol) && symbol != SYM_ASSIGN && symbol != SYM_ASSIGN_CONCAT;
+
+		bool right_is_whole = is_whole_operand(out - 1);
+		bool left_is_whole = right_is_whole && is_whole_operand(out - 2);
+		if (is_arithmetic && right_is_whole)
+		{
+			bool allow_float = !IS_INTEGER_OPERATOR(symbol) && symbol != SYM_BITNOT
+				&& (symbol < SYM_ASSIGN_INTEGERDIVIDE || symbol > SYM_ASSIGN_BITSHIFTRIGHT_LOGICAL);
+			to_number(postfix[out - 1], allow_float);
+			if (is_binary && left_is_whole)
+				to_number(postfix[out - 2], allow_float);
+		}
+
+		if (is_unary && right_is_whole && IS_LITERAL(postfix[out - 1].symbol)
+			&& FoldConstantOperation(this_token, nullptr, postfix[out - 1]))
+		{
+			postfix[out - 1].CopyExprFrom(this_token);
+			old_index[out - 1] = in;
+			new_index[in] = out - 1;
+			continue; // The result replaced the operand, so don't increment out.
+		}
+		if (is_binary && left_is_whole && IS_LITERAL(postfix[out - 1].symbol) && IS_LITERAL(postfix[out - 2].symbol)
+			&& FoldConstantOperation(this_token, &postfix[out - 2], postfix[out - 1]))
+		{
+			postfix[out - 2].CopyExprFrom(this_token);
+			old_index[out - 2] = in;
+			new_index[in] = out - 2;
+			--out;
+			continue;
+		}
+
+		// x := x + 1  ->  ++x
+		if (symbol == SYM_ASSIGN && out >= 4 && !is_branch_end[old_index[out - 1]]
+			&& is_whole_operand(out - 4) && is_whole_operand(out - 3) && is_whole_operand(out - 2))
+		{
+			ExprTokenType &target = postfix[out - 4], &source = postfix[out - 3];
+			SymbolType inc_symbol = target.symbol == SYM_VAR ? IncrementSymbol(target.var, source, postfix[out - 2], postfix[out - 1]) : (SymbolType)0;
+			if (inc_symbol)
+			{
+				target.CopyExprFrom(source); // Use the VARREF_READ token so that an unset var is still an error.
+				postfix[out - 3].CopyExprFrom(this_token);
+				postfix[out - 3].symbol = inc_symbol;
+				old_index[out - 3] = in;
+				new_index[in] = out - 3;
+				out -= 2;
+				continue;
+			}
+		}
+		++out;
+	}
+
+	// x := x + 1 as a line of its own: ACT_ASSIGNEXPR with x in mArg[0] and x + 1 in mArg[1].
+	// ExpandExpression() assigns the result to x, which is x itself, after it has been incremented.
+	if (out == 3 && mActionType == ACT_ASSIGNEXPR && &aArg == mArg + 1
+		&& mArg[0].type == ARG_TYPE_OUTPUT_VAR && !mArg[0].is_expression && !is_branch_end[old_index[2]]
+		&& is_whole_operand(0) && is_whole_operand(1))
+	{
+		if (SymbolType inc_symbol = IncrementSymbol(VAR(mArg[0]), postfix[0], postfix[1], postfix[2]))
+		{
+			postfix[1].CopyExprFrom(postfix[2]);
+			postfix[1].symbol = inc_symbol;
+			out = 2;
+		}
+	}
+
+	if (out == count)
+		return;
+	postfix[out].symbol = SYM_INVALID;
+	for (int i = 0; i < out; ++i)
+		if (SYM_USES_CIRCUIT_TOKEN(postfix[i].symbol))
+			postfix[i].circuit_token = postfix + new_index[postfix[i].circuit_token - postfix];
+
+	if (out == 1 && IS_LITERAL(postfix->symbol) && mActionType == ACT_ASSIGNEXPR)
+	{
+		// The whole expression was folded into a literal, so let PerformAssign() skip ExpandExpression(),
+		// as ExpressionToPostfix() does for a lone literal.
+		TCHAR number_buf[MAX_NUMBER_SIZE];
+		aArg.text = postfix->symbol == SYM_STRING ? postfix->marker : SimpleHeap::Alloc(TokenToString(*postfix, number_buf));
+		aArg.is_expression = false;
+	}
+	#undef IS_LITERAL
+}
+
+
+
+
 //-------------------------------------------------------------------------------------
 
 // Init static vars:
@@ -9651,6 +9981,7 @@ ResultType Line::ExecUntil(ExecUntilMode aMode, ResultToken *aResultToken, Line
 
 		if (g.ListLinesIsEnabled)
 			LOG_LINE(line)
+		PROFILE_LINE(line)
 
 #ifdef CONFIG_DEBUGGER
 		if (g_Debugger.IsConnected() && line->mActionType != ACT_WHILE) // L31: PreExecLine of ACT_WHILE is now handled in PerformLoopWhile() where inspecting A_Index will yield the correct result.
@@ -10829,6 +11160,7 @@ ResultType Line::PerformLoopWhile(ResultToken *aResultToken, Line *&aJumpToLine)
 		// line once immediately before the first iteration.
 		if (g.ListLinesIsEnabled)
 			LOG_LINE(this)
+		PROFILE_LINE(this)
 	} // for()
 	return result; // The script's loop is now over.
 }
@@ -10840,6 +11172,7 @@ bool Line::EvaluateLoopUntil(ResultType &aResult)
 	g_script.mCurrLine = this; // For error-reporting purposes.
 	if (g->ListLinesIsEnabled)
 		LOG_LINE(this);
+	PROFILE_LINE(this)
 #ifdef CONFIG_DEBUGGER
 	// Let the debugger break at or step onto UNTIL.
 	if (g_Debugger.IsConnected())
@@ -11584,8 +11917,13 @@ ResultType Line::PerformLoopParseCSV(ResultToken *aResultToken, Line *&aJumpToLi
 ResultType Line::PerformLoopReadFile(ResultToken *aResultToken, Line *&aJumpToLine, Line *aUntil
 	, LPTSTR aReadFileName, LPTSTR aWriteFileName)
 {
+	// Regular disk files are read through a memory-mapped view, which avoids copying each block
+	// of the file into a buffer and each line into mLineBuf.  Anything else (such as a pipe or
+	// a file too large for the address space) falls back to TextFile.
+	TextMappedFile mfile;
 	TextFile tfile;
-	bool file_is_open = tfile.Open(aReadFileName, DEFAULT_READ_FLAGS, g->Encoding & CP_AHKCP);
+	bool file_is_mapped = mfile.Open(aReadFileName, g->Encoding & CP_AHKCP);
+	bool file_is_open = file_is_mapped || tfile.Open(aReadFileName, DEFAULT_READ_FLAGS, g->Encoding & CP_AHKCP);
 	if (!file_is_open)
 	{
 		// Failed to open the input file.  If an ELSE is present, executing it if the file wasn't found
@@ -11611,11 +11949,22 @@ ResultType Line::PerformLoopReadFile(ResultToken *aResultToken, Line *&aJumpToLi
 	if (file_is_open)
 	for (;; ++g.mLoopIteration)
 	{ 
-		if (  !(line_length = tfile.ReadLine(loop_info.mCurrentLine, _countof(loop_info.mCurrentLine) - 1))  ) // -1 to ensure there's room for a null-terminator.
-			break;
-		if (loop_info.mCurrentLine[line_length - 1] == '\n') // Remove end-of-line character.
-			--line_length;
-		loop_info.mCurrentLine[line_length] = '\0';
+		if (file_is_mapped)
+		{
+			if (  !(loop_info.mCurrentLine = mfile.ReadLine(READ_FILE_LINE_SIZE - 1, line_length))  )
+			{
+				loop_info.mCurrentLine = loop_info.mLineBuf; // For A_LoopReadLine in the ELSE, if any.
+				break;
+			}
+		}
+		else
+		{
+			if (  !(line_length = tfile.ReadLine(loop_info.mLineBuf, _countof(loop_info.mLineBuf) - 1))  ) // -1 to ensure there's room for a null-terminator.
+				break;
+			if (loop_info.mLineBuf[line_length - 1] == '\n') // Remove end-of-line character.
+				--line_length;
+			loop_info.mLineBuf[line_length] = '\0';
+		}
 
 		PERFORMLOOP_EXECUTE_BODY
 		PERFORMLOOP_EVALUATE_UNTIL
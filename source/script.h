@@ -358,6 +358,7 @@ struct CallSite
 	LPTSTR member = nullptr;
 	int flags = IT_CALL;
 	int param_count = 0;
+	Object::MemberCache member_cache; // Used by Object::Invoke() when member is not null.
 	
 	bool is_variadic() { return flags & EIF_VARIADIC; }
 	void is_variadic(bool b) { if (b) flags |= EIF_VARIADIC; else flags &= ~EIF_VARIADIC; }
@@ -524,12 +525,14 @@ struct LoopReadFileStruct
 	TextStream *mWriteFile; // Currently no need for mReadFile, so it's left as a local variable of PerformLoopRead().
 	LPTSTR mWriteFileName;
 	#define READ_FILE_LINE_SIZE (64 * 1024)
-	TCHAR mCurrentLine[READ_FILE_LINE_SIZE];
+	LPTSTR mCurrentLine; // Points into the mapped file's decoded text, or to mLineBuf.
+	TCHAR mLineBuf[READ_FILE_LINE_SIZE]; // Used only when the file can't be mapped.
 	LoopReadFileStruct(LPTSTR aWriteFileName)
 		: mWriteFile(nullptr) // mWriteFile is opened by FileAppend() only upon first use.
 		, mWriteFileName(aWriteFileName) // Caller has passed the result of _tcsdup() for us to take over.
+		, mCurrentLine(mLineBuf)
 	{
-		*mCurrentLine = '\0';
+		*mLineBuf = '\0';
 	}
 	~LoopReadFileStruct()
 	{
@@ -861,6 +864,7 @@ public:
 	ResultType ExpressionToPostfix(ArgStruct &aArg);
 	ResultType ExpressionToPostfix(ArgStruct &aArg, ExprTokenType *&aInfix);
 	ResultType FinalizeExpression(ArgStruct &aArg);
+	void OptimizeExpression(ArgStruct &aArg);
 
 	static bool FileIsFilteredOut(LoopFilesStruct &aCurrentFile, FileLoopModeType aFileLoopMode);
 
@@ -2751,6 +2755,9 @@ private:
 #ifdef CONFIG_DEBUGGER
 	friend class Debugger;
 #endif
+#ifdef CONFIG_PROFILER
+	friend class Profiler;
+#endif
 #ifdef CONFIG_DLL
 	friend class AutoHotkeyLib;
 	friend class FuncCollection;
@@ -2864,7 +2871,8 @@ public:
 	Object *mNewRuntimeException = nullptr; // Lets Error__New detect that it's being called by CreateRuntimeException.
 	LPTSTR mThisHotkeyName, mPriorHotkeyName;
 	MsgMonitorList mOnExit, mOnClipboardChange, mOnError; // Event handlers for OnExit(), OnClipboardChange() and OnError().
-	bool mOnClipboardChangeIsRunning;
+	MsgMonitorList mOnWebSocketMessage; // Event handlers for WebSocketOnMessage().
+	bool mOnClipboardChangeIsRunning, mOnWebSocketMessageIsRunning;
 	int mPendingExitCode = 0;
 
 	ScriptTimer *mFirstTimer, *mLastTimer;  // The first and last script timers in the linked list.
@@ -3192,6 +3200,8 @@ BIF_DECL(BIF_StrCase);
 BIF_DECL(BIF_StrReplace);
 BIF_DECL(BIF_Sort);
 BIF_DECL(BIF_RegEx);
+BIF_DECL(BIF_RegExCache);
+BIF_DECL(BIF_RegExMatchAll);
 BIF_DECL(BIF_Ord);
 BIF_DECL(BIF_Chr);
 BIF_DECL(BIF_Format);
@@ -3233,11 +3243,27 @@ BIF_DECL(BIF_ThreadCount);
 BIF_DECL(BIF_ThreadCreate);
 BIF_DECL(BIF_ThreadDestroy);
 BIF_DECL(BIF_ThreadGetVar);
+BIF_DECL(BIF_ThreadPause);
+BIF_DECL(BIF_ThreadResume);
 BIF_DECL(BIF_ThreadSetVar);
+BIF_DECL(BIF_ThreadSubmit);
+BIF_DECL(BIF_ThreadTaskResult);
+BIF_DECL(BIF_ThreadTaskWait);
+BIF_DECL(BIF_ThreadWait);
+BIF_DECL(BIF_ThreadWaitVar);
+BIF_DECL(BIF_ChannelClose);
+BIF_DECL(BIF_ChannelCreate);
+BIF_DECL(BIF_ChannelReceive);
+BIF_DECL(BIF_ChannelSend);
+BIF_DECL(BIF_WebSocketClose);
 BIF_DECL(BIF_WebSocketConnect);
 BIF_DECL(BIF_WebSocketDisconnect);
+BIF_DECL(BIF_WebSocketFlush);
+BIF_DECL(BIF_WebSocketOnMessage);
+BIF_DECL(BIF_WebSocketOpen);
 BIF_DECL(BIF_WebSocketReceive);
 BIF_DECL(BIF_WebSocketSend);
+BIF_DECL(BIF_WebSocketSendBuffer);
 
 
 BIF_DECL(Op_Object);
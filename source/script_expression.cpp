@@ -369,7 +369,12 @@ LPTSTR Line::ExpandExpression(int aArgIndex, ResultType &aResult, ResultToken *a
 			if (flags & EIF_VARIADIC)
 				invoke_result = VariadicCall(func, result_token, flags, member, *func_token, params, param_count);
 			else
+			{
+				if (member && member == this_token.callsite->member)
+					Object::sInvokeSite = this_token.callsite; // Let Object::Invoke() use the site's cache for this member.
 				invoke_result = func->Invoke(result_token, flags, member, *func_token, params, param_count);
+				Object::sInvokeSite = nullptr;
+			}
 			if (keep_alive)
 				func->Release();
 
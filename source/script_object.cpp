@@ -10,6 +10,7 @@
 
 #include <errno.h> // For ERANGE.
 #include <initializer_list>
+#include <algorithm> // For std::sort.
 
 
 //
@@ -274,7 +275,7 @@ Map *Map::CloneTo(Map &obj)
 		if (!dst.InitCopy(src))
 			++failure_count;
 	}
-	if (failure_count)
+	if (failure_count || mHash && !obj.BuildHash(mCount)) // The clone keeps this map's order, which may be unsorted.
 	{
 		obj.Release();
 		return NULL;
@@ -466,6 +467,7 @@ bool Object::Delete()
 
 Object::~Object()
 {
+	ChainChanged();
 	if (mBase)
 		mBase->Release();
 }
@@ -473,6 +475,10 @@ Object::~Object()
 
 void Map::Clear()
 {
+	// Once the index is gone, re-entrant lookups during the loop below fall back to binary search,
+	// which may miss keys of an unsorted map; that's harmless since all keys are being removed.
+	FreeHash();
+	mFlags &= ~MapUnsorted;
 	while (mCount)
 	{
 		--mCount;
@@ -523,14 +529,22 @@ ResultType Object::Invoke(IObject_Invoke_PARAMS_DECL)
 	}
 	else
 		name = aName;
+
+	MemberCache *cache = nullptr;
+	if (sInvokeSite)
+	{
+		if (sInvokeSite->member == aName)
+			cache = &sInvokeSite->member_cache;
+		sInvokeSite = nullptr;
+	}
 	
 	ResultType result;
 
 	switch (INVOKE_TYPE)
 	{
-	case IT_GET: result = GetProperty(aResultToken, aFlags, name, aThisToken, aParam, aParamCount); break;
-	case IT_SET: result = SetProperty(aResultToken, aFlags, name, aThisToken, aParam, aParamCount); break;
-	default: result = CallProperty(aResultToken, aFlags, name, aThisToken, aParam, aParamCount); break;
+	case IT_GET: result = GetProperty(aResultToken, aFlags, name, aThisToken, aParam, aParamCount, cache); break;
+	case IT_SET: result = SetProperty(aResultToken, aFlags, name, aThisToken, aParam, aParamCount, cache); break;
+	default: result = CallProperty(aResultToken, aFlags, name, aThisToken, aParam, aParamCount, cache); break;
 	}
 
 	if (result == INVOKE_NOT_HANDLED && !(aFlags & IF_BYPASS_METAFUNC))
@@ -540,16 +554,13 @@ ResultType Object::Invoke(IObject_Invoke_PARAMS_DECL)
 }
 
 
-ResultType Object::GetProperty(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, ExprTokenType *aParam[], int aParamCount)
+ResultType Object::GetProperty(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, ExprTokenType *aParam[], int aParamCount, MemberCache *aCache)
 {
 	IObject *method = nullptr;
+	index_t insert_pos;
 
-	for (auto that = this; that; that = that->mBase)
+	for (Object *that = this; auto field = FindFieldInChain(aName, that, insert_pos, aCache); that = that->mBase)
 	{
-		auto field = that->FindField(aName);
-		if (!field)
-			continue;
-
 		if (field->symbol != SYM_DYNAMIC || field->prop->NoParamGet)
 		{
 			auto result = GetFieldValue(aResultToken, aFlags, *field, aThisToken);
@@ -594,11 +605,11 @@ ResultType Object::GetFieldValue(ResultToken &aResultToken, int aFlags, FieldTyp
 }
 
 
-ResultType Object::CallProperty(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, ExprTokenType *aParam[], int aParamCount)
+ResultType Object::CallProperty(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, ExprTokenType *aParam[], int aParamCount, MemberCache *aCache)
 {
 	ResultToken method_token;
 	method_token.InitResult(aResultToken.buf);
-	auto result = GetMethodValue(method_token, aFlags, aName, aThisToken);
+	auto result = GetMethodValue(method_token, aFlags, aName, aThisToken, aCache);
 	if (result == OK)
 		result = CallAsMethod(method_token, aResultToken, aThisToken, aParam, aParamCount);
 	method_token.Free();
@@ -606,14 +617,12 @@ ResultType Object::CallProperty(ResultToken &aResultToken, int aFlags, name_t aN
 }
 
 
-ResultType Object::GetMethodValue(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken)
+ResultType Object::GetMethodValue(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, MemberCache *aCache)
 {
 	FieldType *getter = nullptr;
-	for (auto that = this; that; that = that->mBase)
+	index_t insert_pos;
+	for (Object *that = this; auto field = FindFieldInChain(aName, that, insert_pos, aCache); that = that->mBase)
 	{
-		auto field = that->FindField(aName);
-		if (!field)
-			continue;
 		if (field->symbol != SYM_DYNAMIC)
 		{
 			getter = field;
@@ -634,17 +643,14 @@ ResultType Object::GetMethodValue(ResultToken &aResultToken, int aFlags, name_t
 }
 
 
-ResultType Object::SetProperty(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, ExprTokenType *aParam[], int aParamCount)
+ResultType Object::SetProperty(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, ExprTokenType *aParam[], int aParamCount, MemberCache *aCache)
 {
 	Object *that;
-	index_t insert_pos, other_pos;
+	index_t insert_pos;
 	FieldType *field = nullptr;
 
-	for (that = this; that; that = that->mBase)
+	for (that = this; auto candidate = FindFieldInChain(aName, that, insert_pos, aCache); that = that->mBase)
 	{
-		auto candidate = that->FindField(aName, that == this ? insert_pos : other_pos);
-		if (!candidate)
-			continue;
 		if (candidate->symbol != SYM_DYNAMIC)
 		{
 			// This value property takes precedence over anything inherited from that->mBase,
@@ -718,6 +724,7 @@ ResultType Object::SetProperty(ResultToken &aResultToken, int aFlags, name_t aNa
 		// Completely delete the property, since other sections currently aren't designed to handle properties
 		// with no value (unlike Array and Map items).
 		mFields.Remove((index_t)(field - mFields), 1);
+		ChainChanged();
 		return OK;
 	}
 
@@ -979,7 +986,10 @@ void Object::RemoveMissingProperties()
 	{
 		i--;
 		if (mFields[i].symbol == SYM_MISSING)
+		{
 			mFields.Remove(i, 1);
+			ChainChanged();
+		}
 	}
 }
 
@@ -1196,6 +1206,7 @@ void Object::DeleteProp(ResultToken &aResultToken, int aID, int aFlags, ExprToke
 		_o_return_empty;
 	field->ReturnMove(aResultToken); // Return the removed value.
 	mFields.Remove((index_t)(field - mFields), 1);
+	ChainChanged();
 	_o_return_empty;
 }
 
@@ -1223,20 +1234,30 @@ void Map::Delete(ResultToken &aResultToken, int aID, int aFlags, ExprTokenType *
 	auto copy = (Pair *)_alloca(sizeof(*item));
 	memcpy(copy, item, sizeof(*item));
 	// Remove item.
-	memmove(item, item + 1, (mCount - (pos + 1)) * sizeof(Pair));
-	mCount--;
+	if (mHash)
+		RemoveHashed(pos, key_type); // Also updates mCount and the key-type offsets.
+	else
+	{
+		memmove(item, item + 1, (mCount - (pos + 1)) * sizeof(Pair));
+		mCount--;
+		if (key_type != SYM_STRING) // i.e. SYM_OBJECT or SYM_INTEGER
+		{
+			mKeyOffsetString--;
+			if (key_type == SYM_INTEGER)
+				mKeyOffsetObject--;
+		}
+	}
+	// Once the Map has shrunk well below the threshold, binary search is fast enough again.
+	// That requires the sorted order, which can't be restored under a live enumerator.
+	if (mHash && mCount < HashThreshold / 2
+		&& (!(mFlags & MapUnsorted) || !mEnumCount && SortItems()))
+		FreeHash();
 	// Free item and keys.
 	copy->Free();
 	if (key_type == SYM_STRING)
 		free(copy->key.s);
-	else // i.e. SYM_OBJECT or SYM_INTEGER
-	{
-		mKeyOffsetString--;
-		if (key_type == SYM_INTEGER)
-			mKeyOffsetObject--;
-		else
-			copy->key.p->Release();
-	}
+	else if (key_type == SYM_OBJECT)
+		copy->key.p->Release();
 	_o_return_retval;
 }
 
@@ -1274,6 +1295,7 @@ void Map::CaseSense(ResultToken &aResultToken, int aID, int aFlags, ExprTokenTyp
 	// the Map must be empty of other types of keys as well.
 	if (mCount)
 		_o_throw(_T("Map must be empty"));
+	FreeHash(); // Any index left over from deleted keys was hashed for the old CaseSense.
 
 	switch (TokenToStringCase(*aParam[0]))
 	{
@@ -1372,10 +1394,27 @@ void Object::OwnProps(ResultToken &aResultToken, int aID, int aFlags, ExprTokenT
 		, static_cast<IndexEnumerator::Callback>(&Object::GetEnumProp)));
 }
 
+class Map::Enumerator : public IndexEnumerator
+// Tells the Map to keep its items in order for as long as the enumerator exists.
+{
+	Map *mMap;
+public:
+	Enumerator(Map *aMap, int aVarCount)
+		: IndexEnumerator(aMap, aVarCount, static_cast<IndexEnumerator::Callback>(&Map::GetEnumItem)), mMap(aMap)
+	{
+		++mMap->mEnumCount;
+	}
+	~Enumerator()
+	{
+		--mMap->mEnumCount; // mMap is still valid, since IndexEnumerator releases it afterward.
+	}
+};
+
 void Map::__Enum(ResultToken &aResultToken, int aID, int aFlags, ExprTokenType *aParam[], int aParamCount)
 {
-	_o_return(new IndexEnumerator(this, ParamIndexToOptionalInt(0, 0)
-		, static_cast<IndexEnumerator::Callback>(&Map::GetEnumItem)));
+	if (mFlags & MapUnsorted)
+		SortItems(); // Enumerate in the usual order.  On failure (out of memory), just enumerate as is.
+	_o_return(new Enumerator(this, ParamIndexToOptionalInt(0, 0)));
 }
 
 void Object::HasOwnProp(ResultToken &aResultToken, int aID, int aFlags, ExprTokenType *aParam[], int aParamCount)
@@ -2356,6 +2395,37 @@ Object::FieldType *Object::FindField(name_t name, index_t &insert_pos)
 	return nullptr;
 }
 
+Object::FieldType *Object::FindFieldInChain(name_t aName, Object *&aThat, index_t &aInsertPos, MemberCache *aCache)
+// Returns the first field named aName in aThat or one of its bases, and sets aThat to the object
+// which contains it, or to nullptr if there is none.  Searches starting at this object set aInsertPos
+// to this object's insertion position for aName and are answered by aCache where possible.
+{
+	FieldType *field = nullptr;
+	bool from_this = aThat == this;
+	if (from_this)
+	{
+		if (field = FindField(aName, aInsertPos))
+			return field;
+		if (aCache && aCache->base == mBase && aCache->version == sChainVersion)
+		{
+			aThat = aCache->holder;
+			return aThat ? &aThat->mFields[aCache->index] : nullptr;
+		}
+		aThat = mBase;
+	}
+	for ( ; aThat; aThat = aThat->mBase)
+		if (field = aThat->FindField(aName))
+			break;
+	if (from_this && aCache)
+	{
+		aCache->base = mBase;
+		aCache->holder = aThat;
+		aCache->index = field ? (index_t)(field - aThat->mFields) : 0;
+		aCache->version = sChainVersion;
+	}
+	return field;
+}
+
 bool Object::HasProp(name_t name)
 {
 	return FindField(name) || mBase && mBase->HasProp(name);
@@ -2426,6 +2496,9 @@ Map::Pair *Map::FindItem(SymbolType key_type, Key key, index_t &insert_pos)
 // key_type and key are output for creating a new item or removing an existing one correctly.
 // left and right must indicate the appropriate section of mItem to search, based on key type.
 {
+	if (mHash)
+		return FindHashed(key_type, key, insert_pos);
+
 	index_t left, right;
 
 	switch (key_type)
@@ -2521,6 +2594,7 @@ Object::FieldType *Object::Insert(name_t name, index_t at)
 	}
 	// There is now definitely room in mFields for a new field.
 	FieldType &field = *mFields.InsertUninitialized(at, 1);
+	ChainChanged();
 	field.key_c = ctolower(*name);
 	field.name = name; // Above has already copied string or called key.p->AddRef() as appropriate.
 	field.Minit(); // Initialize to default value.  Caller will likely reassign.
@@ -2532,16 +2606,24 @@ Map::Pair *Map::Insert(SymbolType key_type, Key key, index_t at)
 // Caller must ensure 'at' is the correct offset for this key.
 {
 	if (mCount == mCapacity && !Expand()  // Attempt to expand if at capacity.
+		|| mHash && (mCount + 1) * 2 > mHashMask + 1 && !BuildHash(mCount + 1)  // Keep the index at most half full.
 		|| key_type == SYM_STRING && !(key.s = _tcsdup(key.s)))  // Attempt to duplicate key-string.
 	{	// Out of memory.
 		return NULL;
 	}
 	// There is now definitely room in mItem for a new item.
 
+	bool keep_order = mHash && KeepOrder();
+	if (mHash && !keep_order)
+		at = MakeRoomHashed(key_type, key);
 	auto &item = mItem[at];
-	if (at < mCount)
+	if (at < mCount && (!mHash || keep_order))
+	{
 		// Move existing items to make room.
 		memmove(&item + 1, &item, (mCount - at) * sizeof(Pair));
+		if (keep_order)
+			HashShift(at, 1);
+	}
 	++mCount; // Only after memmove above.
 
 	// Update key-type offsets based on where and what was inserted; also update this key's ref count:
@@ -2564,11 +2646,277 @@ Map::Pair *Map::Insert(SymbolType key_type, Key key, index_t at)
 	item.key = key; // Above has already copied string or called key.p->AddRef() as appropriate.
 	item.Minit(); // Initialize to default value.  Caller will likely reassign.
 
+	if (mHash)
+		HashAdd(HashKey(key_type, key), at);
+	else if (mCount > HashThreshold && !(mFlags & MapUseLocale))
+		BuildHash(mCount); // Failure is harmless: binary search continues to be used.
+
 	return &item;
 }
 
 
 
+//
+// Map hash index
+//
+
+UINT Map::HashKey(SymbolType key_type, Key key)
+{
+	if (key_type == SYM_STRING)
+	{
+		// FNV-1a.  Caseless maps fold only A-Z, consistent with _tcsicmp in the "C" locale.
+		UINT hash = 2166136261U;
+		if (mFlags & MapCaseless)
+			for (LPTSTR cp = key.s; *cp; ++cp)
+				hash = (hash ^ (TBYTE)ctolower(*cp)) * 16777619U;
+		else
+			for (LPTSTR cp = key.s; *cp; ++cp)
+				hash = (hash ^ (TBYTE)*cp) * 16777619U;
+		return hash;
+	}
+	// Integer or object address: mix all 64 bits so that sequential or aligned values spread out.
+	UINT64 x = (UINT64)key.i;
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCDULL;
+	x ^= x >> 33;
+	return (UINT)x;
+}
+
+bool Map::KeyEquals(SymbolType key_type, Key key, Pair &item)
+{
+	if (key_type != SYM_STRING)
+		return item.key.i == key.i; // Search "(IntKeyType)(INT_PTR)" for comments about object keys.
+	return !((mFlags & MapCaseless) ? _tcsicmp(key.s, item.key.s) : _tcscmp(key.s, item.key.s));
+}
+
+bool Map::BuildHash(index_t min_count)
+// (Re)builds the index for the current contents of mItem, with room for at least min_count keys.
+{
+	index_t slot_count = HashThreshold * 2;
+	while (slot_count < min_count * 2)
+		slot_count *= 2;
+	auto new_hash = (HashSlot *)calloc(slot_count, sizeof(HashSlot));
+	if (!new_hash)
+		return false;
+	free(mHash);
+	mHash = new_hash;
+	mHashMask = slot_count - 1;
+	for (index_t i = 0; i < mCount; ++i)
+		HashAdd(HashKey(KeyTypeAt(i), mItem[i].key), i);
+	return true;
+}
+
+void Map::FreeHash()
+{
+	free(mHash);
+	mHash = nullptr;
+	mHashMask = 0;
+}
+
+void Map::HashAdd(UINT hash, index_t i)
+{
+	index_t j = hash & mHashMask;
+	while (mHash[j].item)
+		j = (j + 1) & mHashMask;
+	mHash[j].hash = hash;
+	mHash[j].item = i + 1;
+}
+
+Map::HashSlot *Map::FindSlot(index_t i)
+// Returns the slot referring to mItem[i], which must be indexed.
+{
+	index_t j = HashKey(KeyTypeAt(i), mItem[i].key) & mHashMask;
+	while (mHash[j].item != i + 1)
+		j = (j + 1) & mHashMask;
+	return mHash + j;
+}
+
+void Map::HashRemove(HashSlot *slot)
+// Empties slot, then shifts back any later slots in the same probe run which would
+// otherwise become unreachable (linear probing without tombstones).
+{
+	index_t j = index_t(slot - mHash);
+	for (;;)
+	{
+		mHash[j].item = 0;
+		index_t k = j;
+		for (;;)
+		{
+			k = (k + 1) & mHashMask;
+			if (!mHash[k].item)
+				return;
+			index_t home = mHash[k].hash & mHashMask;
+			// The entry at k can stay only if its home slot lies cyclically within (j, k].
+			if (j <= k ? (j < home && home <= k) : (j < home || home <= k))
+				continue;
+			break;
+		}
+		mHash[j] = mHash[k];
+		j = k;
+	}
+}
+
+void Map::HashShift(index_t from, int delta)
+// Updates the index after the items from mItem[from] onward were moved by delta positions.
+{
+	for (index_t j = 0; j <= mHashMask; ++j)
+		if (mHash[j].item > from) // i.e. item - 1 >= from.
+			mHash[j].item += delta;
+}
+
+void Map::MoveItem(index_t from, index_t to)
+// Moves an item to an unused position.  Must be called before the key-type offsets are updated.
+{
+	auto slot = FindSlot(from);
+	memcpy(&mItem[to], &mItem[from], sizeof(Pair));
+	slot->item = to + 1;
+}
+
+Map::Pair *Map::FindHashed(SymbolType key_type, Key key, index_t &insert_pos)
+{
+	UINT hash = HashKey(key_type, key);
+	for (index_t j = hash & mHashMask; mHash[j].item; j = (j + 1) & mHashMask)
+	{
+		if (mHash[j].hash != hash)
+			continue;
+		index_t i = mHash[j].item - 1;
+		if (KeyTypeAt(i) == key_type && KeyEquals(key_type, key, mItem[i]))
+			return &mItem[i];
+	}
+	if (KeepOrder()) // Insert at the sorted position, as without the index.
+	{
+		if (key_type == SYM_STRING)
+			FindItem(key.s, mKeyOffsetString, mCount, insert_pos);
+		else if (key_type == SYM_OBJECT)
+			FindItem((IntKeyType)(INT_PTR)key.p, mKeyOffsetObject, mKeyOffsetString, insert_pos);
+		else
+			FindItem(key.i, mKeyOffsetInt, mKeyOffsetObject, insert_pos);
+		return nullptr;
+	}
+	// New keys go at the end of their section; see MakeRoomHashed().
+	insert_pos = key_type == SYM_INTEGER ? mKeyOffsetObject : key_type == SYM_OBJECT ? mKeyOffsetString : mCount;
+	return nullptr;
+}
+
+Map::index_t Map::MakeRoomHashed(SymbolType key_type, Key key)
+// Frees up the position just past the end of key_type's section by moving the first item of
+// each following section to the end of that section.  Returns the position.
+{
+	index_t start = key_type == SYM_INTEGER ? mKeyOffsetInt : key_type == SYM_OBJECT ? mKeyOffsetObject : mKeyOffsetString;
+	index_t at = key_type == SYM_INTEGER ? mKeyOffsetObject : key_type == SYM_OBJECT ? mKeyOffsetString : mCount;
+	// Keys added in ascending order (such as from a sorted file) keep the map sorted.
+	if (at > start)
+	{
+		Pair &last = mItem[at - 1];
+		int result = key_type != SYM_STRING ? (key.i < last.key.i ? -1 : 1)
+			: (mFlags & MapCaseless) ? _tcsicmp(key.s, last.key.s) : _tcscmp(key.s, last.key.s);
+		if (result < 0)
+			mFlags |= MapUnsorted;
+	}
+	if (key_type != SYM_STRING)
+	{
+		if (mCount - mKeyOffsetString > 1)
+			mFlags |= MapUnsorted;
+		if (mKeyOffsetString < mCount)
+			MoveItem(mKeyOffsetString, mCount);
+		if (key_type == SYM_INTEGER)
+		{
+			if (mKeyOffsetString - mKeyOffsetObject > 1)
+				mFlags |= MapUnsorted;
+			if (mKeyOffsetObject < mKeyOffsetString)
+				MoveItem(mKeyOffsetObject, mKeyOffsetString);
+		}
+	}
+	return at;
+}
+
+void Map::RemoveHashed(index_t pos, SymbolType key_type)
+// Removes mItem[pos] by filling the gap with the last item of its section, then filling that
+// gap with the last item of each following section.  The caller frees the removed item.
+// While KeepOrder(), the following items are shifted down instead, as without the index.
+{
+	HashRemove(FindSlot(pos));
+	if (KeepOrder())
+	{
+		memmove(&mItem[pos], &mItem[pos + 1], (mCount - (pos + 1)) * sizeof(Pair));
+		HashShift(pos + 1, -1);
+	}
+	else
+		FillGap(pos, key_type);
+	mCount--;
+	if (key_type != SYM_STRING)
+	{
+		mKeyOffsetString--;
+		if (key_type == SYM_INTEGER)
+			mKeyOffsetObject--;
+	}
+}
+
+void Map::FillGap(index_t pos, SymbolType key_type)
+// Helper for RemoveHashed(); must be called before the key-type offsets are updated.
+{
+	index_t end = key_type == SYM_INTEGER ? mKeyOffsetObject : key_type == SYM_OBJECT ? mKeyOffsetString : mCount;
+	index_t gap = pos;
+	if (gap != end - 1)
+	{
+		MoveItem(end - 1, gap);
+		mFlags |= MapUnsorted;
+	}
+	gap = end - 1;
+	if (key_type == SYM_INTEGER && mKeyOffsetObject < mKeyOffsetString)
+	{
+		if (mKeyOffsetString - mKeyOffsetObject > 1)
+			mFlags |= MapUnsorted;
+		MoveItem(mKeyOffsetString - 1, gap);
+		gap = mKeyOffsetString - 1;
+	}
+	if (key_type != SYM_STRING && mKeyOffsetString < mCount)
+	{
+		if (mCount - mKeyOffsetString > 1)
+			mFlags |= MapUnsorted;
+		MoveItem(mCount - 1, gap);
+	}
+}
+
+bool Map::SortItems()
+// Restores the sorted order of each section after MapUnsorted was set.
+{
+	auto order = (index_t *)malloc(mCount * sizeof(index_t) * 2);
+	auto sorted = (Pair *)malloc(mCapacity * sizeof(Pair));
+	if (!order || !sorted)
+	{
+		free(order);
+		free(sorted);
+		return false;
+	}
+	for (index_t i = 0; i < mCount; ++i)
+		order[i] = i;
+	auto by_int = [this](index_t a, index_t b) { return mItem[a].key.i < mItem[b].key.i; };
+	std::sort(order + mKeyOffsetInt, order + mKeyOffsetObject, by_int);
+	std::sort(order + mKeyOffsetObject, order + mKeyOffsetString, by_int); // Objects are ordered by address.
+	if (mFlags & MapCaseless)
+		std::sort(order + mKeyOffsetString, order + mCount, [this](index_t a, index_t b) { return _tcsicmp(mItem[a].key.s, mItem[b].key.s) < 0; });
+	else
+		std::sort(order + mKeyOffsetString, order + mCount, [this](index_t a, index_t b) { return _tcscmp(mItem[a].key.s, mItem[b].key.s) < 0; });
+	index_t *new_pos = order + mCount;
+	for (index_t i = 0; i < mCount; ++i)
+	{
+		memcpy(&sorted[i], &mItem[order[i]], sizeof(Pair));
+		new_pos[order[i]] = i;
+	}
+	free(mItem);
+	mItem = sorted;
+	if (mHash) // Redirect each slot to the item's new position; hashes are unchanged.
+		for (index_t j = 0; j <= mHashMask; ++j)
+			if (mHash[j].item)
+				mHash[j].item = new_pos[mHash[j].item - 1] + 1;
+	free(order);
+	mFlags &= ~MapUnsorted;
+	return true;
+}
+
+
+
 //
 // Func: A function, either built-in or created by a function definition.
 //
@@ -3019,6 +3367,14 @@ ObjectMember RegExMatchObject::sMembers[] =
 	Object_Member(Pos, Invoke, M_Pos, IT_GET, 0, 1),
 };
 
+ObjectMember RegExSetObject::sMembers[] =
+{
+	Object_Method(__New, 1, MAXP_VARIADIC),
+	Object_Method(MatchAny, 1, 2),
+	Object_Method(Matches, 1, 2),
+	Object_Property_get(Count)
+};
+
 
 
 ObjectMember Object::sErrorMembers[]
@@ -3136,7 +3492,9 @@ void Object::CreateRootPrototypes()
 			{_T("MenuBar"), &UserMenu::sBarPrototype, NewObject<UserMenu::Bar>}
 		}},
 		{_T("RegExMatchInfo"), &RegExMatchObject::sPrototype, no_ctor
-			, RegExMatchObject::sMembers, _countof(RegExMatchObject::sMembers)}
+			, RegExMatchObject::sMembers, _countof(RegExMatchObject::sMembers)},
+		{_T("RegExSet"), &RegExSetObject::sPrototype, NewObject<RegExSetObject>
+			, RegExSetObject::sMembers, _countof(RegExSetObject::sMembers)}
 	});
 
 	// Parameter counts are specified for static Call in the following classes
@@ -3171,6 +3529,8 @@ void Object::CreateRootPrototypes()
 }
 
 Object *Object::sAnyPrototype;
+UINT Object::sChainVersion = 1; // Nonzero, so a new MemberCache never matches.
+CallSite *Object::sInvokeSite;
 Object *Func::sPrototype;
 Object *Object::sPrototype;
 
@@ -3188,6 +3548,7 @@ Object *BufferObject::sPrototype;
 Object *ClipboardAll::sPrototype;
 
 Object *RegExMatchObject::sPrototype;
+Object *RegExSetObject::sPrototype;
 
 Object *GuiType::sPrototype;
 Object *UserMenu::sPrototype;
@@ -323,7 +323,8 @@ protected:
 	{
 		ClassPrototype = 0x01,
 		NativeClassPrototype = 0x02,
-		LastObjectFlag = 0x02
+		UsedAsBase = 0x04, // Set when another object inherits from this one; see sChainVersion.
+		LastObjectFlag = 0x04
 	};
 
 	Object *CloneTo(Object &aTo);
@@ -344,6 +345,15 @@ private:
 	
 	FieldType *Insert(name_t name, index_t at);
 
+	// Incremented whenever the fields or base of an object with the UsedAsBase flag change,
+	// or such an object is deleted, invalidating every MemberCache.
+	static UINT sChainVersion;
+	void ChainChanged()
+	{
+		if (mFlags & UsedAsBase)
+			++sChainVersion;
+	}
+
 	bool SetInternalCapacity(index_t new_capacity);
 	bool Expand()
 	// Expands mFields by at least one field.
@@ -351,13 +361,32 @@ private:
 		return SetInternalCapacity(mFields.Capacity() ? mFields.Capacity() * 2 : 4);
 	}
 
+public:
+	// Remembers where a call site's member was last found, so that searching each base object
+	// can be skipped while the inheritance chain is unchanged.  Only the first match is cached;
+	// callers which need to continue the search do so normally.
+	struct MemberCache
+	{
+		Object *base = nullptr; // mBase of the object which was searched.
+		Object *holder = nullptr; // The first object in the chain beginning at base which has the member, or nullptr.
+		index_t index = 0; // Index of the member within holder->mFields.
+		UINT version = 0; // sChainVersion at the time the above were set.
+	};
+
+	// Set by the caller of Invoke() to allow the invoked object to use its member_cache.
+	// Object::Invoke() resets it, so it is never applied to nested invocations.
+	static CallSite *sInvokeSite;
+
+private:
+	FieldType *FindFieldInChain(name_t aName, Object *&aThat, index_t &aInsertPos, MemberCache *aCache);
+
 protected:
-	ResultType GetProperty(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, ExprTokenType *aParam[], int aParamCount);
-	ResultType SetProperty(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, ExprTokenType *aParam[], int aParamCount);
-	ResultType CallProperty(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, ExprTokenType *aParam[], int aParamCount);
+	ResultType GetProperty(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, ExprTokenType *aParam[], int aParamCount, MemberCache *aCache);
+	ResultType SetProperty(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, ExprTokenType *aParam[], int aParamCount, MemberCache *aCache);
+	ResultType CallProperty(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, ExprTokenType *aParam[], int aParamCount, MemberCache *aCache);
 
 	ResultType GetFieldValue(ResultToken &aResultToken, int aFlags, FieldType &aField, ExprTokenType &aThisToken);
-	ResultType GetMethodValue(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken);
+	ResultType GetMethodValue(ResultToken &aResultToken, int aFlags, name_t aName, ExprTokenType &aThisToken, MemberCache *aCache);
 
 	ResultType ApplyParams(ResultToken &aThisResultToken, int aFlags, ExprTokenType *aParam[], int aParamCount);
 	ResultType CallEtter(ResultToken &aResultToken, int aFlags, IObject *aEtter, ExprTokenType &aThisToken, ExprTokenType *aParam[], int aParamCount);
@@ -453,7 +482,10 @@ public:
 	{
 		auto field = FindField(aName);
 		if (field)
+		{
 			mFields.Remove((index_t)(field - mFields), 1);
+			ChainChanged();
+		}
 	}
 	
 	Property *DefineProperty(name_t aName);
@@ -465,10 +497,14 @@ public:
 	void SetBase(Object *aNewBase)
 	{ 
 		if (aNewBase)
+		{
 			aNewBase->AddRef();
+			aNewBase->mFlags |= UsedAsBase;
+		}
 		if (mBase)
 			mBase->Release();
 		mBase = aNewBase;
+		ChainChanged();
 	}
 
 	bool IsClassPrototype() { return mFlags & ClassPrototype; }
@@ -639,7 +675,8 @@ class Map : public Object
 	enum MapOption : decltype(mFlags)
 	{
 		MapCaseless = LastObjectFlag << 1,
-		MapUseLocale = MapCaseless << 1
+		MapUseLocale = MapCaseless << 1,
+		MapUnsorted = MapUseLocale << 1 // Keys within each section of mItem may be out of order; see mHash.
 	};
 
 	Pair *mItem = nullptr;
@@ -655,6 +692,25 @@ class Map : public Object
 	static const index_t mKeyOffsetInt = 0;
 	index_t mKeyOffsetObject = 0, mKeyOffsetString = 0;
 
+	// Hash index over mItem, built once the Map grows past HashThreshold keys (unless CaseSense is
+	// "Locale", since lstrcmpi has no matching hash).  While it exists, keys are found by hashing
+	// and new keys are added at the end of their section rather than at their sorted position,
+	// so each insertion or deletion moves at most three items instead of memmove'ing the tail.
+	// MapUnsorted is then set, and __Enum calls SortItems() to restore the sorted order.
+	// While an enumerator exists, the sorted order is kept instead (see KeepOrder()), so that
+	// items don't move around under the enumerator and it never needs to sort again.
+	struct HashSlot
+	{
+		UINT hash;
+		index_t item; // Index in mItem + 1, or 0 if this slot is empty.
+	};
+	HashSlot *mHash = nullptr;
+	index_t mHashMask = 0; // Slot count - 1; the slot count is a power of 2, at least twice mCount.
+	static const index_t HashThreshold = 256; // The index is freed again below half this many keys.
+	UINT mEnumCount = 0; // Number of enumerators which currently exist for this Map.
+
+	class Enumerator;
+
 	Map() {}
 	void Clear();
 	~Map()
@@ -662,6 +718,23 @@ class Map : public Object
 		Clear();
 		free(mItem);
 	}
+
+	UINT HashKey(SymbolType key_type, Key key);
+	SymbolType KeyTypeAt(index_t i) { return i < mKeyOffsetObject ? SYM_INTEGER : i < mKeyOffsetString ? SYM_OBJECT : SYM_STRING; }
+	bool KeyEquals(SymbolType key_type, Key key, Pair &item);
+	bool BuildHash(index_t min_count);
+	void FreeHash();
+	void HashAdd(UINT hash, index_t i);
+	HashSlot *FindSlot(index_t i);
+	void HashRemove(HashSlot *slot);
+	void HashShift(index_t from, int delta);
+	bool KeepOrder() { return mEnumCount && !(mFlags & MapUnsorted); }
+	void MoveItem(index_t from, index_t to);
+	Pair *FindHashed(SymbolType key_type, Key key, index_t &insert_pos);
+	index_t MakeRoomHashed(SymbolType key_type, Key key);
+	void RemoveHashed(index_t pos, SymbolType key_type);
+	void FillGap(index_t pos, SymbolType key_type);
+	bool SortItems();
 	 
 	Pair *FindItem(LPTSTR val, index_t left, index_t right, index_t &insert_pos);
 	Pair *FindItem(IntKeyType val, index_t left, index_t right, index_t &insert_pos);
@@ -815,6 +888,35 @@ public:
 };
 
 
+//
+// RegExSetObject:  Several patterns compiled once, for finding which of them match a haystack.
+//
+struct RegExSetData;
+class RegExSetObject : public Object
+{
+	RegExSetData *mData = nullptr; // Defined in regex.cpp.
+
+	~RegExSetObject();
+
+	void SetPatterns(ResultToken &aResultToken, ExprTokenType *aParam[], int aParamCount);
+	void Match(ResultToken &aResultToken, ExprTokenType *aParam[], int aParamCount, bool aFindAll);
+
+public:
+	static RegExSetObject *Create();
+
+	enum MemberID
+	{
+		M___New,
+		M_MatchAny,
+		M_Matches,
+		P_Count
+	};
+	static ObjectMember sMembers[];
+	static Object *sPrototype;
+	void Invoke(ResultToken &aResultToken, int aID, int aFlags, ExprTokenType *aParam[], int aParamCount);
+};
+
+
 //
 // Buffer
 //
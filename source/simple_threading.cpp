@@ -2,199 +2,521 @@
 #include "simple_threading.h"
 #include <sstream>
 #include "websocket_client.h"
+#include "globaldata.h"
 
 // Static member definitions
 std::atomic<int> SimpleThreading::s_threadCount(0);
 std::mutex SimpleThreading::s_globalMutex;
 std::unordered_map<DWORD, std::unique_ptr<std::thread>> SimpleThreading::s_threads;
-std::unordered_map<std::string, std::string> SimpleThreading::s_globalVars;
+SharedVarStore SimpleThreading::s_globalVars;
 std::atomic<DWORD> SimpleThreading::s_nextThreadId(1);
+SRWLOCK SimpleThreading::s_statusLock = SRWLOCK_INIT;
+std::unordered_map<DWORD, std::shared_ptr<ThreadStatus>> SimpleThreading::s_status;
+std::atomic<int> SimpleThreading::s_statusWaiters(0);
 std::unordered_map<DWORD, std::unique_ptr<SimpleThreading::ThreadInterpreter>> SimpleThreading::s_interpreters;
 std::unordered_map<DWORD, HANDLE> SimpleThreading::s_processes;
 std::unordered_map<DWORD, std::atomic<bool>> SimpleThreading::s_stopFlags;
+std::mutex SimpleThreading::s_waitMutex;
+std::condition_variable SimpleThreading::s_varChanged;
+std::atomic<int> SimpleThreading::s_varWaiters(0);
+std::atomic<int> SimpleThreading::s_mainWaiters(0);
+std::atomic<bool> SimpleThreading::s_mainWakePending(false);
+SRWLOCK SimpleThreading::s_channelLock = SRWLOCK_INIT;
+std::unordered_map<DWORD, std::shared_ptr<ThreadChannel>> SimpleThreading::s_channels;
+std::atomic<DWORD> SimpleThreading::s_nextChannelId(1);
+SimpleThreading::ThreadPool *SimpleThreading::s_pool = nullptr;
+std::mutex SimpleThreading::s_poolMutex;
+unsigned int SimpleThreading::s_poolSize = 0;
+SRWLOCK SimpleThreading::s_taskLock = SRWLOCK_INIT;
+std::unordered_map<DWORD, std::shared_ptr<PooledTask>> SimpleThreading::s_tasks;
+int SimpleThreading::s_uncollectedTasks = 0;
 
 class SimpleThreading::ThreadInterpreter {
 public:
-    explicit ThreadInterpreter(DWORD id) : m_id(id) {}
+    ThreadInterpreter(DWORD id, std::atomic<bool> *stopFlag, ThreadStatus *status) : m_id(id), m_stop(stopFlag), m_status(status), m_ownsEvents(true)
+    {
+        m_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        m_resumeEvent = CreateEvent(NULL, TRUE, TRUE, NULL);
+        m_doneEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    }
+    // For pooled tasks, whose flag, status and events belong to the PooledTask.
+    explicit ThreadInterpreter(PooledTask &task)
+        : m_id(task.id), m_stop(&task.stop), m_status(task.status.get()), m_stopEvent(task.stopEvent)
+        , m_resumeEvent(task.resumeEvent), m_doneEvent(task.doneEvent), m_ownsEvents(false) {}
+    ~ThreadInterpreter()
+    {
+        if (!m_ownsEvents) return;
+        if (m_stopEvent) CloseHandle(m_stopEvent);
+        if (m_resumeEvent) CloseHandle(m_resumeEvent);
+        if (m_doneEvent) CloseHandle(m_doneEvent);
+    }
+
+    // Called after the stop flag has been set, to end the idle wait in run().
+    void SignalStop() { if (m_stopEvent) SetEvent(m_stopEvent); }
+
+    // Callers serialize these via s_globalMutex.
+    void Pause() { ResetEvent(m_resumeEvent); m_status->pauseRequested = true; }
+    void Resume() { m_status->pauseRequested = false; SetEvent(m_resumeEvent); }
+    // Signaled once the script has finished (as opposed to the thread, which idles until stopped).
+    HANDLE DoneEvent() const { return m_doneEvent; }
+
+    // Worker scripts are compiled once into a flat instruction stream before execution.
+    // Block structure is resolved into jump targets, integer operands are parsed up front
+    // and locals are addressed by slot, so the hot loop does no string work of its own.
+    enum OpCode : unsigned char {
+        OP_NOP,         // Stray "end" etc.
+        OP_IDLE,        // Unrecognised line; yields for 1ms as the line-based interpreter did.
+        OP_WHILE,       // if (!cond) goto target
+        OP_IF,          // if (!cond) goto target (else-branch or past end)
+        OP_JUMP,        // "else" reached from the if-branch, or "end" of a while loop.
+        OP_WS_CONNECT,
+        OP_WS_SEND,
+        OP_WS_RECEIVE,
+        OP_WS_DISCONNECT,
+        OP_SETVAR,      // ThreadSetVar/SetVar
+        OP_GETVAR,
+        OP_SLEEP,
+        OP_INC,
+        OP_ASSIGN,
+        OP_WAITVAR,     // ThreadWaitVar(name[, timeout])
+        OP_CHAN_SEND,   // ChannelSend(id, value)
+        OP_CHAN_RECV,   // ChannelReceive(id[, timeout]) -> thread_<id>_last_receive
+        OP_RETURN,      // Return([value]) -> thread_<id>_result or the pooled task's result
+        OP_ERROR        // Sets thread_<id>_error and stops.
+    };
+
+    enum CondOp : unsigned char { COND_LE, COND_GE, COND_EQ, COND_NE, COND_LT, COND_GT, COND_VALUE };
+
+    struct Instr {
+        OpCode op = OP_NOP;
+        CondOp cond = COND_VALUE;
+        int slot = -1;          // Local slot for OP_INC/OP_ASSIGN and the left operand of a condition.
+        size_t target = 0;      // Jump target for OP_WHILE/OP_IF/OP_JUMP.
+        long long imm = 0;      // Assigned value, sleep time/timeout, or right operand of a condition.
+        long long lhsConst = 0; // Left operand of a condition while its slot is unset (or if slot == -1).
+        long long line = 0;     // 1-based line number reported as thread_<id>_line.
+        DWORD channel = 0;      // Channel id for OP_CHAN_SEND/OP_CHAN_RECV.
+        std::string s1, s2;     // String operands (already unquoted).
+    };
+
+    struct Program {
+        std::vector<Instr> code;
+        size_t slotCount = 0;
+    };
+
+    static Program Compile(const std::string &script);
+
     void run(const std::string &script)
     {
-        // Per-thread locals for basic expression/eval
-        std::unordered_map<std::string, long long> locals;
-
-        auto trim = [](std::string &s) {
-            size_t a = s.find_first_not_of(" \t\r\n");
-            size_t b = s.find_last_not_of(" \t\r\n");
-            if (a == std::string::npos) { s.clear(); return; }
-            s = s.substr(a, b - a + 1);
-        };
-
-        auto stripQuotes = [](std::string s) -> std::string {
-            if (s.size() >= 2 && ((s.front()== '"' && s.back()== '"') || (s.front()== '\'' && s.back()== '\'')))
-                return s.substr(1, s.size()-2);
-            return s;
-        };
-
-        auto parseInt = [](const std::string &s, long long &out) -> bool {
-            try { out = std::stoll(s); return true; } catch (...) { return false; }
-        };
-
-        auto sleepMs = [](int ms) {
-            if (ms < 0) ms = 0;
-            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
-        };
-
-        auto setErrorAndStop = [&](const std::string &msg) {
-            SimpleThreading::SetGlobalVar("thread_" + std::to_string(m_id) + "_error", msg);
-        };
-
-        auto evalCond = [&](std::string expr) -> bool {
-            trim(expr);
-            // support: var <op> number
-            const char* ops[] = {"<=",">=","==","!=","<",">"};
-            int which = -1; size_t pos = std::string::npos;
-            for (int i=0;i<6;i++){ size_t p = expr.find(ops[i]); if (p!=std::string::npos){ which=i; pos=p; break; } }
-            if (which == -1) { long long v; if (parseInt(expr, v)) return v!=0; return false; }
-            std::string lhs = expr.substr(0,pos), rhs = expr.substr(pos + std::string(ops[which]).size());
-            trim(lhs); trim(rhs);
-            long long l=0,r=0; auto itL = locals.find(lhs); if (itL!=locals.end()) l=itL->second; else parseInt(lhs,l);
-            parseInt(rhs,r);
-            switch(which){
-                case 0: return l<=r;
-                case 1: return l>=r;
-                case 2: return l==r;
-                case 3: return l!=r;
-                case 4: return l< r;
-                case 5: return l> r;
-            }
-            return false;
-        };
-
-        // Load script into lines
-        std::vector<std::string> lines;
-        {
-            std::istringstream ss(script);
-            std::string l; while (std::getline(ss,l)) { trim(l); if (!l.empty() && l[0] != ';') lines.push_back(l); }
-        }
-
-        // Execute with minimal control flow support
-        std::vector<size_t> loopStack;           // positions of while
-        std::vector<bool>  execStack;            // whether current if-block is executing
-        size_t pc = 0; bool exec = true;
-        while (pc < lines.size()) {
-            auto itStop = SimpleThreading::s_stopFlags.find(m_id);
-            if (itStop != SimpleThreading::s_stopFlags.end() && itStop->second.load()) break;
-
-            std::string line = lines[pc];
-            SimpleThreading::SetGlobalVar("thread_" + std::to_string(m_id) + "_line", std::to_string((int)pc+1));
-
-            // while ... / end
-            if (line.rfind("while ",0) == 0) {
-                bool cond = exec ? evalCond(line.substr(6)) : false;
-                if (exec) {
-                    if (cond) { loopStack.push_back(pc); execStack.push_back(exec); pc++; continue; }
-                    // skip to matching end
-                    int depth=1; size_t q=pc+1; while (q<lines.size() && depth>0){
-                        if (lines[q].rfind("while ",0)==0) depth++;
-                        else if (lines[q]=="end") depth--; else if (lines[q].rfind("if ",0)==0) { /* skip but track ends */ }
-                        q++; }
-                    pc = q; continue;
-                } else { pc++; continue; }
-            }
-            if (line == "end") {
-                if (!loopStack.empty()) { size_t start = loopStack.back(); bool parentExec = execStack.back(); loopStack.pop_back(); execStack.pop_back();
-                    // re-eval condition
-                    bool cond = parentExec ? evalCond(lines[start].substr(6)) : false;
-                    if (parentExec && cond) { pc = start+1; continue; }
-                    exec = parentExec; pc++; continue; }
-                exec = true; pc++; continue;
-            }
+        Program prog = Compile(script);
+        Execute(prog);
+        m_status->SetState(ThreadStatus::Completed);
+        SetEvent(m_doneEvent);
+        SimpleThreading::NotifyVarChanged();
 
-            // if / else
-            if (line.rfind("if ",0) == 0) {
-                bool cond = exec ? evalCond(line.substr(3)) : false;
-                execStack.push_back(exec);
-                exec = exec && cond; pc++; continue;
-            }
-            if (line == "else") {
-                if (execStack.empty()) { setErrorAndStop("else without if"); break; }
-                bool parent = execStack.back();
-                // flip exec only within this if-else
-                exec = parent && !exec; pc++; continue;
-            }
+        // Lightweight per-thread message loop.  It sleeps until a message arrives or the thread
+        // is stopped, so idle workers use no CPU; the heartbeat is derived from idleSince.
+        m_status->idleSince = GetTickCount();
+        m_status->idle = true;
+        while (!m_stop->load()) {
+            MSG msg; while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) { TranslateMessage(&msg); DispatchMessage(&msg); }
+            if (m_stop->load()) break;
+            MsgWaitForMultipleObjects(1, &m_stopEvent, FALSE, INFINITE, QS_ALLINPUT);
+        }
+    }
 
-            // Skip when current block is inactive
-            if (!exec) { pc++; continue; }
+    // Pooled tasks run to completion and then give the thread back to the pool.
+    void RunTask(PooledTask &task)
+    {
+        Execute(Compile(task.script));
+        task.result = std::move(m_result);
+        task.error = std::move(m_error);
+    }
 
-            // Supported commands
-            if (line.rfind("WebSocketConnect(", 0) == 0 && line.back() == ')') {
-                std::string arg = line.substr(17, line.size()-18); trim(arg);
-                std::string url = stripQuotes(arg);
-                bool ok = g_WebSocketClient->connect(url);
-                SimpleThreading::SetGlobalVar("thread_" + std::to_string(m_id) + "_ws_status", ok ? "connected" : "failed");
-                pc++; continue;
-            }
-            if (line.rfind("WebSocketSend(", 0) == 0 && line.back() == ')') {
-                std::string arg = line.substr(14, line.size()-15); trim(arg);
-                std::string msg = stripQuotes(arg);
-                g_WebSocketClient->send_message(msg);
-                SimpleThreading::SetGlobalVar("thread_" + std::to_string(m_id) + "_ws_last_sent", msg);
-                pc++; continue;
-            }
-            if (line == "WebSocketReceive()") {
-                std::string msg = g_WebSocketClient->receive_message();
-                if (!msg.empty()) SimpleThreading::SetGlobalVar("thread_" + std::to_string(m_id) + "_ws_last_received", msg);
-                pc++; continue;
-            }
-            if (line == "WebSocketDisconnect()") {
-                g_WebSocketClient->disconnect();
-                SimpleThreading::SetGlobalVar("thread_" + std::to_string(m_id) + "_ws_status", "disconnected");
-                pc++; continue;
-            }
-            if (line.rfind("ThreadSetVar(", 0) == 0 && line.back() == ')') {
-                std::string args = line.substr(13, line.size() - 14); size_t comma = args.find(',');
-                if (comma != std::string::npos) { std::string k = args.substr(0, comma); std::string v = args.substr(comma + 1); trim(k); trim(v); k=stripQuotes(k); v=stripQuotes(v); SimpleThreading::SetGlobalVar(k, v); }
-                else { setErrorAndStop("ThreadSetVar requires 2 args"); break; }
-                pc++; continue;
-            }
-            if (line.rfind("ThreadGetVar(", 0) == 0 && line.back() == ')') {
-                std::string arg = line.substr(13, line.size() - 14); trim(arg); arg=stripQuotes(arg);
-                std::string val = SimpleThreading::GetGlobalVar(arg);
-                SimpleThreading::SetGlobalVar("thread_" + std::to_string(m_id) + "_last_get", val);
-                pc++; continue;
-            }
-            if (line.rfind("Sleep(", 0) == 0 && line.back() == ')') {
-                std::string arg = line.substr(6, line.size() - 7); trim(arg); long long ms; if (parseInt(arg, ms)) sleepMs((int)ms); else sleepMs(1);
-                pc++; continue;
-            }
-            if (line.rfind("SetVar(", 0) == 0 && line.back() == ')') {
-                std::string args = line.substr(7, line.size() - 8); size_t comma = args.find(',');
-                if (comma != std::string::npos) { std::string k = args.substr(0, comma); std::string v = args.substr(comma + 1); trim(k); trim(v); k=stripQuotes(k); v=stripQuotes(v); SimpleThreading::SetGlobalVar(k, v); }
-                pc++; continue;
+private:
+    void Execute(const Program &prog);
+
+    // Blocks while paused (or until stopped), reporting the paused state meanwhile.
+    void WaitWhilePaused()
+    {
+        m_status->SetState(ThreadStatus::Paused);
+        SimpleThreading::NotifyVarChanged();
+        HANDLE handles[] = { m_resumeEvent, m_stopEvent };
+        WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+        m_status->SetState(ThreadStatus::Running);
+        SimpleThreading::NotifyVarChanged();
+    }
+
+    DWORD m_id;
+    std::atomic<bool> *m_stop;
+    ThreadStatus *m_status;
+    HANDLE m_stopEvent;
+    HANDLE m_resumeEvent;
+    HANDLE m_doneEvent;
+    bool m_ownsEvents;
+    SharedValue m_result;
+    std::string m_error;
+};
+
+SimpleThreading::ThreadInterpreter::Program SimpleThreading::ThreadInterpreter::Compile(const std::string &script)
+{
+    auto trim = [](std::string &s) {
+        size_t a = s.find_first_not_of(" \t\r\n");
+        size_t b = s.find_last_not_of(" \t\r\n");
+        if (a == std::string::npos) { s.clear(); return; }
+        s = s.substr(a, b - a + 1);
+    };
+
+    auto stripQuotes = [](std::string s) -> std::string {
+        if (s.size() >= 2 && ((s.front()== '"' && s.back()== '"') || (s.front()== '\'' && s.back()== '\'')))
+            return s.substr(1, s.size()-2);
+        return s;
+    };
+
+    auto parseInt = [](const std::string &s, long long &out) -> bool {
+        try { out = std::stoll(s); return true; } catch (...) { return false; }
+    };
+
+    // Splits "a, b" at the first comma; rest is empty if there is none.
+    auto splitArg = [&](const std::string &args, std::string &first, std::string &rest) -> bool {
+        size_t comma = args.find(',');
+        first = args.substr(0, comma); trim(first);
+        rest = comma == std::string::npos ? "" : args.substr(comma + 1); trim(rest);
+        return comma != std::string::npos;
+    };
+    auto argsOf = [](const std::string &line) { size_t open = line.find('('); return line.substr(open + 1, line.size() - open - 2); };
+
+    Program prog;
+    std::unordered_map<std::string, int> slots;
+    auto slotOf = [&](const std::string &name) -> int {
+        auto it = slots.find(name);
+        if (it != slots.end()) return it->second;
+        int slot = (int)prog.slotCount++;
+        slots.emplace(name, slot);
+        return slot;
+    };
+
+    auto compileCond = [&](std::string expr, Instr &ins) {
+        trim(expr);
+        // support: var <op> number
+        static const char* ops[] = {"<=",">=","==","!=","<",">"};
+        int which = -1; size_t pos = std::string::npos;
+        for (int i=0;i<6;i++){ size_t p = expr.find(ops[i]); if (p!=std::string::npos){ which=i; pos=p; break; } }
+        if (which == -1) { long long v; ins.cond = COND_VALUE; ins.lhsConst = parseInt(expr, v) ? (v != 0) : 0; return; }
+        std::string lhs = expr.substr(0,pos), rhs = expr.substr(pos + std::string(ops[which]).size());
+        trim(lhs); trim(rhs);
+        ins.cond = (CondOp)which;
+        ins.slot = slotOf(lhs);
+        parseInt(lhs, ins.lhsConst);
+        parseInt(rhs, ins.imm);
+    };
+
+    // Load script into lines
+    std::vector<std::string> lines;
+    {
+        std::istringstream ss(script);
+        std::string l; while (std::getline(ss,l)) { trim(l); if (!l.empty() && l[0] != ';') lines.push_back(l); }
+    }
+
+    // Open while/if blocks awaiting their "end"; elsePc is the pending else-jump of an if, if any.
+    struct Block { bool isLoop; size_t pc; size_t elsePc; bool hasElse; };
+    std::vector<Block> blocks;
+
+    prog.code.reserve(lines.size());
+    for (size_t n = 0; n < lines.size(); ++n) {
+        const std::string &line = lines[n];
+        Instr ins;
+        ins.line = (long long)n + 1;
+        size_t pc = prog.code.size();
+
+        if (line.rfind("while ",0) == 0) {
+            ins.op = OP_WHILE; compileCond(line.substr(6), ins);
+            blocks.push_back({true, pc, 0, false});
+        }
+        else if (line == "end") {
+            if (blocks.empty()) ins.op = OP_NOP;
+            else {
+                Block b = blocks.back(); blocks.pop_back();
+                if (b.isLoop) { ins.op = OP_JUMP; ins.target = b.pc; prog.code[b.pc].target = pc + 1; }
+                else {
+                    ins.op = OP_NOP;
+                    if (b.hasElse) prog.code[b.elsePc].target = pc + 1;
+                    else prog.code[b.pc].target = pc + 1;
+                }
             }
-            if (line.size() >= 3 && line.substr(line.size()-2) == "++") {
-                std::string var = line.substr(0, line.size()-2); trim(var); long long cur = 0; auto itL = locals.find(var); if (itL != locals.end()) cur = itL->second; locals[var] = cur + 1; pc++; continue;
+        }
+        else if (line.rfind("if ",0) == 0) {
+            ins.op = OP_IF; compileCond(line.substr(3), ins);
+            blocks.push_back({false, pc, 0, false});
+        }
+        else if (line == "else") {
+            if (blocks.empty() || blocks.back().isLoop || blocks.back().hasElse) { ins.op = OP_ERROR; ins.s1 = "else without if"; }
+            else {
+                Block &b = blocks.back();
+                ins.op = OP_JUMP; b.hasElse = true; b.elsePc = pc;
+                prog.code[b.pc].target = pc + 1;
             }
+        }
+        else if (line.rfind("WebSocketConnect(", 0) == 0 && line.back() == ')') {
+            std::string arg = line.substr(17, line.size()-18); trim(arg);
+            ins.op = OP_WS_CONNECT; ins.s1 = stripQuotes(arg);
+        }
+        else if (line.rfind("WebSocketSend(", 0) == 0 && line.back() == ')') {
+            std::string arg = line.substr(14, line.size()-15); trim(arg);
+            ins.op = OP_WS_SEND; ins.s1 = stripQuotes(arg);
+        }
+        else if (line == "WebSocketReceive()") ins.op = OP_WS_RECEIVE;
+        else if (line == "WebSocketDisconnect()") ins.op = OP_WS_DISCONNECT;
+        else if ((line.rfind("ThreadSetVar(", 0) == 0 || line.rfind("SetVar(", 0) == 0) && line.back() == ')') {
+            size_t open = line.find('(');
+            std::string args = line.substr(open + 1, line.size() - open - 2); size_t comma = args.find(',');
+            if (comma != std::string::npos) { std::string k = args.substr(0, comma); std::string v = args.substr(comma + 1); trim(k); trim(v); ins.op = OP_SETVAR; ins.s1 = stripQuotes(k); ins.s2 = stripQuotes(v); }
+            else if (line[0] == 'T') { ins.op = OP_ERROR; ins.s1 = "ThreadSetVar requires 2 args"; }
+            else ins.op = OP_NOP;
+        }
+        else if (line.rfind("ThreadGetVar(", 0) == 0 && line.back() == ')') {
+            std::string arg = line.substr(13, line.size() - 14); trim(arg);
+            ins.op = OP_GETVAR; ins.s1 = stripQuotes(arg);
+        }
+        else if (line.rfind("ThreadWaitVar(", 0) == 0 && line.back() == ')') {
+            std::string name, timeout;
+            ins.op = OP_WAITVAR; ins.imm = -1;
+            if (splitArg(argsOf(line), name, timeout)) parseInt(timeout, ins.imm);
+            ins.s1 = stripQuotes(name);
+        }
+        else if (line.rfind("ChannelSend(", 0) == 0 && line.back() == ')') {
+            std::string id, value; long long channel = 0;
+            if (splitArg(argsOf(line), id, value) && parseInt(id, channel)) { ins.op = OP_CHAN_SEND; ins.channel = (DWORD)channel; ins.s1 = stripQuotes(value); }
+            else { ins.op = OP_ERROR; ins.s1 = "ChannelSend requires a channel id and a value"; }
+        }
+        else if (line.rfind("ChannelReceive(", 0) == 0 && line.back() == ')') {
+            std::string id, timeout; long long channel = 0;
+            ins.imm = -1;
+            if (splitArg(argsOf(line), id, timeout)) parseInt(timeout, ins.imm);
+            if (parseInt(id, channel)) { ins.op = OP_CHAN_RECV; ins.channel = (DWORD)channel; }
+            else { ins.op = OP_ERROR; ins.s1 = "ChannelReceive requires a channel id"; }
+        }
+        else if (line.rfind("Return(", 0) == 0 && line.back() == ')') {
+            std::string arg = argsOf(line); trim(arg);
+            ins.op = OP_RETURN; ins.s1 = stripQuotes(arg);
+        }
+        else if (line.rfind("Sleep(", 0) == 0 && line.back() == ')') {
+            std::string arg = line.substr(6, line.size() - 7); trim(arg);
+            ins.op = OP_SLEEP; if (!parseInt(arg, ins.imm)) ins.imm = 1;
+            if (ins.imm < 0) ins.imm = 0;
+        }
+        else if (line.size() >= 3 && line.substr(line.size()-2) == "++") {
+            std::string var = line.substr(0, line.size()-2); trim(var);
+            ins.op = OP_INC; ins.slot = slotOf(var);
+        }
+        else if (line.find(":=") != std::string::npos) {
             size_t asn = line.find(":=");
-            if (asn != std::string::npos) {
-                std::string var = line.substr(0, asn), rhs = line.substr(asn + 2); trim(var); trim(rhs); long long val; if (parseInt(rhs, val)) locals[var] = val; pc++; continue;
-            }
+            std::string var = line.substr(0, asn), rhs = line.substr(asn + 2); trim(var); trim(rhs);
+            // Non-integer right-hand sides have never been supported; such lines are no-ops.
+            ins.op = parseInt(rhs, ins.imm) ? OP_ASSIGN : OP_NOP; ins.slot = slotOf(var);
+        }
+        else if (line.find('(') != std::string::npos && line.back() == ')') { ins.op = OP_ERROR; ins.s1 = "Unsupported function in thread: " + line; }
+        else ins.op = OP_IDLE;
+
+        prog.code.push_back(std::move(ins));
+    }
+    // Unterminated blocks fall through to the end of the program.
+    for (const Block &b : blocks)
+        prog.code[b.hasElse ? b.elsePc : b.pc].target = prog.code.size();
+    return prog;
+}
 
-            if (!line.empty() && line.find('(') != std::string::npos && line.back() == ')') { setErrorAndStop("Unsupported function in thread: " + line); break; }
-            std::this_thread::sleep_for(std::chrono::milliseconds(1)); pc++;
+void SimpleThreading::ThreadInterpreter::Execute(const Program &prog)
+{
+    struct Local { long long value; bool set; };
+    std::vector<Local> locals(prog.slotCount, Local{0, false});
+
+    const std::string prefix = "thread_" + std::to_string(m_id);
+    const std::string errorKey = prefix + "_error", wsStatusKey = prefix + "_ws_status",
+        wsSentKey = prefix + "_ws_last_sent", wsReceivedKey = prefix + "_ws_last_received", lastGetKey = prefix + "_last_get",
+        lastReceiveKey = prefix + "_last_receive", resultKey = prefix + "_result";
+
+    auto evalCond = [&](const Instr &ins) -> bool {
+        long long l = (ins.slot >= 0 && locals[ins.slot].set) ? locals[ins.slot].value : ins.lhsConst, r = ins.imm;
+        switch (ins.cond) {
+            case COND_LE: return l<=r;
+            case COND_GE: return l>=r;
+            case COND_EQ: return l==r;
+            case COND_NE: return l!=r;
+            case COND_LT: return l< r;
+            case COND_GT: return l> r;
+            default:      return l!=0;
         }
+    };
 
-        // Lightweight per-thread message loop with a simple heartbeat
-        DWORD lastTick = GetTickCount();
-        while (true) {
-            auto it = SimpleThreading::s_stopFlags.find(m_id);
-            if (it != SimpleThreading::s_stopFlags.end() && it->second.load()) break;
-            MSG msg; while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) { TranslateMessage(&msg); DispatchMessage(&msg); }
-            DWORD now = GetTickCount(); if (now - lastTick >= 10) { lastTick = now; std::string beatKey = std::string("thread_") + std::to_string(m_id) + "_heartbeat"; std::string beat = SimpleThreading::GetGlobalVar(beatKey); int beatVal = beat.empty() ? 0 : atoi(beat.c_str()); SimpleThreading::SetGlobalVar(beatKey, std::to_string(beatVal + 1)); }
+    const Instr *code = prog.code.data();
+    size_t pc = 0, count = prog.code.size();
+    while (pc < count) {
+        if (m_status->pauseRequested.load(std::memory_order_relaxed)) WaitWhilePaused();
+        if (m_stop->load(std::memory_order_relaxed)) break;
+
+        const Instr &ins = code[pc];
+        m_status->line.store(ins.line, std::memory_order_relaxed);
+        if (s_statusWaiters.load(std::memory_order_relaxed)) NotifyVarChanged();
+
+        switch (ins.op) {
+        case OP_WHILE:
+        case OP_IF:
+            pc = evalCond(ins) ? pc + 1 : ins.target;
+            continue;
+        case OP_JUMP:
+            pc = ins.target;
+            continue;
+        case OP_WS_CONNECT: {
+            bool ok = g_WebSocketClient->connect(ins.s1);
+            SimpleThreading::SetGlobalVar(wsStatusKey, ok ? "connected" : "failed");
+            break;
+        }
+        case OP_WS_SEND:
+            g_WebSocketClient->send_message(ins.s1);
+            SimpleThreading::SetGlobalVar(wsSentKey, ins.s1);
+            break;
+        case OP_WS_RECEIVE: {
+            std::string msg = g_WebSocketClient->receive_message();
+            if (!msg.empty()) SimpleThreading::SetGlobalVar(wsReceivedKey, msg);
+            break;
+        }
+        case OP_WS_DISCONNECT:
+            g_WebSocketClient->disconnect();
+            SimpleThreading::SetGlobalVar(wsStatusKey, "disconnected");
+            break;
+        case OP_SETVAR:
+            SimpleThreading::SetGlobalVar(ins.s1, ins.s2);
+            break;
+        case OP_GETVAR: {
+            SharedValue val;
+            SimpleThreading::GetGlobalValue(ins.s1, val);
+            SimpleThreading::SetGlobalValue(lastGetKey, val);
+            break;
+        }
+        case OP_SLEEP:
+            // Waiting on the stop event lets ThreadDestroy interrupt a long Sleep.
+            WaitForSingleObject(m_stopEvent, (DWORD)ins.imm);
+            break;
+        case OP_INC: {
+            Local &v = locals[ins.slot];
+            v.value = (v.set ? v.value : 0) + 1; v.set = true;
+            break;
+        }
+        case OP_ASSIGN:
+            locals[ins.slot] = Local{ins.imm, true};
+            break;
+        case OP_WAITVAR:
+            SimpleThreading::WaitForGlobalVarChange(ins.s1, SimpleThreading::GetGlobalVarVersion(ins.s1), (int)ins.imm, m_stop);
+            break;
+        case OP_CHAN_SEND: {
+            auto channel = SimpleThreading::GetChannel(ins.channel);
+            if (!channel) { SimpleThreading::SetGlobalVar(errorKey, "Invalid channel: " + std::to_string(ins.channel)); return; }
+            channel->Send(SharedValue(ins.s1), -1, m_stop);
+            break;
+        }
+        case OP_CHAN_RECV: {
+            auto channel = SimpleThreading::GetChannel(ins.channel);
+            if (!channel) { SimpleThreading::SetGlobalVar(errorKey, "Invalid channel: " + std::to_string(ins.channel)); return; }
+            SharedValue val;
+            if (channel->Receive(val, (int)ins.imm, m_stop)) SimpleThreading::SetGlobalValue(lastReceiveKey, val);
+            break;
+        }
+        case OP_RETURN:
+            m_result = SharedValue(ins.s1);
+            SimpleThreading::SetGlobalValue(resultKey, m_result);
+            return;
+        case OP_ERROR:
+            m_error = ins.s1;
+            SimpleThreading::SetGlobalVar(errorKey, ins.s1);
+            return;
+        case OP_IDLE:
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            break;
+        default:
+            break;
         }
+        ++pc;
+    }
+}
+
+// Fixed-size pool of worker threads with one task deque per worker.  A worker takes from the
+// back of its own deque and, when that is empty, steals from the front of the others'.
+// The pool lasts until SimpleThreading::Shutdown, which stops its tasks before destroying it.
+class SimpleThreading::ThreadPool {
+public:
+    explicit ThreadPool(unsigned int threads) : m_pending(0), m_nextQueue(0), m_stop(false)
+    {
+        for (unsigned int i = 0; i < threads; ++i)
+            m_queues.emplace_back(new Queue);
+        for (unsigned int i = 0; i < threads; ++i)
+            m_threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+
+    // Tasks still queued are discarded; running tasks must already have been stopped.
+    ~ThreadPool()
+    {
+        m_stop = true;
+        { std::lock_guard<std::mutex> lock(m_idleMutex); }
+        m_idle.notify_all();
+        for (auto &thread : m_threads)
+            thread.join();
+    }
+
+    void Submit(const std::shared_ptr<PooledTask> &task)
+    {
+        Queue &q = *m_queues[m_nextQueue++ % m_queues.size()];
+        { std::lock_guard<std::mutex> lock(q.mutex); q.tasks.push_back(task); }
+        ++m_pending;
+        { std::lock_guard<std::mutex> lock(m_idleMutex); }
+        m_idle.notify_one();
     }
+
 private:
-    DWORD m_id;
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::shared_ptr<PooledTask>> tasks;
+    };
+
+    bool Take(size_t self, std::shared_ptr<PooledTask> &task)
+    {
+        size_t count = m_queues.size();
+        for (size_t n = 0; n < count; ++n) {
+            Queue &q = *m_queues[(self + n) % count];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty()) continue;
+            if (n == 0) { task = std::move(q.tasks.back()); q.tasks.pop_back(); }
+            else { task = std::move(q.tasks.front()); q.tasks.pop_front(); }
+            --m_pending;
+            return true;
+        }
+        return false;
+    }
+
+    void WorkerLoop(size_t self)
+    {
+        while (!m_stop) {
+            std::shared_ptr<PooledTask> task;
+            if (!Take(self, task)) {
+                std::unique_lock<std::mutex> lock(m_idleMutex);
+                m_idle.wait(lock, [this] { return m_pending.load() > 0 || m_stop; });
+                continue;
+            }
+            if (!task->stop) { // Not destroyed while queued.
+                ThreadInterpreter intr(*task);
+                intr.RunTask(*task);
+            }
+            SimpleThreading::FinishTask(task);
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::atomic<size_t> m_pending;
+    std::atomic<size_t> m_nextQueue;
+    std::mutex m_idleMutex;
+    std::condition_variable m_idle;
+    std::atomic<bool> m_stop;
 };
 
 void SimpleThreading::IncrementThreadCount() { s_threadCount++; }
@@ -204,12 +526,15 @@ int SimpleThreading::GetThreadCount() { return s_threadCount.load(); }
 DWORD SimpleThreading::CreateThread(const std::string& script) {
     std::lock_guard<std::mutex> lock(s_globalMutex);
     DWORD threadId = s_nextThreadId++;
-    auto interpreter = std::make_unique<ThreadInterpreter>(threadId);
-    s_stopFlags[threadId] = false;
-    auto thread = std::make_unique<std::thread>([script, threadId, intr = interpreter.get()]() {
-        SimpleThreading::SetGlobalVar("thread_" + std::to_string(threadId) + "_status", "running");
+    std::atomic<bool> &stopFlag = s_stopFlags[threadId];
+    stopFlag = false;
+    auto status = std::make_shared<ThreadStatus>();
+    auto interpreter = std::make_unique<ThreadInterpreter>(threadId, &stopFlag, status.get());
+    AcquireSRWLockExclusive(&s_statusLock);
+    s_status[threadId] = std::move(status);
+    ReleaseSRWLockExclusive(&s_statusLock);
+    auto thread = std::make_unique<std::thread>([script, intr = interpreter.get()]() {
         intr->run(script);
-        SimpleThreading::SetGlobalVar("thread_" + std::to_string(threadId) + "_status", "completed");
     });
     s_threads[threadId] = std::move(thread);
     s_interpreters[threadId] = std::move(interpreter);
@@ -221,34 +546,459 @@ bool SimpleThreading::DestroyThread(DWORD threadId) {
     {
         std::lock_guard<std::mutex> lock(s_globalMutex);
         auto itFlag = s_stopFlags.find(threadId); if (itFlag != s_stopFlags.end()) itFlag->second.store(true);
+        auto itIntr = s_interpreters.find(threadId); if (itIntr != s_interpreters.end()) itIntr->second->SignalStop();
         auto it = s_threads.find(threadId); if (it != s_threads.end()) { toJoin = std::move(it->second); s_threads.erase(it); }
     }
     if (toJoin) {
+        InterruptWaits();
         if (toJoin->joinable()) toJoin->join();
         std::lock_guard<std::mutex> lock(s_globalMutex);
         auto itIntr = s_interpreters.find(threadId); if (itIntr != s_interpreters.end()) s_interpreters.erase(itIntr);
         s_stopFlags.erase(threadId);
+        // Keep the final counters readable by name once the live status block is gone.
+        AcquireSRWLockExclusive(&s_statusLock);
+        auto itStatus = s_status.find(threadId);
+        std::shared_ptr<ThreadStatus> status;
+        if (itStatus != s_status.end()) { status = std::move(itStatus->second); s_status.erase(itStatus); }
+        ReleaseSRWLockExclusive(&s_statusLock);
+        if (status) {
+            std::string prefix = "thread_" + std::to_string(threadId);
+            s_globalVars.Set(prefix + "_status", SharedValue(std::string(status->StateName())));
+            s_globalVars.Set(prefix + "_line", SharedValue((__int64)status->line.load()));
+            s_globalVars.Set(prefix + "_heartbeat", SharedValue((__int64)status->Heartbeat()));
+            NotifyVarChanged();
+        }
+        return true;
+    }
+    // Pooled tasks aren't joined, since their pool thread moves on to the next task.
+    if (auto task = GetTask(threadId)) {
+        StopTask(*task);
+        ReleaseTask(threadId);
         return true;
     }
     return false;
 }
 
-bool SimpleThreading::PauseThread(DWORD) { return true; }
-bool SimpleThreading::ResumeThread(DWORD) { return true; }
+bool SimpleThreading::PauseThread(DWORD threadId) {
+    {
+        std::lock_guard<std::mutex> lock(s_globalMutex);
+        auto it = s_interpreters.find(threadId);
+        if (it != s_interpreters.end()) { it->second->Pause(); return true; }
+    }
+    auto task = GetTask(threadId); if (!task) return false;
+    ResetEvent(task->resumeEvent);
+    task->status->pauseRequested = true;
+    return true;
+}
 
-bool SimpleThreading::WaitForThread(DWORD threadId, int) {
-    std::unique_ptr<std::thread> toJoin;
+bool SimpleThreading::ResumeThread(DWORD threadId) {
     {
         std::lock_guard<std::mutex> lock(s_globalMutex);
-        auto it = s_threads.find(threadId);
-        if (it != s_threads.end()) { toJoin = std::make_unique<std::thread>(); toJoin.swap(it->second); s_threads.erase(it); }
+        auto it = s_interpreters.find(threadId);
+        if (it != s_interpreters.end()) { it->second->Resume(); return true; }
     }
-    if (toJoin) { if (toJoin->joinable()) toJoin->join(); return true; }
-    return false;
+    auto task = GetTask(threadId); if (!task) return false;
+    task->status->pauseRequested = false;
+    SetEvent(task->resumeEvent);
+    return true;
+}
+
+bool SimpleThreading::WaitForThread(DWORD threadId, int timeoutMs) {
+    // Wait on a duplicate of the event so that DestroyThread can free the interpreter meanwhile.
+    HANDLE done = NULL;
+    std::shared_ptr<PooledTask> task; // Keeps a task's event alive instead.
+    {
+        std::lock_guard<std::mutex> lock(s_globalMutex);
+        auto it = s_interpreters.find(threadId);
+        if (it == s_interpreters.end()) {
+            if (!(task = GetTask(threadId))) return false;
+            done = task->doneEvent;
+        }
+        else if (!DuplicateHandle(GetCurrentProcess(), it->second->DoneEvent(), GetCurrentProcess(), &done, 0, FALSE, DUPLICATE_SAME_ACCESS))
+            return false;
+    }
+    DWORD result = WaitForSingleObject(done, timeoutMs < 0 ? INFINITE : (DWORD)timeoutMs);
+    if (!task) CloseHandle(done);
+    return result == WAIT_OBJECT_0;
+}
+
+bool SimpleThreading::IsThread(DWORD threadId) {
+    AcquireSRWLockShared(&s_statusLock);
+    bool found = s_status.find(threadId) != s_status.end();
+    ReleaseSRWLockShared(&s_statusLock);
+    return found;
+}
+
+std::string SharedValue::ToString() const
+{
+    switch (type) {
+        case Int: return std::to_string(i);
+        case Float: {
+            // Use the shortest form that reads back as the same value, and add ".0" to integral
+            // values as the script's own float formatting does, so that 0.1 reads "0.1".
+            char buf[32];
+            for (int precision = 15; ; ++precision) {
+                snprintf(buf, sizeof(buf), "%.*g", precision, d);
+                if (precision == 17 || strtod(buf, NULL) == d) break;
+            }
+            size_t len = strlen(buf);
+            if (!strpbrk(buf, ".e") && len && buf[len - 1] >= '0' && buf[len - 1] <= '9') strcpy(buf + len, ".0");
+            return buf;
+        }
+        case String: return s;
+        default: return "";
+    }
+}
+
+void SharedVarStore::Set(const std::string& name, SharedValue value)
+{
+    AcquireSRWLockExclusive(&m_lock);
+    Entry &entry = m_vars[name];
+    entry.value = std::move(value);
+    entry.version = m_nextVersion++;
+    ReleaseSRWLockExclusive(&m_lock);
+}
+
+bool SharedVarStore::Get(const std::string& name, SharedValue& value)
+{
+    AcquireSRWLockShared(&m_lock);
+    auto it = m_vars.find(name);
+    bool found = it != m_vars.end();
+    if (found) value = it->second.value;
+    ReleaseSRWLockShared(&m_lock);
+    return found;
+}
+
+unsigned __int64 SharedVarStore::Version(const std::string& name)
+{
+    AcquireSRWLockShared(&m_lock);
+    auto it = m_vars.find(name);
+    unsigned __int64 version = it != m_vars.end() ? it->second.version : 0;
+    ReleaseSRWLockShared(&m_lock);
+    return version;
+}
+
+bool SharedVarStore::Has(const std::string& name)
+{
+    AcquireSRWLockShared(&m_lock);
+    bool found = m_vars.find(name) != m_vars.end();
+    ReleaseSRWLockShared(&m_lock);
+    return found;
+}
+
+// Splits thread_<id>_status, thread_<id>_line or thread_<id>_heartbeat into its parts.
+bool SimpleThreading::ParseStatusVar(const std::string& name, DWORD& threadId, const char*& field)
+{
+    if (name.compare(0, 7, "thread_") != 0) return false;
+    size_t sep = name.find('_', 7);
+    if (sep == std::string::npos || sep == 7) return false;
+    threadId = 0;
+    for (size_t i = 7; i < sep; ++i) {
+        if (name[i] < '0' || name[i] > '9') return false;
+        threadId = threadId * 10 + (name[i] - '0');
+    }
+    field = name.c_str() + sep + 1;
+    return !strcmp(field, "line") || !strcmp(field, "heartbeat") || !strcmp(field, "status");
+}
+
+bool SimpleThreading::IsStatusVar(const std::string& name)
+{
+    DWORD threadId; const char *field;
+    return ParseStatusVar(name, threadId, field);
+}
+
+// Resolves thread_<id>_status, thread_<id>_line and thread_<id>_heartbeat from the live
+// status counters of a running thread.
+bool SimpleThreading::GetStatusVar(const std::string& name, SharedValue& value)
+{
+    DWORD threadId; const char *field;
+    if (!ParseStatusVar(name, threadId, field)) return false;
+    bool found = false;
+    AcquireSRWLockShared(&s_statusLock);
+    auto it = s_status.find(threadId);
+    if (it != s_status.end()) {
+        ThreadStatus &st = *it->second;
+        found = true;
+        if (!strcmp(field, "line")) value = SharedValue((__int64)st.line.load(std::memory_order_relaxed));
+        else if (!strcmp(field, "heartbeat")) value = SharedValue((__int64)st.Heartbeat());
+        else value = SharedValue(std::string(st.StateName()));
+    }
+    ReleaseSRWLockShared(&s_statusLock);
+    return found;
+}
+
+// The version of a live status name is derived from the value itself (or from the number of
+// state changes), so that the counters need no separate bookkeeping on every statement.
+// The top bit keeps these apart from the store's versions, which take over once the thread
+// is destroyed and its final values are written to the store.
+bool SimpleThreading::GetStatusVersion(const std::string& name, unsigned __int64& version)
+{
+    DWORD threadId; const char *field;
+    if (!ParseStatusVar(name, threadId, field)) return false;
+    bool found = false;
+    AcquireSRWLockShared(&s_statusLock);
+    auto it = s_status.find(threadId);
+    if (it != s_status.end()) {
+        ThreadStatus &st = *it->second;
+        found = true;
+        if (!strcmp(field, "line")) version = (unsigned __int64)st.line.load(std::memory_order_relaxed) + 1;
+        else if (!strcmp(field, "heartbeat")) version = (unsigned __int64)st.Heartbeat() + 1;
+        else version = (unsigned __int64)st.stateChanges.load() + 1;
+        version |= 1ULL << 63;
+    }
+    ReleaseSRWLockShared(&s_statusLock);
+    return found;
+}
+
+bool SimpleThreading::SetGlobalVar(const std::string& name, const std::string& value) { s_globalVars.Set(name, SharedValue(value)); NotifyVarChanged(); return true; }
+bool SimpleThreading::SetGlobalValue(const std::string& name, const SharedValue& value) { s_globalVars.Set(name, value); NotifyVarChanged(); return true; }
+std::string SimpleThreading::GetGlobalVar(const std::string& name)
+{
+    SharedValue value;
+    GetGlobalValue(name, value);
+    return value.type == SharedValue::String ? std::move(value.s) : value.ToString();
 }
+bool SimpleThreading::GetGlobalValue(const std::string& name, SharedValue& value) { return GetStatusVar(name, value) || s_globalVars.Get(name, value); }
+bool SimpleThreading::HasGlobalVar(const std::string& name) { SharedValue value; return GetStatusVar(name, value) || s_globalVars.Has(name); }
 
-bool SimpleThreading::SetGlobalVar(const std::string& name, const std::string& value) { std::lock_guard<std::mutex> lock(s_globalMutex); s_globalVars[name] = value; return true; }
-std::string SimpleThreading::GetGlobalVar(const std::string& name) { std::lock_guard<std::mutex> lock(s_globalMutex); auto it = s_globalVars.find(name); return (it != s_globalVars.end()) ? it->second : ""; }
-bool SimpleThreading::HasGlobalVar(const std::string& name) { std::lock_guard<std::mutex> lock(s_globalMutex); return s_globalVars.find(name) != s_globalVars.end(); }
+unsigned __int64 SimpleThreading::GetGlobalVarVersion(const std::string& name)
+{
+    unsigned __int64 version;
+    if (GetStatusVersion(name, version)) return version;
+    return s_globalVars.Version(name);
+}
+
+void SimpleThreading::NotifyVarChanged()
+{
+    // Waiters register before checking the version, so a waiter that missed this change
+    // is guaranteed to be counted here (and is blocked on or about to check s_varChanged).
+    if (s_varWaiters.load()) { std::lock_guard<std::mutex> lock(s_waitMutex); s_varChanged.notify_all(); }
+    WakeMainThread();
+}
+
+bool SimpleThreading::WaitForGlobalVarChange(const std::string& name, unsigned __int64 version, int timeoutMs, const std::atomic<bool> *cancel)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs < 0 ? 0 : timeoutMs);
+    StatusWaiter statusWaiter(name);
+    // Nothing writes the heartbeat, which advances with time while a thread is idle, so status
+    // names are rechecked at the heartbeat's resolution rather than only when notified.
+    const bool poll = IsStatusVar(name);
+    ++s_varWaiters;
+    std::unique_lock<std::mutex> lock(s_waitMutex);
+    bool changed;
+    while (!(changed = GetGlobalVarVersion(name) != version) && !(cancel && cancel->load())) {
+        auto until = poll ? std::chrono::steady_clock::now() + std::chrono::milliseconds(10) : deadline;
+        if (timeoutMs >= 0 && until > deadline) until = deadline;
+        if (timeoutMs < 0 && !poll) s_varChanged.wait(lock);
+        else if (s_varChanged.wait_until(lock, until) == std::cv_status::timeout && timeoutMs >= 0
+            && std::chrono::steady_clock::now() >= deadline) { changed = GetGlobalVarVersion(name) != version; break; }
+    }
+    lock.unlock();
+    --s_varWaiters;
+    return changed;
+}
+
+void SimpleThreading::WakeMainThread()
+{
+    // Only one WM_NULL is kept in flight; the waiter rearms before each check.
+    if (s_mainWaiters.load() && !s_mainWakePending.exchange(true))
+        PostMessage(g_hWnd, WM_NULL, 0, 0);
+}
+
+void SimpleThreading::InterruptWaits()
+{
+    { std::lock_guard<std::mutex> lock(s_waitMutex); s_varChanged.notify_all(); }
+    AcquireSRWLockShared(&s_channelLock);
+    for (auto &it : s_channels) it.second->Interrupt();
+    ReleaseSRWLockShared(&s_channelLock);
+}
+
+DWORD SimpleThreading::CreateChannel(size_t capacity)
+{
+    DWORD channelId = s_nextChannelId++;
+    auto channel = std::make_shared<ThreadChannel>(capacity);
+    AcquireSRWLockExclusive(&s_channelLock);
+    s_channels[channelId] = std::move(channel);
+    ReleaseSRWLockExclusive(&s_channelLock);
+    return channelId;
+}
+
+bool SimpleThreading::CloseChannel(DWORD channelId)
+{
+    std::shared_ptr<ThreadChannel> channel;
+    AcquireSRWLockExclusive(&s_channelLock);
+    auto it = s_channels.find(channelId);
+    if (it != s_channels.end()) { channel = std::move(it->second); s_channels.erase(it); }
+    ReleaseSRWLockExclusive(&s_channelLock);
+    if (!channel) return false;
+    // Threads already holding the channel keep it alive until they see it closed.
+    channel->Close();
+    return true;
+}
+
+std::shared_ptr<ThreadChannel> SimpleThreading::GetChannel(DWORD channelId)
+{
+    std::shared_ptr<ThreadChannel> channel;
+    AcquireSRWLockShared(&s_channelLock);
+    auto it = s_channels.find(channelId);
+    if (it != s_channels.end()) channel = it->second;
+    ReleaseSRWLockShared(&s_channelLock);
+    return channel;
+}
+
+bool ThreadChannel::Send(const SharedValue& value, int timeoutMs, const std::atomic<bool> *cancel)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs < 0 ? 0 : timeoutMs);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto ready = [&] { return m_closed || m_queue.size() < m_capacity || (cancel && cancel->load()); };
+    if (timeoutMs < 0) m_notFull.wait(lock, ready);
+    else if (!m_notFull.wait_until(lock, deadline, ready)) return false;
+    if (m_closed || m_queue.size() >= m_capacity) return false; // Closed or cancelled.
+    m_queue.push_back(value);
+    lock.unlock();
+    m_notEmpty.notify_one();
+    SimpleThreading::WakeMainThread();
+    return true;
+}
+
+bool ThreadChannel::Receive(SharedValue& value, int timeoutMs, const std::atomic<bool> *cancel)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs < 0 ? 0 : timeoutMs);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto ready = [&] { return m_closed || !m_queue.empty() || (cancel && cancel->load()); };
+    if (timeoutMs < 0) m_notEmpty.wait(lock, ready);
+    else if (!m_notEmpty.wait_until(lock, deadline, ready)) return false;
+    if (m_queue.empty()) return false; // Closed or cancelled.
+    value = std::move(m_queue.front());
+    m_queue.pop_front();
+    lock.unlock();
+    m_notFull.notify_one();
+    SimpleThreading::WakeMainThread();
+    return true;
+}
+
+void ThreadChannel::Close()
+{
+    { std::lock_guard<std::mutex> lock(m_mutex); m_closed = true; }
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+    SimpleThreading::WakeMainThread();
+}
+
+bool ThreadChannel::IsClosed()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_closed;
+}
+
+void ThreadChannel::Interrupt()
+{
+    { std::lock_guard<std::mutex> lock(m_mutex); }
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+}
+
+void SimpleThreading::SetPoolSize(unsigned int threads)
+{
+    std::lock_guard<std::mutex> lock(s_poolMutex);
+    s_poolSize = threads;
+}
+
+DWORD SimpleThreading::SubmitTask(const std::string& script, bool keepResult)
+{
+    std::lock_guard<std::mutex> lock(s_poolMutex); // Also prevents Shutdown from destroying the pool meanwhile.
+    if (!s_pool) {
+        unsigned int threads = s_poolSize ? s_poolSize : std::thread::hardware_concurrency();
+        s_pool = new ThreadPool(threads ? threads : 1);
+    }
+    // Task ids share the thread id sequence so that thread_<id>_* names never collide.
+    auto task = std::make_shared<PooledTask>(s_nextThreadId++, script, keepResult);
+    AcquireSRWLockExclusive(&s_taskLock);
+    // Results that are never collected would otherwise accumulate for the life of the process.
+    bool full = keepResult && s_uncollectedTasks >= MAX_UNCOLLECTED_TASKS;
+    if (!full) s_tasks[task->id] = task;
+    ReleaseSRWLockExclusive(&s_taskLock);
+    if (full) return 0;
+    AcquireSRWLockExclusive(&s_statusLock);
+    s_status[task->id] = task->status;
+    ReleaseSRWLockExclusive(&s_statusLock);
+    s_pool->Submit(task);
+    return task->id;
+}
+
+void SimpleThreading::StopTask(PooledTask& task)
+{
+    task.stop = true;
+    SetEvent(task.stopEvent);
+    InterruptWaits();
+}
+
+// Called on the pool thread once a task has run, or been skipped because it was stopped.
+void SimpleThreading::FinishTask(const std::shared_ptr<PooledTask>& task)
+{
+    task->status->SetState(ThreadStatus::Completed);
+    task->done = true;
+    SetEvent(task->doneEvent);
+    bool release = false;
+    AcquireSRWLockExclusive(&s_taskLock);
+    auto it = s_tasks.find(task->id);
+    if (it != s_tasks.end()) {
+        if (task->keepResult) { task->uncollected = true; ++s_uncollectedTasks; }
+        else release = true;
+    }
+    ReleaseSRWLockExclusive(&s_taskLock);
+    if (release) ReleaseTask(task->id);
+    NotifyVarChanged();
+}
+
+std::shared_ptr<PooledTask> SimpleThreading::GetTask(DWORD taskId)
+{
+    std::shared_ptr<PooledTask> task;
+    AcquireSRWLockShared(&s_taskLock);
+    auto it = s_tasks.find(taskId);
+    if (it != s_tasks.end()) task = it->second;
+    ReleaseSRWLockShared(&s_taskLock);
+    return task;
+}
+
+bool SimpleThreading::ReleaseTask(DWORD taskId)
+{
+    AcquireSRWLockExclusive(&s_taskLock);
+    auto it = s_tasks.find(taskId);
+    bool found = it != s_tasks.end();
+    if (found) {
+        if (it->second->uncollected) --s_uncollectedTasks;
+        s_tasks.erase(it);
+    }
+    ReleaseSRWLockExclusive(&s_taskLock);
+    if (found) {
+        AcquireSRWLockExclusive(&s_statusLock);
+        s_status.erase(taskId);
+        ReleaseSRWLockExclusive(&s_statusLock);
+    }
+    return found;
+}
+
+void SimpleThreading::Shutdown()
+{
+    std::vector<DWORD> threadIds;
+    {
+        std::lock_guard<std::mutex> lock(s_globalMutex);
+        for (auto &it : s_threads) threadIds.push_back(it.first);
+    }
+    for (DWORD threadId : threadIds)
+        DestroyThread(threadId);
+
+    std::lock_guard<std::mutex> lock(s_poolMutex);
+    if (!s_pool) return;
+    // Every task which may be running is still registered, since records are only reclaimed
+    // early by ThreadDestroy, which stops the task first.
+    AcquireSRWLockShared(&s_taskLock);
+    for (auto &it : s_tasks) { it.second->stop = true; SetEvent(it.second->stopEvent); }
+    ReleaseSRWLockShared(&s_taskLock);
+    InterruptWaits();
+    delete s_pool; // Joins the pool's threads.
+    s_pool = nullptr;
+}
 
 // Global instance is defined in globaldata.cpp
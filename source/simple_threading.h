@@ -9,10 +9,118 @@
 #include <memory>
 #include <windows.h>
 #include <condition_variable>
+#include <deque>
+
+// Typed value held in the shared variable store.  Scripts get back the same type they stored,
+// so integers and floats round-trip without being formatted and re-parsed.
+struct SharedValue {
+    enum Type { None, Int, Float, String };
+    Type type = None;
+    __int64 i = 0;
+    double d = 0;
+    std::string s;
+
+    SharedValue() {}
+    explicit SharedValue(__int64 aValue) : type(Int), i(aValue) {}
+    explicit SharedValue(double aValue) : type(Float), d(aValue) {}
+    explicit SharedValue(const std::string &aValue) : type(String), s(aValue) {}
+
+    std::string ToString() const;
+};
+
+// Concurrent name/value store behind ThreadSetVar/ThreadGetVar.  Lookups take the lock in
+// shared mode, so readers don't block each other.
+// Each Set() stamps the entry with a new version number, which ThreadWaitVar uses to detect changes.
+class SharedVarStore {
+public:
+    void Set(const std::string& name, SharedValue value);
+    bool Get(const std::string& name, SharedValue& value);
+    bool Has(const std::string& name);
+    unsigned __int64 Version(const std::string& name); // 0 if the name has never been set.
+
+private:
+    struct Entry {
+        SharedValue value;
+        unsigned __int64 version;
+    };
+    SRWLOCK m_lock = SRWLOCK_INIT;
+    std::unordered_map<std::string, Entry> m_vars;
+    unsigned __int64 m_nextVersion = 1; // Guarded by m_lock.
+};
+
+// Per-thread status counters.  These are updated on every statement and heartbeat, so they are
+// plain atomics rather than entries in the shared store; ThreadGetVar("thread_<id>_line") etc.
+// read them directly.
+// The heartbeat counts 10ms ticks spent idle after the script finished; it is derived from
+// the time idling began so that idle workers don't have to wake up to maintain it.
+struct ThreadStatus {
+    enum State { Running, Paused, Completed };
+    std::atomic<int> state;
+    std::atomic<unsigned> stateChanges; // Serves as the version of thread_<id>_status for ThreadWaitVar.
+    std::atomic<long long> line;
+    std::atomic<bool> idle;
+    std::atomic<DWORD> idleSince;
+    std::atomic<bool> pauseRequested; // Checked by the worker before each statement.
+
+    ThreadStatus() : state(Running), stateChanges(0), line(0), idle(false), idleSince(0), pauseRequested(false) {}
+    void SetState(State aState) { state = aState; ++stateChanges; }
+    long long Heartbeat() const { return idle ? (GetTickCount() - idleSince) / 10 : 0; }
+    const char *StateName() const { return state == Completed ? "completed" : state == Paused ? "paused" : "running"; }
+};
+
+// Bounded multi-producer/multi-consumer queue of values between threads.  Send blocks while
+// the channel is full and Receive while it is empty, each up to timeoutMs (-1 = no limit).
+// Waits also end early if *cancel becomes true; see SimpleThreading::InterruptWaits.
+class ThreadChannel {
+public:
+    explicit ThreadChannel(size_t capacity) : m_capacity(capacity ? capacity : 1), m_closed(false) {}
+
+    bool Send(const SharedValue& value, int timeoutMs, const std::atomic<bool> *cancel = nullptr);
+    bool Receive(SharedValue& value, int timeoutMs, const std::atomic<bool> *cancel = nullptr);
+    // After Close(), Send fails and Receive fails once the remaining items have been drained.
+    void Close();
+    bool IsClosed();
+    void Interrupt();
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty, m_notFull;
+    std::deque<SharedValue> m_queue;
+    size_t m_capacity;
+    bool m_closed;
+};
+
+// A script submitted to the worker pool via ThreadSubmit.  If its result is to be kept, the record
+// outlives the run so that the result can be collected, and is reclaimed once the result has been
+// retrieved.  Otherwise it is reclaimed as soon as the task finishes.  Either way, ThreadDestroy
+// stops the task and reclaims the record.
+struct PooledTask {
+    DWORD id;
+    std::string script;
+    bool keepResult;
+    bool uncollected;    // Finished with a result which hasn't been retrieved.  Guarded by s_taskLock.
+    std::atomic<bool> done;
+    std::atomic<bool> stop;
+    HANDLE stopEvent, resumeEvent, doneEvent;
+    std::shared_ptr<ThreadStatus> status; // Also registered in s_status while the record exists.
+    SharedValue result;  // Value passed to Return() in the script, if any.
+    std::string error;   // Set instead of result if the script stopped on an error.
+
+    PooledTask(DWORD aId, const std::string& aScript, bool aKeepResult)
+        : id(aId), script(aScript), keepResult(aKeepResult), uncollected(false), done(false), stop(false)
+        , status(std::make_shared<ThreadStatus>())
+    {
+        stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        resumeEvent = CreateEvent(NULL, TRUE, TRUE, NULL);
+        doneEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    }
+    ~PooledTask() { CloseHandle(stopEvent); CloseHandle(resumeEvent); CloseHandle(doneEvent); }
+};
 
 class SimpleThreading {
 public:
     class ThreadInterpreter;
+    class ThreadPool;
 
 private:
     static std::atomic<int> s_threadCount;
@@ -25,28 +133,109 @@ public:
     static void DecrementThreadCount();
     static int GetThreadCount();
     
-    // Thread creation/management
+    // Thread creation/management.  Unless stated otherwise, these also accept pooled task ids.
     static DWORD CreateThread(const std::string& script);
     static bool DestroyThread(DWORD threadId);
+    // Pausing takes effect at the thread's next statement boundary.  A paused task keeps its pool thread.
     static bool PauseThread(DWORD threadId);
     static bool ResumeThread(DWORD threadId);
+    // Waits for the thread's script to finish (the thread itself lingers until DestroyThread).
+    // Returns false on timeout or if there is no such thread.
     static bool WaitForThread(DWORD threadId, int timeoutMs = -1);
+    static bool IsThread(DWORD threadId);
     
     // Shared variable store
     static bool SetGlobalVar(const std::string& name, const std::string& value);
+    static bool SetGlobalValue(const std::string& name, const SharedValue& value);
     static std::string GetGlobalVar(const std::string& name);
+    static bool GetGlobalValue(const std::string& name, SharedValue& value);
     static bool HasGlobalVar(const std::string& name);
+    static unsigned __int64 GetGlobalVarVersion(const std::string& name);
+    // Blocks until the version of name differs from version.  Worker threads only; the script's
+    // own thread must use MainThreadWaiter so that it keeps processing messages.
+    static bool WaitForGlobalVarChange(const std::string& name, unsigned __int64 version, int timeoutMs, const std::atomic<bool> *cancel);
+
+    // Workers report each statement to waiters only while one of these exists for a
+    // thread_<id>_line/_status/_heartbeat name, since those are otherwise plain counters.
+    class StatusWaiter {
+    public:
+        explicit StatusWaiter(const std::string& name) : m_active(IsStatusVar(name)) { if (m_active) ++s_statusWaiters; }
+        ~StatusWaiter() { if (m_active) --s_statusWaiters; }
+    private:
+        bool m_active;
+    };
+    static bool IsStatusVar(const std::string& name);
+
+    // Worker pool.  Tasks run on a fixed set of threads (hardware_concurrency by default) which
+    // are created on first use and shared by all submitted scripts.
+    // SubmitTask returns 0 if MAX_UNCOLLECTED_TASKS results are already waiting to be retrieved.
+    enum { MAX_UNCOLLECTED_TASKS = 65536 };
+    static DWORD SubmitTask(const std::string& script, bool keepResult = true);
+    static std::shared_ptr<PooledTask> GetTask(DWORD taskId);
+    static bool ReleaseTask(DWORD taskId);
+    static void SetPoolSize(unsigned int threads); // Takes effect only before the first SubmitTask.
+
+    // Stops all threads and tasks, including any blocked in a wait, and the pool itself.
+    // Called when the script exits.
+    static void Shutdown();
+
+    // Channels
+    static DWORD CreateChannel(size_t capacity);
+    static bool CloseChannel(DWORD channelId);
+    static std::shared_ptr<ThreadChannel> GetChannel(DWORD channelId);
+
+    // While one of these exists, changes to shared vars and channels post WM_NULL to the main
+    // window so that a MsgSleep-based wait on the script's thread returns immediately.
+    class MainThreadWaiter {
+    public:
+        MainThreadWaiter() { ++s_mainWaiters; }
+        ~MainThreadWaiter() { --s_mainWaiters; }
+        // Call before each check of the awaited condition.
+        void Rearm() { s_mainWakePending = false; }
+    };
+    static void WakeMainThread();
+    // Wakes worker threads blocked in a channel or var wait so that they can see their stop flag.
+    static void InterruptWaits();
     
 private:
     static std::unordered_map<DWORD, std::unique_ptr<std::thread>> s_threads;
-    static std::unordered_map<std::string, std::string> s_globalVars;
+    static SharedVarStore s_globalVars;
     static std::atomic<DWORD> s_nextThreadId;
 
+    // Status counters per thread id, guarded by s_statusLock rather than s_globalMutex.
+    static SRWLOCK s_statusLock;
+    static std::unordered_map<DWORD, std::shared_ptr<ThreadStatus>> s_status;
+    static std::atomic<int> s_statusWaiters;
+    static bool ParseStatusVar(const std::string& name, DWORD& threadId, const char*& field);
+    static bool GetStatusVar(const std::string& name, SharedValue& value);
+    static bool GetStatusVersion(const std::string& name, unsigned __int64& version);
+
     // Reserved for potential out-of-process workers
     static std::unordered_map<DWORD, HANDLE> s_processes;
 
     // Cooperative shutdown flags
     static std::unordered_map<DWORD, std::atomic<bool>> s_stopFlags;
+
+    // Change notification for WaitForGlobalVarChange.
+    static std::mutex s_waitMutex;
+    static std::condition_variable s_varChanged;
+    static std::atomic<int> s_varWaiters;
+    static std::atomic<int> s_mainWaiters;
+    static std::atomic<bool> s_mainWakePending;
+    static void NotifyVarChanged();
+
+    static ThreadPool *s_pool;
+    static std::mutex s_poolMutex; // Guards creation of s_pool.
+    static unsigned int s_poolSize;
+    static SRWLOCK s_taskLock;
+    static std::unordered_map<DWORD, std::shared_ptr<PooledTask>> s_tasks;
+    static int s_uncollectedTasks; // Guarded by s_taskLock.
+    static void StopTask(PooledTask& task);
+    static void FinishTask(const std::shared_ptr<PooledTask>& task);
+
+    static SRWLOCK s_channelLock;
+    static std::unordered_map<DWORD, std::shared_ptr<ThreadChannel>> s_channels;
+    static std::atomic<DWORD> s_nextChannelId;
 };
 
 // Global instance
@@ -2,6 +2,7 @@
 #include "simple_threading_api.h"
 #include "simple_threading.h"
 #include "globaldata.h"
+#include "application.h"
 #include "script_func_impl.h"
 
 BIF_DECL(BIF_ThreadCreate)
@@ -50,32 +51,117 @@ BIF_DECL(BIF_ThreadCount)
     _f_return_i(count);
 }
 
-BIF_DECL(BIF_ThreadSetVar)
+// Conversions between script strings and the UTF-8 strings held by SimpleThreading.
+static std::string ToUtf8(LPCTSTR aStr)
 {
-    // Get variable name and value using proper AutoHotkey parameter handling
-    _f_param_string(varName_str, 0);
-    _f_param_string(varValue_str, 1);
-    
-    // Convert LPTSTR to std::string
-    std::string varName, varValue;
 #ifdef UNICODE
-    int len1 = WideCharToMultiByte(CP_UTF8, 0, varName_str, -1, NULL, 0, NULL, NULL);
-    if (len1 > 0) {
-        varName.resize(len1 - 1);
-        WideCharToMultiByte(CP_UTF8, 0, varName_str, -1, &varName[0], len1, NULL, NULL);
-    }
-    int len2 = WideCharToMultiByte(CP_UTF8, 0, varValue_str, -1, NULL, 0, NULL, NULL);
-    if (len2 > 0) {
-        varValue.resize(len2 - 1);
-        WideCharToMultiByte(CP_UTF8, 0, varValue_str, -1, &varValue[0], len2, NULL, NULL);
+    std::string result;
+    int len = WideCharToMultiByte(CP_UTF8, 0, aStr, -1, NULL, 0, NULL, NULL);
+    if (len > 0) {
+        result.resize(len - 1);
+        WideCharToMultiByte(CP_UTF8, 0, aStr, -1, &result[0], len, NULL, NULL);
     }
+    return result;
+#else
+    return aStr;
+#endif
+}
+
+static std::basic_string<TCHAR> FromUtf8(const std::string &aValue)
+{
+#ifdef UNICODE
+    int len = MultiByteToWideChar(CP_UTF8, 0, aValue.data(), (int)aValue.size(), NULL, 0);
+    std::wstring result(len, L'\0');
+    if (len > 0)
+        MultiByteToWideChar(CP_UTF8, 0, aValue.data(), (int)aValue.size(), &result[0], len);
+    return result;
 #else
-    varName = varName_str;
-    varValue = varValue_str;
+    return aValue;
 #endif
+}
+
+static void ReturnUtf8(ResultToken &aResultToken, const std::string &aValue)
+{
+    if (aValue.empty()) {
+        aResultToken.ReturnPtr(_T(""), 0);
+        return;
+    }
+    auto str = FromUtf8(aValue);
+    aResultToken.Return(&str[0], str.size()); // Copies the string.
+}
+
+// Numbers are stored as-is so that the receiving side gets back the same type.
+static bool ParamToSharedValue(ResultToken &aResultToken, ExprTokenType *aParam[], int aIndex, SharedValue &aValue)
+{
+    switch (TypeOfToken(*aParam[aIndex]))
+    {
+    case SYM_INTEGER: aValue = SharedValue((__int64)ParamIndexToInt64(aIndex)); return true;
+    case SYM_FLOAT: aValue = SharedValue(ParamIndexToDouble(aIndex)); return true;
+    }
+    TCHAR buf[MAX_NUMBER_SIZE], *str;
+    if (!TokenToStringParam(aResultToken, aParam, aIndex, buf, str))
+        return false;
+    aValue = SharedValue(ToUtf8(str));
+    return true;
+}
+
+static void ReturnSharedValue(ResultToken &aResultToken, const SharedValue &aValue)
+{
+    switch (aValue.type)
+    {
+    case SharedValue::Int: aResultToken.Return(aValue.i); break;
+    case SharedValue::Float: aResultToken.Return(aValue.d); break;
+    case SharedValue::String: ReturnUtf8(aResultToken, aValue.s); break;
+    default: aResultToken.ReturnPtr(_T(""), 0); break;
+    }
+}
+
+static ResultType AssignSharedValue(Var &aVar, const SharedValue &aValue)
+{
+    switch (aValue.type)
+    {
+    case SharedValue::Int: return aVar.Assign(aValue.i);
+    case SharedValue::Float: return aVar.Assign(aValue.d);
+    case SharedValue::String:
+    {
+        auto str = FromUtf8(aValue.s);
+        return aVar.Assign(str.c_str(), (VarSizeType)str.size());
+    }
+    default: return aVar.Assign();
+    }
+}
+
+// Waits on the script's thread in the same manner as ClipWait/WinWait so that the script stays
+// responsive, except that SimpleThreading posts WM_NULL when shared state changes, ending the
+// MsgSleep early rather than leaving the change unnoticed until the next interval.
+template<typename Predicate>
+static bool MainThreadWait(int aTimeoutMs, Predicate aDone)
+{
+    SimpleThreading::MainThreadWaiter waiter;
+    for (DWORD start_time = GetTickCount();;)
+    {
+        waiter.Rearm();
+        if (aDone())
+            return true;
+        // Must cast to int or any negative result will be lost due to DWORD type:
+        if (aTimeoutMs >= 0 && (int)(GetTickCount() - start_time) >= aTimeoutMs)
+            return false;
+        MsgSleep(INTERVAL_UNSPECIFIED);
+    }
+}
+
+BIF_DECL(BIF_ThreadSetVar)
+{
+    // Get variable name using proper AutoHotkey parameter handling
+    _f_param_string(varName_str, 0);
+    std::string varName = ToUtf8(varName_str);
+
+    SharedValue value;
+    if (!ParamToSharedValue(aResultToken, aParam, 1, value))
+        return;
     
     // Set global variable
-    bool success = SimpleThreading::SetGlobalVar(varName, varValue);
+    bool success = SimpleThreading::SetGlobalValue(varName, value);
     _f_return_i(success ? 1 : 0);
 }
 
@@ -84,33 +170,124 @@ BIF_DECL(BIF_ThreadGetVar)
     // Get variable name using proper AutoHotkey parameter handling
     _f_param_string(varName_str, 0);
     
-    // Convert LPTSTR to std::string
-    std::string varName;
-#ifdef UNICODE
-    int len = WideCharToMultiByte(CP_UTF8, 0, varName_str, -1, NULL, 0, NULL, NULL);
-    if (len > 0) {
-        varName.resize(len - 1);
-        WideCharToMultiByte(CP_UTF8, 0, varName_str, -1, &varName[0], len, NULL, NULL);
-    }
-#else
-    varName = varName_str;
-#endif
-    
     // Get global variable
-    std::string value = SimpleThreading::GetGlobalVar(varName);
-    
-#ifdef UNICODE
-    // Convert std::string to wide string
-    int valueLen = MultiByteToWideChar(CP_UTF8, 0, value.c_str(), -1, NULL, 0);
-    if (valueLen > 0) {
-        wchar_t* wideStr = new wchar_t[valueLen];
-        MultiByteToWideChar(CP_UTF8, 0, value.c_str(), -1, wideStr, valueLen);
-        _f_set_retval_p(wideStr, valueLen - 1);
-        delete[] wideStr;
-    } else {
-        _f_set_retval_p(_T(""), 0);
-    }
-#else
-    _f_set_retval_p(value.c_str(), value.length());
-#endif
+    SharedValue value;
+    SimpleThreading::GetGlobalValue(ToUtf8(varName_str), value);
+    ReturnSharedValue(aResultToken, value);
+}
+
+BIF_DECL(BIF_ThreadWaitVar)
+{
+    _f_param_string(varName_str, 0);
+    int timeout = ParamIndexToOptionalInt(1, -1);
+    std::string varName = ToUtf8(varName_str);
+
+    // Wait for the next change after this call, not merely for the variable to exist.
+    SimpleThreading::StatusWaiter status_waiter(varName);
+    unsigned __int64 version = SimpleThreading::GetGlobalVarVersion(varName);
+    bool changed = MainThreadWait(timeout, [&] { return SimpleThreading::GetGlobalVarVersion(varName) != version; });
+    _f_return_b(changed);
+}
+
+BIF_DECL(BIF_ChannelCreate)
+{
+    __int64 capacity = ParamIndexToOptionalInt64(0, 64);
+    if (capacity < 1)
+        _f_throw_param(0);
+    _f_return_i(SimpleThreading::CreateChannel((size_t)capacity));
+}
+
+BIF_DECL(BIF_ChannelSend)
+{
+    auto channel = SimpleThreading::GetChannel((DWORD)ParamIndexToInt64(0));
+    if (!channel)
+        _f_throw_param(0);
+    SharedValue value;
+    if (!ParamToSharedValue(aResultToken, aParam, 1, value))
+        return;
+    int timeout = ParamIndexToOptionalInt(2, -1);
+
+    bool sent = false;
+    MainThreadWait(timeout, [&] { return (sent = channel->Send(value, 0)) || channel->IsClosed(); });
+    _f_return_b(sent);
+}
+
+BIF_DECL(BIF_ChannelReceive)
+{
+    auto channel = SimpleThreading::GetChannel((DWORD)ParamIndexToInt64(0));
+    if (!channel)
+        _f_throw_param(0);
+    Var *output_var = ParamIndexToOutputVar(1);
+    int timeout = ParamIndexToOptionalInt(2, -1);
+
+    SharedValue value;
+    bool received = false;
+    MainThreadWait(timeout, [&] { return (received = channel->Receive(value, 0)) || channel->IsClosed(); });
+    if (received && output_var && !AssignSharedValue(*output_var, value))
+        _f_return_FAIL;
+    _f_return_b(received);
+}
+
+BIF_DECL(BIF_ChannelClose)
+{
+    _f_return_b(SimpleThreading::CloseChannel((DWORD)ParamIndexToInt64(0)));
+}
+
+BIF_DECL(BIF_ThreadSubmit)
+{
+    _f_param_string(script_str, 0);
+    bool keep_result = ParamIndexToOptionalBOOL(1, true);
+    DWORD task_id = SimpleThreading::SubmitTask(ToUtf8(script_str), keep_result);
+    if (!task_id)
+        _f_throw(_T("Too many task results have not been collected."));
+    _f_return_i(task_id);
+}
+
+BIF_DECL(BIF_ThreadTaskWait)
+{
+    auto task = SimpleThreading::GetTask((DWORD)ParamIndexToInt64(0));
+    if (!task)
+        _f_throw_param(0);
+    int timeout = ParamIndexToOptionalInt(1, -1);
+    _f_return_b(MainThreadWait(timeout, [&] { return task->done.load(); }));
+}
+
+BIF_DECL(BIF_ThreadTaskResult)
+{
+    DWORD taskId = (DWORD)ParamIndexToInt64(0);
+    auto task = SimpleThreading::GetTask(taskId);
+    if (!task)
+        _f_throw_param(0);
+    int timeout = ParamIndexToOptionalInt(1, -1);
+    if (!MainThreadWait(timeout, [&] { return task->done.load(); }))
+        _f_throw(ERR_TIMEOUT, ErrorPrototype::Timeout);
+
+    // The result can be collected only once; the task record is reclaimed here.
+    SimpleThreading::ReleaseTask(taskId);
+    if (!task->error.empty())
+        _f_throw(FromUtf8(task->error).c_str());
+    ReturnSharedValue(aResultToken, task->result);
+}
+
+BIF_DECL(BIF_ThreadPause)
+{
+    _f_return_b(SimpleThreading::PauseThread((DWORD)ParamIndexToInt64(0)));
+}
+
+BIF_DECL(BIF_ThreadResume)
+{
+    _f_return_b(SimpleThreading::ResumeThread((DWORD)ParamIndexToInt64(0)));
+}
+
+BIF_DECL(BIF_ThreadWait)
+{
+    DWORD threadId = (DWORD)ParamIndexToInt64(0);
+    int timeout = ParamIndexToOptionalInt(1, -1);
+    // Check between message checks with a zero timeout; the worker wakes us when it finishes.
+    // Stop early if the thread is destroyed meanwhile (or never existed).
+    bool finished = false;
+    MainThreadWait(timeout, [&] {
+        return (finished = SimpleThreading::WaitForThread(threadId, 0)) || !SimpleThreading::IsThread(threadId);
+    });
+    _f_return_b(finished);
 }
@@ -9,3 +9,14 @@ BIF_DECL(BIF_ThreadDestroy);
 BIF_DECL(BIF_ThreadCount);
 BIF_DECL(BIF_ThreadSetVar);
 BIF_DECL(BIF_ThreadGetVar);
+BIF_DECL(BIF_ThreadWaitVar);
+BIF_DECL(BIF_ThreadSubmit);
+BIF_DECL(BIF_ThreadTaskWait);
+BIF_DECL(BIF_ThreadTaskResult);
+BIF_DECL(BIF_ThreadPause);
+BIF_DECL(BIF_ThreadResume);
+BIF_DECL(BIF_ThreadWait);
+BIF_DECL(BIF_ChannelCreate);
+BIF_DECL(BIF_ChannelSend);
+BIF_DECL(BIF_ChannelReceive);
+BIF_DECL(BIF_ChannelClose);
@@ -17,6 +17,8 @@ GNU General Public License for more details.
 #include "stdafx.h" // pre-compiled headers
 #include <olectl.h> // for OleLoadPicture()
 #include <gdiplus.h> // Used by LoadPicture().
+#include <intrin.h> // For __cpuid() and _BitScanForward(), used by the SIMD substring search.
+#include <immintrin.h> // SSE2/AVX2 intrinsics.
 #include "util.h"
 #include "globaldata.h"
 
@@ -570,6 +572,242 @@ int tcslicmp(LPTSTR aBuf1, LPTSTR aBuf2, size_t aLength1, size_t aLength2)
 
 
 
+// Substring search with a first/last character filter: each block of the haystack is compared against
+// the needle's first character and (at the corresponding offset) its last character, and only positions
+// where both match are verified in full.  This skips over the haystack 8 or 16 characters at a time,
+// and false candidates are rare in practice since two characters must match.  Case-insensitive mode
+// compares each of the two characters against both its lowercase and uppercase form, and folds only
+// A-Z/a-z when verifying, consistent with ctolower() and tcscasestr().
+//
+// As with _tcsstr(), the search ends at the first binary zero in the haystack, so callers with a known
+// length can switch to these without changing behaviour for strings that contain binary zeros.
+
+static inline bool tmemstr_verify(LPCTSTR aHaystack, LPCTSTR aNeedle, size_t aLength, bool aCaseless)
+{
+	if (!aCaseless)
+		return !tmemcmp(aHaystack, aNeedle, aLength);
+	for (size_t i = 0; i < aLength; ++i)
+		if (ctolower(aHaystack[i]) != ctolower(aNeedle[i]))
+			return false;
+	return true;
+}
+
+
+static LPTSTR tmemstr_scalar(LPCTSTR aHaystack, size_t aHaystackLength, LPCTSTR aNeedle, size_t aNeedleLength, bool aCaseless)
+{
+	if (aHaystackLength < aNeedleLength)
+		return NULL;
+	TCHAR first_lower = aCaseless ? ctolower(*aNeedle) : *aNeedle;
+	TCHAR first_upper = aCaseless ? ctoupper(*aNeedle) : *aNeedle;
+	for (LPCTSTR cp = aHaystack, last = aHaystack + (aHaystackLength - aNeedleLength); cp <= last; ++cp)
+	{
+		if (!*cp)
+			break;
+		if ((*cp == first_lower || *cp == first_upper)
+			&& tmemstr_verify(cp + 1, aNeedle + 1, aNeedleLength - 1, aCaseless))
+			return (LPTSTR)cp;
+	}
+	return NULL;
+}
+
+
+// -1 = not yet determined.  Not a static local due to /Zc:threadSafeInit-; a race is harmless here.
+static int sCpuHasAVX2 = -1;
+
+bool CpuHasAVX2()
+// Returns true if AVX2 instructions can be used.  Callers of _mm256 intrinsics must check this first,
+// since the program is built for processors which support only SSE2.
+{
+	if (sCpuHasAVX2 >= 0)
+		return sCpuHasAVX2;
+	int info[4];
+	__cpuid(info, 0);
+	bool has_avx2 = false;
+	if (info[0] >= 7)
+	{
+		__cpuid(info, 1);
+		const int osxsave_and_avx = (1 << 27) | (1 << 28);
+		if ((info[2] & osxsave_and_avx) == osxsave_and_avx
+			&& (_xgetbv(0) & 6) == 6) // The OS must save the YMM registers.
+		{
+			__cpuidex(info, 7, 0);
+			has_avx2 = (info[1] & (1 << 5)) != 0; // EBX bit 5: AVX2.
+		}
+	}
+	sCpuHasAVX2 = has_avx2;
+	return has_avx2;
+}
+
+
+#ifdef UNICODE
+
+
+// Returns the index of the first candidate in aMask (two bits per character, as produced by
+// _mm_movemask_epi8 on a vector of 16-bit comparison results) whose full match succeeds, or -1.
+static inline int tmemstr_check_mask(unsigned aMask, LPCTSTR aBlock, LPCTSTR aNeedle, size_t aNeedleLength, bool aCaseless)
+{
+	aMask &= 0x55555555; // One bit per character.
+	while (aMask)
+	{
+		unsigned long bit;
+		_BitScanForward(&bit, aMask);
+		int i = bit >> 1;
+		// The first and last characters have already been compared.
+		if (aNeedleLength < 3 || tmemstr_verify(aBlock + i + 1, aNeedle + 1, aNeedleLength - 2, aCaseless))
+			return i;
+		aMask &= aMask - 1;
+	}
+	return -1;
+}
+
+
+static LPTSTR tmemstr_sse2(LPCTSTR aHaystack, size_t aHaystackLength, LPCTSTR aNeedle, size_t aNeedleLength, bool aCaseless)
+{
+	const size_t last_offset = aNeedleLength - 1;
+	TCHAR first = aNeedle[0], last = aNeedle[last_offset];
+	const __m128i first1 = _mm_set1_epi16((short)(aCaseless ? ctolower(first) : first));
+	const __m128i first2 = _mm_set1_epi16((short)(aCaseless ? ctoupper(first) : first));
+	const __m128i last1 = _mm_set1_epi16((short)(aCaseless ? ctolower(last) : last));
+	const __m128i last2 = _mm_set1_epi16((short)(aCaseless ? ctoupper(last) : last));
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + last_offset + 8 <= aHaystackLength; i += 8)
+	{
+		__m128i block_first = _mm_loadu_si128((const __m128i *)(aHaystack + i));
+		__m128i block_last = _mm_loadu_si128((const __m128i *)(aHaystack + i + last_offset));
+		__m128i eq_first = _mm_or_si128(_mm_cmpeq_epi16(block_first, first1), _mm_cmpeq_epi16(block_first, first2));
+		__m128i eq_last = _mm_or_si128(_mm_cmpeq_epi16(block_last, last1), _mm_cmpeq_epi16(block_last, last2));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(eq_first, eq_last));
+		unsigned zero_mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(block_first, zero));
+		if (zero_mask)
+			mask &= (zero_mask & (0 - zero_mask)) - 1; // Only candidates before the terminator.
+		if (mask)
+		{
+			int found = tmemstr_check_mask(mask, aHaystack + i, aNeedle, aNeedleLength, aCaseless);
+			if (found >= 0)
+				return (LPTSTR)aHaystack + i + found;
+		}
+		if (zero_mask)
+			return NULL;
+	}
+	return tmemstr_scalar(aHaystack + i, aHaystackLength - i, aNeedle, aNeedleLength, aCaseless);
+}
+
+
+static LPTSTR tmemstr_avx2(LPCTSTR aHaystack, size_t aHaystackLength, LPCTSTR aNeedle, size_t aNeedleLength, bool aCaseless)
+{
+	const size_t last_offset = aNeedleLength - 1;
+	TCHAR first = aNeedle[0], last = aNeedle[last_offset];
+	const __m256i first1 = _mm256_set1_epi16((short)(aCaseless ? ctolower(first) : first));
+	const __m256i first2 = _mm256_set1_epi16((short)(aCaseless ? ctoupper(first) : first));
+	const __m256i last1 = _mm256_set1_epi16((short)(aCaseless ? ctolower(last) : last));
+	const __m256i last2 = _mm256_set1_epi16((short)(aCaseless ? ctoupper(last) : last));
+	const __m256i zero = _mm256_setzero_si256();
+	LPTSTR result = NULL;
+	size_t i = 0;
+	for (; i + last_offset + 16 <= aHaystackLength; i += 16)
+	{
+		__m256i block_first = _mm256_loadu_si256((const __m256i *)(aHaystack + i));
+		__m256i block_last = _mm256_loadu_si256((const __m256i *)(aHaystack + i + last_offset));
+		__m256i eq_first = _mm256_or_si256(_mm256_cmpeq_epi16(block_first, first1), _mm256_cmpeq_epi16(block_first, first2));
+		__m256i eq_last = _mm256_or_si256(_mm256_cmpeq_epi16(block_last, last1), _mm256_cmpeq_epi16(block_last, last2));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(eq_first, eq_last));
+		unsigned zero_mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(block_first, zero));
+		if (zero_mask)
+			mask &= (zero_mask & (0 - zero_mask)) - 1; // Only candidates before the terminator.
+		if (mask)
+		{
+			int found = tmemstr_check_mask(mask, aHaystack + i, aNeedle, aNeedleLength, aCaseless);
+			if (found >= 0)
+			{
+				result = (LPTSTR)aHaystack + i + found;
+				break;
+			}
+		}
+		if (zero_mask)
+			break;
+	}
+	_mm256_zeroupper(); // Avoid the SSE/AVX transition penalty in code compiled without /arch:AVX.
+	if (result || i + last_offset + 16 <= aHaystackLength) // Found, or stopped at the terminator.
+		return result;
+	return tmemstr_sse2(aHaystack + i, aHaystackLength - i, aNeedle, aNeedleLength, aCaseless);
+}
+
+#endif // UNICODE
+
+
+LPTSTR tmemstr(LPCTSTR aHaystack, size_t aHaystackLength, LPCTSTR aNeedle, size_t aNeedleLength, StringCaseSenseType aStringCaseSense)
+// Returns the address of the first occurrence of aNeedle in aHaystack, or NULL if not found.
+// aHaystack must be valid up to aHaystackLength characters, but the search also stops at the first binary
+// zero.  aNeedle must not contain binary zeros and aNeedleLength must be non-zero.
+// SCS_INSENSITIVE_LOCALE is delegated to lstrcasestr(), which requires aHaystack to be null-terminated.
+{
+	if (aStringCaseSense == SCS_INSENSITIVE_LOCALE)
+		return lstrcasestr(aHaystack, aNeedle);
+	bool caseless = aStringCaseSense != SCS_SENSITIVE;
+#ifdef UNICODE
+	if (aHaystackLength >= aNeedleLength + 8) // Long enough for at least one block.
+	{
+		return CpuHasAVX2() ? tmemstr_avx2(aHaystack, aHaystackLength, aNeedle, aNeedleLength, caseless)
+			: tmemstr_sse2(aHaystack, aHaystackLength, aNeedle, aNeedleLength, caseless);
+	}
+#endif
+	return tmemstr_scalar(aHaystack, aHaystackLength, aNeedle, aNeedleLength, caseless);
+}
+
+
+LPTSTR tmemchr2(LPCTSTR aBegin, LPCTSTR aEnd, TCHAR aChar1, TCHAR aChar2)
+// Returns the address of the first occurrence of aChar1 or aChar2 in the range aBegin..aEnd-1,
+// or NULL if neither is present.  Used to find the end of each line when reading a file.
+{
+#ifdef UNICODE
+	const __m128i c1 = _mm_set1_epi16((short)aChar1), c2 = _mm_set1_epi16((short)aChar2);
+	for (; aEnd - aBegin >= 8; aBegin += 8)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i *)aBegin);
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(block, c1), _mm_cmpeq_epi16(block, c2)));
+		if (mask)
+		{
+			unsigned long bit;
+			_BitScanForward(&bit, mask);
+			return (LPTSTR)aBegin + (bit >> 1);
+		}
+	}
+#endif
+	for (; aBegin < aEnd; ++aBegin)
+		if (*aBegin == aChar1 || *aBegin == aChar2)
+			return (LPTSTR)aBegin;
+	return NULL;
+}
+
+
+static LPCTSTR tmemrchr2(LPCTSTR aBegin, LPCTSTR aLast, TCHAR aChar1, TCHAR aChar2)
+// Returns the address of the last occurrence of aChar1 or aChar2 in the range aBegin..aLast (inclusive),
+// or NULL if neither is present.  Used by tcsrstr() to find candidates for the last char of the pattern.
+{
+#ifdef UNICODE
+	const __m128i c1 = _mm_set1_epi16((short)aChar1), c2 = _mm_set1_epi16((short)aChar2);
+	while (aLast - aBegin >= 7)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i *)(aLast - 7));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(block, c1), _mm_cmpeq_epi16(block, c2)));
+		if (mask)
+		{
+			unsigned long bit;
+			_BitScanReverse(&bit, mask);
+			return aLast - 7 + (bit >> 1);
+		}
+		aLast -= 8;
+	}
+#endif
+	for (; aLast >= aBegin; --aLast)
+		if (*aLast == aChar1 || *aLast == aChar2)
+			return aLast;
+	return NULL;
+}
+
+
+
 LPTSTR tcsrstr(LPTSTR aStr, size_t aStr_length, LPCTSTR aPattern, StringCaseSenseType aStringCaseSense, int aOccurrence)
 // Returns NULL if not found, otherwise the address of the found string.
 // This could probably use a faster algorithm someday.  For now it seems adequate because
@@ -599,27 +837,18 @@ LPTSTR tcsrstr(LPTSTR aStr, size_t aStr_length, LPCTSTR aPattern, StringCaseSens
 			return NULL;  // No further matches are possible.
 		// Find (from the right) the first occurrence of aPattern's last char:
 		LPCTSTR last_char_match;
-		for (last_char_match = match_starting_pos; last_char_match >= aStr; --last_char_match)
+		if (aStringCaseSense == SCS_INSENSITIVE_LOCALE)
 		{
-			if (aStringCaseSense == SCS_INSENSITIVE) // The most common mode is listed first for performance.
-			{
-				if (ctolower(*last_char_match) == aPattern_last_char_lower)
-					break;
-			}
-			else if (aStringCaseSense == SCS_INSENSITIVE_LOCALE)
-			{
+			for (last_char_match = match_starting_pos; last_char_match >= aStr; --last_char_match)
 				if (ltolower(*last_char_match) == aPattern_last_char_lower)
 					break;
-			}
-			else // Case sensitive.
-			{
-				if (*last_char_match == aPattern_last_char)
-					break;
-			}
+			if (last_char_match < aStr) // No further matches are possible.
+				return NULL;
 		}
-
-		if (last_char_match < aStr) // No further matches are possible.
-			return NULL;
+		else if (  !(last_char_match = (aStringCaseSense == SCS_INSENSITIVE) // The most common mode is listed first for performance.
+			? tmemrchr2(aStr, match_starting_pos, aPattern_last_char_lower, ctoupper(aPattern_last_char))
+			: tmemrchr2(aStr, match_starting_pos, aPattern_last_char, aPattern_last_char))  )
+			return NULL; // No further matches are possible.
 
 		// Now that aPattern's last character has been found in aStr, ensure the rest of aPattern
 		// exists in aStr to the left of last_char_match:
@@ -700,6 +929,13 @@ LPTSTR tcscasestr(LPCTSTR phaystack, LPCTSTR pneedle)
 	// Faster looping by precalculating bl, bu, cl, cu before looping.
 	// 2004 Apr 08	Jose Da Silva, digital@joescat@com
 {
+#ifdef UNICODE
+	// The block-at-a-time search in tmemstr() is several times faster for anything but the shortest
+	// haystacks, even counting the extra pass by wcslen() (which is itself vectorized by the CRT).
+	if (!*pneedle)
+		return (LPTSTR)phaystack;
+	return tmemstr(phaystack, _tcslen(phaystack), pneedle, _tcslen(pneedle), SCS_INSENSITIVE);
+#else
 	register const TBYTE *haystack, *needle;
 	register unsigned bl, bu, cl, cu;
 	
@@ -787,6 +1023,7 @@ foundneedle:
 	return (LPTSTR) haystack;
 ret0:
 	return 0;
+#endif
 }
 
 
@@ -1189,7 +1426,7 @@ UINT StrReplace(LPTSTR aHaystack, LPTSTR aOld, LPTSTR aNew, StringCaseSenseType
 
 	// Perform the replacement:
 	for (replacement_count = 0, src = aHaystack
-		; aLimit && (match_pos = tcsstr2(src, aOld, aStringCaseSense));) // Relies on short-circuit boolean order.
+		; aLimit && (match_pos = tmemstr(src, haystack_length - (src - aHaystack), aOld, aOld_length, aStringCaseSense));) // Relies on short-circuit boolean order.
 	{
 		++replacement_count;
 		--aLimit;
@@ -1277,7 +1514,7 @@ in_place_method:
 	//for ( ; ptr = StrReplace(aHaystack, aOld, aNew, aStringCaseSense); ); // Note that this very different from the below.
 
 	for (replacement_count = 0, src = aHaystack
-		; aLimit && (match_pos = tcsstr2(src, aOld, aStringCaseSense)) // Relies on short-circuit boolean order.
+		; aLimit && (match_pos = tmemstr(src, haystack_length - (src - aHaystack), aOld, aOld_length, aStringCaseSense)) // Relies on short-circuit boolean order.
 		; --aLimit, ++replacement_count)
 	{
 		src = match_pos + aNew_length;  // The next search should start at this position when all is adjusted below.
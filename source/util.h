@@ -718,6 +718,9 @@ LPTSTR tcsrstr(LPTSTR aStr, size_t aStr_length, LPCTSTR aPattern, StringCaseSens
 LPTSTR ltcschr(LPCTSTR haystack, TCHAR ch);
 LPTSTR lstrcasestr(LPCTSTR phaystack, LPCTSTR pneedle);
 LPTSTR tcscasestr (LPCTSTR phaystack, LPCTSTR pneedle);
+bool CpuHasAVX2();
+LPTSTR tmemstr(LPCTSTR aHaystack, size_t aHaystackLength, LPCTSTR aNeedle, size_t aNeedleLength, StringCaseSenseType aStringCaseSense);
+LPTSTR tmemchr2(LPCTSTR aBegin, LPCTSTR aEnd, TCHAR aChar1, TCHAR aChar2);
 UINT StrReplace(LPTSTR aHaystack, LPTSTR aOld, LPTSTR aNew, StringCaseSenseType aStringCaseSense
 	, UINT aLimit = UINT_MAX, size_t aSizeLimit = -1, LPTSTR *aDest = NULL, size_t *aHaystackLength = NULL);
 size_t PredictReplacementSize(ptrdiff_t aLengthDelta, int aReplacementCount, int aLimit, size_t aHaystackLength
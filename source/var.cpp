@@ -1090,6 +1090,67 @@ void Var::SetLengthFromContents()
 
 
 
+// Each VarBkp array belongs to a function call which must return before any call it interrupted
+// or recursed from, so the arrays are freed in the reverse order of their allocation.  They are
+// therefore carved out of a stack of blocks which are retained for reuse, so that a recursive
+// function allocates memory only when it recurses deeper than it has before.  Blocks are never
+// moved or resized, since the debugger and each suspended call hold pointers into them.
+struct VarBkpBlock
+{
+	VarBkpBlock *prev, *next; // Any block after the current one is empty and kept for reuse.
+	VarBkp *top, *end;
+	VarBkp item[1];
+};
+static VarBkpBlock *sVarBkpBlock = nullptr; // The block containing the most recent allocation.
+#define VARBKP_BLOCK_MIN_COUNT 1024
+
+
+
+static VarBkp *AllocVarBkp(int aCount)
+{
+	VarBkpBlock *block = sVarBkpBlock;
+	if (!block || block->end - block->top < aCount)
+	{
+		VarBkpBlock *next = block ? block->next : nullptr;
+		if (!next || next->end - next->top < aCount)
+		{
+			free(next); // Too small, so replace it.
+			int count = aCount > VARBKP_BLOCK_MIN_COUNT ? aCount : VARBKP_BLOCK_MIN_COUNT;
+			if (   !(next = (VarBkpBlock *)malloc(sizeof(VarBkpBlock) + (count - 1) * sizeof(VarBkp)))   )
+				return nullptr;
+			next->prev = block;
+			next->next = nullptr;
+			next->top = next->item;
+			next->end = next->item + count;
+			if (block)
+				block->next = next;
+		}
+		sVarBkpBlock = block = next;
+	}
+	VarBkp *bkp = block->top;
+	block->top += aCount;
+	return bkp;
+}
+
+
+
+static void FreeVarBkp(VarBkp *aBkp)
+// aBkp must be the most recent allocation which hasn't been freed.
+{
+	VarBkpBlock *block = sVarBkpBlock;
+	block->top = aBkp;
+	if (block->top == block->item && block->prev)
+	{
+		// Keep this block for the next deeper call, but free any beyond it to release memory
+		// used by a recursion which was deeper than usual.
+		free(block->next);
+		block->next = nullptr;
+		sVarBkpBlock = block->prev;
+	}
+}
+
+
+
 ResultType Var::BackupFunctionVars(UserFunc &aFunc, VarBkp *&aVarBackup, int &aVarBackupCount)
 // All parameters except the first are output parameters that are set for our caller (though caller
 // is responsible for having initialized aVarBackup to NULL).
@@ -1099,15 +1160,10 @@ ResultType Var::BackupFunctionVars(UserFunc &aFunc, VarBkp *&aVarBackup, int &aV
 	if (   !(aVarBackupCount = aFunc.mVars.mCount)   )  // Nothing needs to be backed up.
 		return OK; // Leave aVarBackup set to NULL as set by the caller.
 
-	// NOTES ABOUT MALLOC(): Apparently, the implementation of malloc() is quite good, at least for small blocks
-	// needed to back up 50 or less variables.  It nearly as fast as alloca(), at least when the system
-	// isn't under load and has the memory to spare without swapping.  Therefore, the attempt to use alloca to
-	// speed up recursive script-functions didn't result in enough of a speed-up (only 1 to 5%) to be worth the
-	// added complexity.
 	// Since Var is not a POD struct (it contains private members, a custom constructor, etc.), the VarBkp
 	// POD struct is used to hold the backup because it's probably better performance than using Var's
 	// constructor to create each backup array element.
-	if (   !(aVarBackup = (VarBkp *)malloc(aVarBackupCount * sizeof(VarBkp)))   ) // Caller will take care of freeing it.
+	if (   !(aVarBackup = AllocVarBkp(aVarBackupCount))   ) // Caller will take care of freeing it.
 		return FAIL;
 
 	int i;
@@ -1188,7 +1244,7 @@ void Var::FreeAndRestoreFunctionVars(UserFunc &aFunc, VarBkp *&aVarBackup, int &
 			VarBkp &bkp = aVarBackup[i];
 			bkp.mVar->Restore(bkp);
 		}
-		free(aVarBackup);
+		FreeVarBkp(aVarBackup);
 		aVarBackup = NULL; // Some callers want this reset; it's an indicator of whether the next function call in this expression (if any) will have a backup.
 	}
 }
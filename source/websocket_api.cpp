@@ -9,6 +9,40 @@
 
 #pragma comment(lib, "winhttp.lib")
 
+// Resolves an optional connection handle parameter: omitted or 0 means the connection
+// managed by WebSocketConnect/WebSocketDisconnect.
+static std::shared_ptr<WebSocketClient> ParamToClient(ExprTokenType *aParam[], int aParamCount, int aIndex)
+{
+    int handle = (int)ParamIndexToOptionalInt64(aIndex, 0);
+    if (!handle)
+        return std::shared_ptr<WebSocketClient>(g_WebSocketClient.get(), [](WebSocketClient *) {});
+    return WebSocketClient::Find(handle);
+}
+
+// Copies a binary message into a new Buffer object, or returns nullptr if out of memory.
+static BufferObject *MessageToBuffer(const std::string &aMessage)
+{
+    void *data = malloc(aMessage.size() ? aMessage.size() : 1);
+    if (!data)
+        return nullptr;
+    memcpy(data, aMessage.data(), aMessage.size());
+    return BufferObject::Create(data, aMessage.size());
+}
+
+#ifdef UNICODE
+// Decodes a text message.  The length is passed explicitly so that null characters are kept.
+static std::wstring MessageToText(const std::string &aMessage)
+{
+    std::wstring text;
+    int len = MultiByteToWideChar(CP_UTF8, 0, aMessage.data(), (int)aMessage.size(), NULL, 0);
+    if (len > 0) {
+        text.resize(len);
+        MultiByteToWideChar(CP_UTF8, 0, aMessage.data(), (int)aMessage.size(), &text[0], len);
+    }
+    return text;
+}
+#endif
+
 BIF_DECL(BIF_WebSocketConnect)
 {
     // Get URL parameter using proper AutoHotkey parameter handling
@@ -56,8 +90,13 @@ BIF_DECL(BIF_WebSocketSend)
     message = message_str;
 #endif
     
-    // Send the message through the real WebSocket connection
-    bool success = g_WebSocketClient->send_message(message);
+    auto client = ParamToClient(aParam, aParamCount, 1);
+    if (!client)
+        _f_throw_param(1);
+    
+    // Send the message through the real WebSocket connection.  flush = false lets it be
+    // batched with following messages (see WebSocketClient::SendBatchDelay).
+    bool success = client->send_message(message, ParamIndexToOptionalBOOL(2, TRUE) != FALSE);
     
     if (success) {
         SimpleThreading::SetGlobalVar("websocket_last_sent", message);
@@ -67,29 +106,58 @@ BIF_DECL(BIF_WebSocketSend)
     }
 }
 
+BIF_DECL(BIF_WebSocketSendBuffer)
+{
+    IObject *buffer_obj = ParamIndexToObject(0);
+    if (!buffer_obj)
+        _f_throw_param(0, _T("object"));
+    size_t ptr, size;
+    GetBufferObjectPtr(aResultToken, buffer_obj, ptr, size);
+    if (aResultToken.Exited())
+        return;
+
+    auto client = ParamToClient(aParam, aParamCount, 1);
+    if (!client)
+        _f_throw_param(1);
+
+    // The frame is masked directly from the buffer's memory into the send queue.
+    _f_return_b(client->send_binary((const void *)ptr, size, ParamIndexToOptionalBOOL(2, TRUE) != FALSE));
+}
+
+BIF_DECL(BIF_WebSocketFlush)
+{
+    auto client = ParamToClient(aParam, aParamCount, 0);
+    if (!client)
+        _f_throw_param(0);
+    _f_return_b(client->flush());
+}
+
 BIF_DECL(BIF_WebSocketReceive)
 {
-    // Get the last received message from the real WebSocket connection
-    std::string message = g_WebSocketClient->receive_message();
+    auto client = ParamToClient(aParam, aParamCount, 0);
+    if (!client)
+        _f_throw_param(0);
     
-    // Convert std::string to LPTSTR
-    if (message.empty()) {
-        _f_set_retval_p(_T(""), 0);
-    } else {
+    // Get the next message received by the real WebSocket connection.  Binary messages are
+    // returned as a Buffer, since they may contain null bytes or invalid UTF-8.
+    std::string message;
+    bool binary = false;
+    if (!client->try_receive_message(message, &binary))
+        _f_return_empty;
+    if (binary)
+    {
+        auto buf = MessageToBuffer(message);
+        if (!buf)
+            _f_throw_oom;
+        aResultToken.Return(buf);
+        return;
+    }
 #ifdef UNICODE
-        int len = MultiByteToWideChar(CP_UTF8, 0, message.c_str(), -1, NULL, 0);
-        if (len > 0) {
-            wchar_t* result = new wchar_t[len];
-            MultiByteToWideChar(CP_UTF8, 0, message.c_str(), -1, result, len);
-            _f_set_retval_p(result, len - 1);
-            delete[] result;
-        } else {
-            _f_set_retval_p(_T(""), 0);
-        }
+    std::wstring text = MessageToText(message);
+    aResultToken.Return(const_cast<LPTSTR>(text.c_str()), text.size()); // Copies the string.
 #else
-        _f_set_retval_p(message.c_str(), message.length());
+    aResultToken.Return(const_cast<LPTSTR>(message.c_str()), message.size());
 #endif
-    }
 }
 
 BIF_DECL(BIF_WebSocketDisconnect)
@@ -100,6 +168,111 @@ BIF_DECL(BIF_WebSocketDisconnect)
     _f_return_i(1);
 }
 
+BIF_DECL(BIF_WebSocketOpen)
+{
+    _f_param_string(url_str, 0);
+    
+    std::string url;
+#ifdef UNICODE
+    int len = WideCharToMultiByte(CP_UTF8, 0, url_str, -1, NULL, 0, NULL, NULL);
+    if (len > 0) {
+        url.resize(len - 1);
+        WideCharToMultiByte(CP_UTF8, 0, url_str, -1, &url[0], len, NULL, NULL);
+    }
+#else
+    url = url_str;
+#endif
+    
+    // Each handle is an independent connection with its own receive queue
+    _f_return_i(WebSocketClient::Open(url));
+}
+
+BIF_DECL(BIF_WebSocketClose)
+{
+    _f_return_b(WebSocketClient::Close((int)ParamIndexToInt64(0)));
+}
+
+BIF_DECL(BIF_WebSocketOnMessage)
+{
+    IObject *callback = ParamIndexToObject(0);
+    if (!callback)
+        _f_throw_param(0, _T("object"));
+    if (!ValidateFunctor(callback, 2, aResultToken))
+        return;
+
+    // Same add/remove semantics as OnClipboardChange: 1 = call after others, -1 = call first, 0 = remove.
+    MsgMonitorList &handlers = g_script.mOnWebSocketMessage;
+    int mode = (int)ParamIndexToOptionalInt64(1, 1);
+    MsgMonitorStruct *existing = handlers.Find(0, callback);
+    switch (mode)
+    {
+    case  1:
+    case -1:
+        if (!existing && !handlers.Add(0, callback, mode == 1))
+            _f_throw_oom;
+        break;
+    case  0:
+        if (existing)
+            handlers.Delete(existing);
+        break;
+    default:
+        _f_throw_param(1);
+    }
+    WebSocketClient::SetNotify(handlers.Count() > 0);
+    _f_return_empty;
+}
+
+void WebSocketPostRetrieved()
+{
+    WebSocketClient::PostRetrieved();
+}
+
+void WebSocketDispatchMessages()
+{
+    // The first callback runs in the thread MsgSleep started for this message; each later
+    // message gets a fresh thread, as with consecutive OnMessage calls.
+    int init_new_thread_index = 1;
+    for (;;)
+    {
+        std::vector<int> ready = WebSocketClient::TakeReady();
+        if (ready.empty())
+            break;
+        for (int handle : ready)
+        {
+            auto client = handle ? WebSocketClient::Find(handle)
+                : std::shared_ptr<WebSocketClient>(g_WebSocketClient.get(), [](WebSocketClient *) {});
+            if (!client)
+                continue; // Closed since the messages arrived.
+            std::string message;
+            bool binary;
+            while (g_script.mOnWebSocketMessage.Count() && client->try_receive_message(message, &binary))
+            {
+                // Binary messages are passed as a Buffer, as WebSocketReceive returns them.
+                if (binary)
+                {
+                    auto buf = MessageToBuffer(message);
+                    if (!buf)
+                        continue; // Out of memory: drop the message rather than corrupt it.
+                    ExprTokenType params[] = { buf, (__int64)handle };
+                    g_script.mOnWebSocketMessage.Call(params, 2, init_new_thread_index);
+                    buf->Release();
+                }
+                else
+                {
+#ifdef UNICODE
+                    std::wstring text = MessageToText(message);
+                    ExprTokenType params[] = { ExprTokenType(const_cast<LPTSTR>(text.c_str()), text.size()), (__int64)handle };
+#else
+                    ExprTokenType params[] = { ExprTokenType(const_cast<LPTSTR>(message.c_str()), message.size()), (__int64)handle };
+#endif
+                    g_script.mOnWebSocketMessage.Call(params, 2, init_new_thread_index);
+                }
+                init_new_thread_index = 0;
+            }
+        }
+    }
+}
+
 BIF_DECL(BIF_HttpRequest)
 {
     // Get URL and method parameters using proper AutoHotkey parameter handling
@@ -134,12 +307,12 @@ BIF_DECL(BIF_HttpRequest)
     if (len > 0) {
         wchar_t* result = new wchar_t[len];
         MultiByteToWideChar(CP_UTF8, 0, response.c_str(), -1, result, len);
-        _f_set_retval_p(result, len - 1);
+        aResultToken.Return(result, len - 1); // Copies the string.
         delete[] result;
     } else {
         _f_set_retval_p(_T(""), 0);
     }
 #else
-    _f_set_retval_p(response.c_str(), response.length());
+    aResultToken.Return(response.c_str(), response.length());
 #endif
 }
@@ -5,6 +5,17 @@
 
 BIF_DECL(BIF_WebSocketConnect);
 BIF_DECL(BIF_WebSocketSend);
+BIF_DECL(BIF_WebSocketSendBuffer);
+BIF_DECL(BIF_WebSocketFlush);
 BIF_DECL(BIF_WebSocketReceive);
 BIF_DECL(BIF_WebSocketDisconnect);
+BIF_DECL(BIF_WebSocketOpen);
+BIF_DECL(BIF_WebSocketClose);
+BIF_DECL(BIF_WebSocketOnMessage);
+
+// Called by MsgSleep when it retrieves AHK_WEBSOCKET_MESSAGE, so that further arrivals post again.
+void WebSocketPostRetrieved();
+// Calls the WebSocketOnMessage callbacks for every message received so far.  Called by MsgSleep
+// in response to AHK_WEBSOCKET_MESSAGE, after it has started a new thread for the first callback.
+void WebSocketDispatchMessages();
 BIF_DECL(BIF_HttpRequest);
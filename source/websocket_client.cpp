@@ -1,11 +1,14 @@
 #include "stdafx.h"
 #include "websocket_client.h"
+#include "globaldata.h" // For g_hWnd.
 #include <iostream>
 #include <sstream>
 #include <random>
 #include <iomanip>
+#include <algorithm>
+#include <climits>
 
-WebSocketClient::WebSocketClient() : m_socket(INVALID_SOCKET), m_connected(false), m_running(false), m_port(0), m_secure(false) {
+WebSocketClient::WebSocketClient() : m_socket(INVALID_SOCKET), m_sendPending(false), m_maskGen(std::random_device()()), m_connected(false), m_running(false), m_port(0), m_secure(false) {
     // Initialize Winsock
     WSADATA wsaData;
     WSAStartup(MAKEWORD(2, 2), &wsaData);
@@ -135,125 +138,201 @@ bool WebSocketClient::perform_handshake() {
         return false;
     }
     
-    // Receive handshake response
+    // Receive handshake response.  The server may send its first frames right behind it, so
+    // read up to the end of the headers and pass anything after that to the frame parser.
     char buffer[1024];
-    result = recv(m_socket, buffer, sizeof(buffer) - 1, 0);
-    if (result == SOCKET_ERROR) {
-        return false;
+    std::string response;
+    size_t header_end;
+    while ((header_end = response.find("\r\n\r\n")) == std::string::npos) {
+        if (response.size() > 16384) {
+            return false;
+        }
+        result = recv(m_socket, buffer, sizeof(buffer), 0);
+        if (result == SOCKET_ERROR || result == 0) {
+            return false;
+        }
+        response.append(buffer, result);
     }
-    
-    buffer[result] = '\0';
-    std::string response(buffer);
+    header_end += 4;
+    if (header_end < response.size()) {
+        m_parser.Feed(response.data() + header_end, response.size() - header_end);
+    }
+    response.resize(header_end);
     
     // Expect 101 Switching Protocols
     return response.find("101 Switching Protocols") != std::string::npos;
 }
 
-std::vector<uint8_t> WebSocketClient::websocket_frame_encode(const std::string& message) {
-    std::vector<uint8_t> frame;
+void WebSocketClient::append_frame(uint8_t opcode, const void *data, size_t len) {
+    uint8_t header[14];
+    size_t header_len = 0;
     
-    // First byte: FIN=1, opcode=1 (text)
-    frame.push_back(0x81);
+    // First byte: FIN=1, opcode
+    header[header_len++] = 0x80 | opcode;
     
     // Payload length (MASK bit set)
-    size_t payload_len = message.length();
-    if (payload_len < 126) {
-        frame.push_back(static_cast<uint8_t>(payload_len) | 0x80); // Set MASK bit
-    } else if (payload_len < 65536) {
-        frame.push_back(126 | 0x80); // Set MASK bit
-        frame.push_back((payload_len >> 8) & 0xFF);
-        frame.push_back(payload_len & 0xFF);
+    if (len < 126) {
+        header[header_len++] = static_cast<uint8_t>(len) | 0x80;
+    } else if (len < 65536) {
+        header[header_len++] = 126 | 0x80;
+        header[header_len++] = (len >> 8) & 0xFF;
+        header[header_len++] = len & 0xFF;
     } else {
-        frame.push_back(127 | 0x80); // Set MASK bit
+        header[header_len++] = 127 | 0x80;
         for (int i = 7; i >= 0; --i) {
-            frame.push_back((payload_len >> (i * 8)) & 0xFF);
+            header[header_len++] = ((uint64_t)len >> (i * 8)) & 0xFF;
         }
     }
     
     // Random masking key
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 255);
-    
-    uint8_t mask_key[4];
-    for (int i = 0; i < 4; ++i) {
-        mask_key[i] = static_cast<uint8_t>(dis(gen));
-        frame.push_back(mask_key[i]);
-    }
-    
-    // Masked payload
-    for (size_t i = 0; i < message.length(); ++i) {
-        uint8_t masked_byte = static_cast<uint8_t>(message[i]) ^ mask_key[i % 4];
-        frame.push_back(masked_byte);
+    uint32_t mask_key = static_cast<uint32_t>(m_maskGen());
+    memcpy(header + header_len, &mask_key, 4);
+    header_len += 4;
+    
+    // Masked payload, written directly from the caller's memory into the queue
+    size_t offset = m_sendQueue.size();
+    m_sendQueue.resize(offset + header_len + len);
+    uint8_t *frame = m_sendQueue.data() + offset;
+    memcpy(frame, header, header_len);
+    if (len) {
+        websocket_mask(frame + header_len, static_cast<const uint8_t*>(data), len, header + header_len - 4);
     }
-    
-    return frame;
 }
 
-std::string WebSocketClient::websocket_frame_decode(const std::vector<uint8_t>& data) {
-    if (data.size() < 2) {
-        return "";
+bool WebSocketClient::send_frame(uint8_t opcode, const void *data, size_t len, bool flush) {
+    bool schedule = false;
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        size_t unsent = m_sendQueue.size() - m_sendOffset;
+        if (unsent >= SendQueueMax) {
+            return false;
+        }
+        append_frame(opcode, data, len);
+        if (m_sendQueue.size() - m_sendOffset >= SendBatchMax) {
+            flush = true;
+        }
+        // Only the first frame of a batch needs to arm the timer.  Frames queued behind unsent
+        // data go out when the socket becomes writable.
+        schedule = !flush && !unsent;
+    }
+    if (!flush) {
+        // Outside m_sendMutex, since ScheduleFlush takes the poller's lock.
+        if (schedule) {
+            WebSocketPoller::Instance().ScheduleFlush(this);
+        }
+        return true;
     }
-    
-    bool fin = (data[0] & 0x80) != 0;
-    uint8_t opcode = data[0] & 0x0F;
-    bool masked = (data[1] & 0x80) != 0;
-    uint8_t payload_len = data[1] & 0x7F;
-    
-    size_t header_len = 2;
-    size_t actual_payload_len = payload_len;
-    
-    if (payload_len == 126) {
-        if (data.size() < 4) return "";
-        actual_payload_len = (data[2] << 8) | data[3];
-        header_len = 4;
-    } else if (payload_len == 127) {
-        if (data.size() < 10) return "";
-        actual_payload_len = 0;
-        for (int i = 2; i < 10; ++i) {
-            actual_payload_len = (actual_payload_len << 8) | data[i];
+    return this->flush();
+}
+
+bool WebSocketClient::flush() {
+    bool success = true, wake;
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        while (m_sendOffset < m_sendQueue.size()) {
+            size_t unsent = m_sendQueue.size() - m_sendOffset;
+            int result = send(m_socket, reinterpret_cast<const char*>(m_sendQueue.data()) + m_sendOffset, unsent > INT_MAX ? INT_MAX : static_cast<int>(unsent), 0);
+            if (result == SOCKET_ERROR) {
+                if (WSAGetLastError() == WSAEWOULDBLOCK) {
+                    break; // The peer's window is full; the I/O thread sends the rest when it opens.
+                }
+                success = false;
+                m_sendOffset = m_sendQueue.size();
+                break;
+            }
+            m_sendOffset += result;
+        }
+        if (m_sendOffset == m_sendQueue.size()) {
+            m_sendQueue.clear(); // Keeps the capacity for the next batch.
+            m_sendOffset = 0;
+        } else if (m_sendOffset >= m_sendQueue.size() / 2) {
+            // Reclaim the sent part lazily, as WebSocketFrameParser does, so each byte is moved
+            // at most a constant number of times while the peer reads slowly.
+            m_sendQueue.erase(m_sendQueue.begin(), m_sendQueue.begin() + m_sendOffset);
+            m_sendOffset = 0;
         }
-        header_len = 10;
+        bool pending = !m_sendQueue.empty();
+        wake = pending && !m_sendPending;
+        m_sendPending = pending;
     }
-    
-    if (masked) {
-        header_len += 4; // Masking key
+    if (wake) {
+        // Have the I/O thread add POLLWRNORM for this socket.
+        WebSocketPoller::Instance().Wake();
     }
-    
-    if (data.size() < header_len + actual_payload_len) {
-        return "";
+    return success;
+}
+
+bool WebSocketClient::on_readable() {
+    char buffer[16384];
+    int result = recv(m_socket, buffer, sizeof(buffer), 0);
+    if (result == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK) {
+        return true; // Nothing to read after all.
     }
-    
-    std::string payload;
-    payload.reserve(actual_payload_len);
-    
-    for (size_t i = 0; i < actual_payload_len; ++i) {
-        uint8_t byte = data[header_len + i];
-        if (masked) {
-            byte ^= data[header_len - 4 + (i % 4)];
-        }
-        payload += static_cast<char>(byte);
+    if (result == SOCKET_ERROR || result == 0) {
+        m_connected = false;
+        return false;
     }
-    
-    return payload;
+
+    m_parser.Feed(buffer, result);
+    return process_frames();
 }
 
-void WebSocketClient::receive_loop() {
-    char buffer[4096];
-    
-    while (m_running && m_connected) {
-        int result = recv(m_socket, buffer, sizeof(buffer), 0);
-        if (result == SOCKET_ERROR || result == 0) {
+// Handles every complete frame buffered so far.  Returns false once the connection is closing.
+bool WebSocketClient::process_frames() {
+    static const char kProtocolError[] = { 0x03, (char)0xEA }; // Close status 1002.
+    WebSocketFrameParser::Frame frame;
+    for (;;) {
+        WebSocketFrameParser::Result result = m_parser.Next(frame);
+        if (result == WebSocketFrameParser::NeedMore) {
+            return true;
+        }
+        if (result == WebSocketFrameParser::ProtocolError) {
+            send_frame(0x8, kProtocolError, sizeof(kProtocolError));
             m_connected = false;
+            return false;
+        }
+
+        switch (frame.opcode) {
+        case 0x0: // Continuation
+            if (!m_fragmentOpcode || m_fragment.size() + frame.payload.size() > WebSocketFrameParser::MaxPayload) {
+                send_frame(0x8, kProtocolError, sizeof(kProtocolError));
+                m_connected = false;
+                return false;
+            }
+            m_fragment += frame.payload;
+            break;
+        case 0x1: // Text
+        case 0x2: // Binary
+            if (m_fragmentOpcode) {
+                // A new data message can't start until the fragmented one is finished.
+                send_frame(0x8, kProtocolError, sizeof(kProtocolError));
+                m_connected = false;
+                return false;
+            }
+            m_fragment = std::move(frame.payload);
+            m_fragmentOpcode = frame.opcode;
             break;
+        case 0x8: // Close: echo the status code back and stop reading.
+            send_frame(0x8, frame.payload.data(), frame.payload.size() < 2 ? frame.payload.size() : 2);
+            m_connected = false;
+            return false;
+        case 0x9: // Ping
+            send_frame(0xA, frame.payload.data(), frame.payload.size());
+            continue;
+        default: // Pong
+            continue;
         }
-        
-        std::vector<uint8_t> data(buffer, buffer + result);
-        std::string message = websocket_frame_decode(data);
-        
-        if (!message.empty()) {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            m_messageQueue.push(message);
+
+        if (frame.fin) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_messageQueue.push({ std::move(m_fragment), m_fragmentOpcode == 0x2 });
+            }
+            m_fragment.clear();
+            m_fragmentOpcode = 0;
+            if (s_notify) {
+                mark_ready(m_handle);
+            }
         }
     }
 }
@@ -269,6 +348,17 @@ bool WebSocketClient::connect(const std::string& url) {
         return false;
     }
 
+    // Discard any partial frame or unsent batch left over from a previous connection.
+    m_parser = WebSocketFrameParser();
+    m_fragment.clear();
+    m_fragmentOpcode = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        m_sendQueue.clear();
+        m_sendOffset = 0;
+        m_sendPending = false;
+    }
+
     if (m_secure) {
         if (!connect_wss(url))
             return false;
@@ -297,11 +387,27 @@ bool WebSocketClient::connect(const std::string& url) {
     
     std::cout << "WebSocket: Handshake successful" << std::endl;
     
+    // From here on, sends must never block: they are made by the shared I/O thread as well as
+    // by script threads.
+    u_long nonBlocking = 1;
+    ioctlsocket(m_socket, FIONBIO, &nonBlocking);
+    
     m_connected = true;
     m_running = true;
     
-    // Start receive thread
-    m_thread = std::thread(&WebSocketClient::receive_loop, this);
+    // Frames that arrived along with the handshake response
+    if (!process_frames()) {
+        return true; // Already closed by the server; the queue keeps anything it sent first.
+    }
+    
+    // Incoming data is read by the shared I/O thread
+    if (!WebSocketPoller::Instance().Add(this)) {
+        m_connected = false;
+        m_running = false;
+        closesocket(m_socket);
+        m_socket = INVALID_SOCKET;
+        return false;
+    }
     
     return true;
 }
@@ -312,12 +418,20 @@ void WebSocketClient::disconnect() {
     }
     
     m_running = false;
-    m_connected = false;
     
     if (m_socket != INVALID_SOCKET) {
+        if (m_connected) {
+            // Best effort: if the peer has stopped reading, the close frame is dropped along with
+            // anything else still queued rather than holding up the caller.
+            static const char kNormalClosure[] = { 0x03, (char)0xE8 }; // Close status 1000.
+            send_frame(0x8, kNormalClosure, sizeof(kNormalClosure));
+        }
+        m_connected = false;
+        WebSocketPoller::Instance().Remove(this);
         closesocket(m_socket);
         m_socket = INVALID_SOCKET;
     }
+    m_connected = false;
     
     if (m_thread.joinable()) {
         m_thread.join();
@@ -333,7 +447,7 @@ void WebSocketClient::disconnect() {
     if (m_hSession) { WinHttpCloseHandle(m_hSession); m_hSession = nullptr; }
 }
 
-bool WebSocketClient::send_message(const std::string& message) {
+bool WebSocketClient::send_message(const std::string& message, bool flush) {
     if (!m_connected) {
         return false;
     }
@@ -342,9 +456,20 @@ bool WebSocketClient::send_message(const std::string& message) {
             (PVOID)message.data(), (DWORD)message.size());
         return hr == S_OK;
     } else {
-        std::vector<uint8_t> frame = websocket_frame_encode(message);
-        int result = send(m_socket, reinterpret_cast<const char*>(frame.data()), static_cast<int>(frame.size()), 0);
-        return result != SOCKET_ERROR;
+        return send_frame(0x1, message.data(), message.size(), flush);
+    }
+}
+
+bool WebSocketClient::send_binary(const void *data, size_t len, bool flush) {
+    if (!m_connected) {
+        return false;
+    }
+    if (m_secure && m_hWebSocket) {
+        auto hr = WinHttpWebSocketSend(m_hWebSocket, WINHTTP_WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE,
+            (PVOID)data, (DWORD)len);
+        return hr == S_OK;
+    } else {
+        return send_frame(0x2, data, len, flush);
     }
 }
 
@@ -355,11 +480,26 @@ std::string WebSocketClient::receive_message() {
         return "";
     }
     
-    std::string message = m_messageQueue.front();
+    std::string message = std::move(m_messageQueue.front().data);
     m_messageQueue.pop();
     return message;
 }
 
+bool WebSocketClient::try_receive_message(std::string& message, bool *binary) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    
+    if (m_messageQueue.empty()) {
+        return false;
+    }
+    
+    message = std::move(m_messageQueue.front().data);
+    if (binary) {
+        *binary = m_messageQueue.front().binary;
+    }
+    m_messageQueue.pop();
+    return true;
+}
+
 bool WebSocketClient::is_connected() const {
     return m_connected;
 }
@@ -426,16 +566,275 @@ bool WebSocketClient::connect_wss(const std::string& url) {
 }
 
 void WebSocketClient::receive_loop_wss() {
-    BYTE buffer[4096];
+    BYTE buffer[16384];
+    std::string msg; // WinHTTP returns messages larger than the buffer as a series of fragments.
     while (m_running && m_connected && m_hWebSocket) {
         DWORD received = 0; WINHTTP_WEB_SOCKET_BUFFER_TYPE type = WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE;
         HRESULT hr = WinHttpWebSocketReceive(m_hWebSocket, buffer, sizeof(buffer), &received, &type);
         if (hr != S_OK) { m_connected = false; break; }
         if (type == WINHTTP_WEB_SOCKET_CLOSE_BUFFER_TYPE) { m_connected = false; break; }
-        if (received) {
-            std::string msg((char*)buffer, (char*)buffer + received);
+        msg.append((char*)buffer, (char*)buffer + received);
+        if (type == WINHTTP_WEB_SOCKET_UTF8_FRAGMENT_BUFFER_TYPE || type == WINHTTP_WEB_SOCKET_BINARY_FRAGMENT_BUFFER_TYPE)
+            continue;
+        if (!msg.empty()) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_messageQueue.push({ std::move(msg), type == WINHTTP_WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE });
+            }
+            msg.clear();
+            if (s_notify) {
+                mark_ready(m_handle);
+            }
+        }
+    }
+}
+
+std::mutex WebSocketClient::s_handleMutex;
+std::unordered_map<int, std::shared_ptr<WebSocketClient>> WebSocketClient::s_handles;
+int WebSocketClient::s_nextHandle = 1;
+
+int WebSocketClient::Open(const std::string& url) {
+    auto client = std::make_shared<WebSocketClient>();
+    {
+        // Registered before connecting, since messages can arrive as soon as the handshake completes
+        // and the notifications naming this handle would otherwise be discarded by the dispatcher.
+        std::lock_guard<std::mutex> lock(s_handleMutex);
+        client->m_handle = s_nextHandle++;
+        s_handles[client->m_handle] = client;
+    }
+    if (client->connect(url))
+        return client->m_handle;
+    std::lock_guard<std::mutex> lock(s_handleMutex);
+    s_handles.erase(client->m_handle);
+    return 0;
+}
+
+std::shared_ptr<WebSocketClient> WebSocketClient::Find(int handle) {
+    std::lock_guard<std::mutex> lock(s_handleMutex);
+    auto it = s_handles.find(handle);
+    return it != s_handles.end() ? it->second : nullptr;
+}
+
+bool WebSocketClient::Close(int handle) {
+    std::shared_ptr<WebSocketClient> client;
+    {
+        std::lock_guard<std::mutex> lock(s_handleMutex);
+        auto it = s_handles.find(handle);
+        if (it == s_handles.end()) return false;
+        client = std::move(it->second);
+        s_handles.erase(it);
+    }
+    client->disconnect(); // Outside the lock, since it may wait for the I/O thread.
+    return true;
+}
+
+std::atomic<bool> WebSocketClient::s_notify(false);
+std::mutex WebSocketClient::s_readyMutex;
+std::vector<int> WebSocketClient::s_ready;
+bool WebSocketClient::s_postPending = false;
+
+void WebSocketClient::mark_ready(int handle) {
+    std::lock_guard<std::mutex> lock(s_readyMutex);
+    if (std::find(s_ready.begin(), s_ready.end(), handle) == s_ready.end()) {
+        s_ready.push_back(handle);
+    }
+    if (!s_postPending) {
+        // A burst of messages costs one post; the main thread drains every queue in one go.
+        s_postPending = true;
+        PostMessage(g_hWnd, AHK_WEBSOCKET_MESSAGE, 0, 0);
+    }
+}
+
+void WebSocketClient::SetNotify(bool enable) {
+    bool was_enabled = s_notify.exchange(enable);
+    if (!enable || was_enabled) {
+        return;
+    }
+    // Deliver anything that was queued before the callback was registered.
+    mark_ready(0);
+    std::lock_guard<std::mutex> lock(s_handleMutex);
+    for (auto &entry : s_handles) {
+        mark_ready(entry.first);
+    }
+}
+
+void WebSocketClient::PostRetrieved() {
+    std::lock_guard<std::mutex> lock(s_readyMutex);
+    s_postPending = false;
+}
+
+std::vector<int> WebSocketClient::TakeReady() {
+    std::vector<int> ready;
+    std::lock_guard<std::mutex> lock(s_readyMutex);
+    ready.swap(s_ready);
+    return ready;
+}
+
+WebSocketPoller &WebSocketPoller::Instance() {
+    // Created on first use and never destroyed, so the I/O thread can't outlive its poller.
+    static WebSocketPoller *sInstance = nullptr;
+    static std::once_flag sOnce;
+    std::call_once(sOnce, [] { sInstance = new WebSocketPoller(); });
+    return *sInstance;
+}
+
+WebSocketPoller::WebSocketPoller() : m_wakeRecv(INVALID_SOCKET), m_wakeSend(INVALID_SOCKET) {
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    int addrLen = sizeof(addr);
+    m_wakeRecv = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    m_wakeSend = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_wakeRecv == INVALID_SOCKET || m_wakeSend == INVALID_SOCKET
+        || bind(m_wakeRecv, (sockaddr*)&addr, sizeof(addr)) != 0
+        || getsockname(m_wakeRecv, (sockaddr*)&addr, &addrLen) != 0
+        || ::connect(m_wakeSend, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        return; // Without a way to interrupt WSAPoll, the I/O thread can't be run; Add() fails.
+    }
+    u_long nonBlocking = 1;
+    ioctlsocket(m_wakeRecv, FIONBIO, &nonBlocking);
+
+    m_thread = std::thread(&WebSocketPoller::Run, this);
+    m_ok = true;
+}
+
+bool WebSocketPoller::Add(WebSocketClient *client) {
+    if (!m_ok) return false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_clients.push_back(client);
+    }
+    Wake();
+    return true;
+}
+
+void WebSocketPoller::Remove(WebSocketClient *client) {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (size_t i = 0; i < m_clients.size(); ++i) {
+            if (m_clients[i] == client) { m_clients.erase(m_clients.begin() + i); break; }
+        }
+        for (size_t i = 0; i < m_flushes.size(); ++i) {
+            if (m_flushes[i].first == client) { m_flushes.erase(m_flushes.begin() + i); break; }
+        }
+        // The I/O thread only picks up clients which are still registered, so once it has
+        // finished with this one (which can't take long, since its socket never blocks), the
+        // client is never used again.
+        m_leave.wait(lock, [&] { return m_busy != client; });
+    }
+    Wake();
+}
+
+void WebSocketPoller::ScheduleFlush(WebSocketClient *client) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (std::find(m_clients.begin(), m_clients.end(), client) == m_clients.end()) {
+            return; // Disconnected; nothing will be sent anyway.
+        }
+        for (auto &flush : m_flushes) {
+            if (flush.first == client) return; // Already armed.
+        }
+        m_flushes.emplace_back(client, std::chrono::steady_clock::now() + std::chrono::milliseconds(WebSocketClient::SendBatchDelay));
+    }
+    Wake();
+}
+
+void WebSocketPoller::Wake() {
+    char b = 0;
+    send(m_wakeSend, &b, 1, 0);
+}
+
+void WebSocketPoller::Run() {
+    std::vector<WSAPOLLFD> fds;
+    std::vector<WebSocketClient *> polled;
+    for (;;) {
+        int timeout = -1;
+        fds.clear();
+        polled.clear();
+        WSAPOLLFD wake{};
+        wake.fd = m_wakeRecv; wake.events = POLLRDNORM;
+        fds.push_back(wake);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (WebSocketClient *client : m_clients) {
+                WSAPOLLFD fd{};
+                fd.fd = client->m_socket;
+                fd.events = client->m_sendPending ? POLLRDNORM | POLLWRNORM : POLLRDNORM;
+                fds.push_back(fd);
+                polled.push_back(client);
+            }
+            // Wake up in time for the earliest batched send.
+            auto now = std::chrono::steady_clock::now();
+            for (auto &flush : m_flushes) {
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(flush.second - now).count();
+                int wait = ms > 0 ? (int)ms : 0;
+                if (timeout < 0 || wait < timeout) timeout = wait;
+            }
+        }
+
+        if (WSAPoll(fds.data(), (ULONG)fds.size(), timeout) == SOCKET_ERROR) {
+            Sleep(10); // Avoid spinning if polling fails persistently.
+            continue;
+        }
+
+        if (fds[0].revents) {
+            char drain[64];
+            while (recv(m_wakeRecv, drain, sizeof(drain), 0) > 0) {}
+        }
+
+        for (size_t i = 1; i < fds.size(); ++i) {
+            if (!fds[i].revents) continue;
+            WebSocketClient *client = polled[i - 1];
+            if (!Enter(client, fds[i].fd)) continue;
+            bool open = true;
+            if (fds[i].revents & ~POLLWRNORM) // Readable, closed or failed; recv() tells which.
+                open = client->on_readable();
+            if (open && (fds[i].revents & POLLWRNORM))
+                client->flush();
+            Leave(client, !open);
+        }
+
+        std::vector<WebSocketClient *> due;
+        {
             std::lock_guard<std::mutex> lock(m_mutex);
-            m_messageQueue.push(msg);
+            auto now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < m_flushes.size(); ) {
+                if (m_flushes[i].second > now) { ++i; continue; }
+                due.push_back(m_flushes[i].first);
+                m_flushes.erase(m_flushes.begin() + i);
+            }
+        }
+        for (WebSocketClient *client : due) {
+            if (!Enter(client, INVALID_SOCKET)) continue;
+            client->flush();
+            Leave(client, false);
         }
     }
-}
\ No newline at end of file
+}
+
+bool WebSocketPoller::Enter(WebSocketClient *client, SOCKET socket) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // Skip clients removed (and possibly freed) since they were polled or scheduled.
+    if (std::find(m_clients.begin(), m_clients.end(), client) == m_clients.end()
+        || (socket != INVALID_SOCKET && client->m_socket != socket)) {
+        return false;
+    }
+    m_busy = client;
+    return true;
+}
+
+void WebSocketPoller::Leave(WebSocketClient *client, bool remove) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_busy = nullptr;
+        if (remove) {
+            auto it = std::find(m_clients.begin(), m_clients.end(), client);
+            if (it != m_clients.end()) m_clients.erase(it);
+        }
+    }
+    m_leave.notify_all();
+}
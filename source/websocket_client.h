@@ -7,19 +7,84 @@
 #include <string>
 #include <atomic>
 #include <memory>
+#include <vector>
+#include <unordered_map>
+#include <random>
+#include <cstdint>
+#include <chrono>
+#include <condition_variable>
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <winhttp.h>
+#include "websocket_frame.h"
 
 #pragma comment(lib, "ws2_32.lib")
 #pragma comment(lib, "winhttp.lib")
 
+class WebSocketClient;
+
+// Single I/O thread shared by all ws:// connections.  It waits on every registered socket at
+// once with WSAPoll and hands incoming data to the owning client, so opening more connections
+// doesn't add threads.  wss:// connections are read by WinHTTP on their own thread instead.
+// The sockets are non-blocking and clients are serviced without m_mutex held, so a peer which
+// stops reading can't stall the other connections or a script thread calling Remove.
+class WebSocketPoller {
+public:
+    static WebSocketPoller &Instance();
+
+    bool Add(WebSocketClient *client); // Returns false if the I/O thread couldn't be started.
+    // Once this returns, the I/O thread will no longer touch client.  Must not be called on the
+    // I/O thread itself.
+    void Remove(WebSocketClient *client);
+    // Has the I/O thread flush client's batched frames after SendBatchDelay.
+    void ScheduleFlush(WebSocketClient *client);
+    // Interrupts WSAPoll so that the I/O thread rebuilds its poll set, e.g. to wait for a socket
+    // to become writable.
+    void Wake();
+
+private:
+    WebSocketPoller();
+    void Run();
+    // Marks client as in use by the I/O thread, unless it was removed or its socket replaced.
+    bool Enter(WebSocketClient *client, SOCKET socket);
+    void Leave(WebSocketClient *client, bool remove);
+
+    std::mutex m_mutex;
+    std::condition_variable m_leave; // Signalled when m_busy is reset.
+    std::vector<WebSocketClient *> m_clients;
+    WebSocketClient *m_busy = nullptr; // Being serviced by the I/O thread outside m_mutex.
+    std::vector<std::pair<WebSocketClient *, std::chrono::steady_clock::time_point>> m_flushes; // Pending ScheduleFlush deadlines.
+    std::thread m_thread;
+    SOCKET m_wakeRecv; // Loopback UDP pair used to interrupt WSAPoll when m_clients changes.
+    SOCKET m_wakeSend;
+    bool m_ok = false;
+};
+
 class WebSocketClient {
 private:
+    friend class WebSocketPoller;
+
     SOCKET m_socket;
     std::thread m_thread;
     std::mutex m_mutex;
-    std::queue<std::string> m_messageQueue;
+    struct Message {
+        std::string data;
+        bool binary; // Opcode 0x2: arbitrary bytes rather than UTF-8 text.
+    };
+    std::queue<Message> m_messageQueue;
+    // Outgoing frames are masked straight into m_sendQueue and written with non-blocking send()
+    // calls under m_sendMutex, so concurrent senders never interleave frames and a batch goes out
+    // in one send().  Whatever the socket won't take yet is left queued and sent by the I/O thread
+    // once the socket becomes writable.
+    std::mutex m_sendMutex;
+    std::vector<uint8_t> m_sendQueue; // Frames not yet handed to send(); guarded by m_sendMutex.
+    size_t m_sendOffset = 0; // Bytes at the front of m_sendQueue already sent; guarded by m_sendMutex.
+    std::atomic<bool> m_sendPending; // Waiting for the socket to become writable.
+    std::mt19937 m_maskGen; // Guarded by m_sendMutex.
+    WebSocketFrameParser m_parser; // Only used by the I/O thread once connected.
+    std::string m_fragment; // Data message being reassembled from continuation frames.
+    uint8_t m_fragmentOpcode = 0; // Opcode of m_fragment, or 0 if none is in progress.
+    int m_handle = 0; // 0 for g_WebSocketClient, otherwise the handle returned by Open.
     std::atomic<bool> m_connected;
     std::atomic<bool> m_running;
     std::string m_url;
@@ -37,11 +102,15 @@ private:
     bool parse_url(const std::string& url);
     bool resolve_and_connect();
     bool perform_handshake();
+    bool process_frames();
+    // Queues a frame.  Unless flush is false, it and anything queued before it are sent at once.
+    bool send_frame(uint8_t opcode, const void *data, size_t len, bool flush = true);
+    void append_frame(uint8_t opcode, const void *data, size_t len);
     std::string create_handshake_request();
     std::string base64_encode(const std::string& input);
-    void receive_loop();
-    std::string websocket_frame_decode(const std::vector<uint8_t>& data);
-    std::vector<uint8_t> websocket_frame_encode(const std::string& message);
+    // Called on the poller's I/O thread when the socket is readable.  Returns false once the
+    // connection has been closed by the peer, after which the client is unregistered.
+    bool on_readable();
 
     // WSS (WinHTTP) path
     bool connect_wss(const std::string& url);
@@ -53,9 +122,43 @@ public:
     
     bool connect(const std::string& url);
     void disconnect();
-    bool send_message(const std::string& message);
+    bool send_message(const std::string& message, bool flush = true);
+    bool send_binary(const void *data, size_t len, bool flush = true);
+    bool flush();
+
+    // Batched (flush = false) frames are sent once this much is queued, or after SendBatchDelay.
+    static const size_t SendBatchMax = 64 * 1024;
+    // Frames are refused while this much is waiting for the peer to read it.
+    static const size_t SendQueueMax = 16 * 1024 * 1024;
+    static const int SendBatchDelay = 5; // Milliseconds.
     std::string receive_message();
+    // Unlike receive_message, distinguishes an empty message from none, and text from binary.
+    bool try_receive_message(std::string& message, bool *binary = nullptr);
     bool is_connected() const;
+    int handle() const { return m_handle; }
+
+    // Posting of AHK_WEBSOCKET_MESSAGE for WebSocketOnMessage.  Arrivals are coalesced: at most one
+    // post is outstanding, and TakeReady returns every connection that has received messages since.
+    static void SetNotify(bool enable);
+    static void PostRetrieved();
+    static std::vector<int> TakeReady();
+
+    // Connections opened by WebSocketOpen, each with its own receive queue.  Handle 0 is
+    // reserved for g_WebSocketClient, the connection used by WebSocketConnect.
+    static int Open(const std::string& url); // Returns 0 on failure.
+    static std::shared_ptr<WebSocketClient> Find(int handle);
+    static bool Close(int handle);
+
+private:
+    static std::mutex s_handleMutex;
+    static std::unordered_map<int, std::shared_ptr<WebSocketClient>> s_handles;
+    static int s_nextHandle;
+
+    static std::atomic<bool> s_notify;
+    static std::mutex s_readyMutex;
+    static std::vector<int> s_ready; // Handles with unread messages, guarded by s_readyMutex.
+    static bool s_postPending;
+    static void mark_ready(int handle);
 };
 
 // Global WebSocket client instance
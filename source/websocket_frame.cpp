@@ -0,0 +1,92 @@
+// This file doesn't use the precompiled header, since it must not depend on Windows.
+#include "websocket_frame.h"
+#include <cstring>
+
+void websocket_mask(uint8_t *dst, const uint8_t *src, size_t len, const uint8_t key[4]) {
+    // memcpy keeps the loads and stores alignment-safe; compilers turn it into plain moves.
+    uint32_t key32;
+    memcpy(&key32, key, 4);
+    uint64_t key64 = ((uint64_t)key32 << 32) | key32;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, src + i, 8);
+        word ^= key64;
+        memcpy(dst + i, &word, 8);
+    }
+    for (; i < len; ++i) {
+        dst[i] = src[i] ^ key[i & 3]; // i is a multiple of 8 on entry, so the key stays in phase.
+    }
+}
+
+void WebSocketFrameParser::Feed(const char *data, size_t len) {
+    if (m_begin && m_begin >= m_buf.size() / 2) {
+        m_buf.erase(m_buf.begin(), m_buf.begin() + m_begin);
+        m_begin = 0;
+    }
+    m_buf.insert(m_buf.end(), reinterpret_cast<const uint8_t*>(data), reinterpret_cast<const uint8_t*>(data) + len);
+}
+
+WebSocketFrameParser::Result WebSocketFrameParser::Next(Frame &frame) {
+    size_t avail = m_buf.size() - m_begin;
+    if (avail < 2) {
+        return NeedMore;
+    }
+    const uint8_t *p = m_buf.data() + m_begin;
+
+    if (p[0] & 0x70) {
+        return ProtocolError; // RSV bits require a negotiated extension.
+    }
+    frame.fin = (p[0] & 0x80) != 0;
+    frame.opcode = p[0] & 0x0F;
+    bool masked = (p[1] & 0x80) != 0;
+    uint64_t payload_len = p[1] & 0x7F;
+    size_t header_len = 2;
+
+    if (payload_len == 126) {
+        if (avail < 4) return NeedMore;
+        payload_len = ((uint64_t)p[2] << 8) | p[3];
+        header_len = 4;
+    } else if (payload_len == 127) {
+        if (avail < 10) return NeedMore;
+        payload_len = 0;
+        for (int i = 2; i < 10; ++i) {
+            payload_len = (payload_len << 8) | p[i];
+        }
+        header_len = 10;
+    }
+
+    switch (frame.opcode) {
+    case 0x0: case 0x1: case 0x2: // Continuation, text, binary.
+        break;
+    case 0x8: case 0x9: case 0xA: // Close, ping, pong.
+        if (!frame.fin || payload_len > 125) return ProtocolError; // Control frames can't be fragmented.
+        break;
+    default:
+        return ProtocolError;
+    }
+    if (payload_len > MaxPayload) {
+        return ProtocolError;
+    }
+
+    if (masked) {
+        header_len += 4; // Masking key
+    }
+    if (avail < header_len + payload_len) {
+        return NeedMore;
+    }
+
+    const uint8_t *payload = p + header_len;
+    frame.payload.assign(reinterpret_cast<const char*>(payload), (size_t)payload_len);
+    if (masked && payload_len) {
+        uint8_t *unmasked = reinterpret_cast<uint8_t*>(&frame.payload[0]);
+        websocket_mask(unmasked, unmasked, (size_t)payload_len, payload - 4);
+    }
+
+    m_begin += header_len + (size_t)payload_len;
+    if (m_begin == m_buf.size()) {
+        m_buf.clear();
+        m_begin = 0;
+    }
+    return Complete;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// RFC 6455 framing shared by the WebSocket client.  This has no Windows or Winsock dependency,
+// so that it can also be built on its own (see benchmarks/websocket_parser_bench.cpp).
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Incremental RFC 6455 frame parser.  Bytes are fed in whatever pieces recv() returns them and
+// complete frames are taken off the front, so frames split across reads or coalesced into one
+// read are handled alike.  Consumed space at the front of the buffer is reclaimed lazily, once
+// it makes up half the buffer, so each byte is moved at most a constant number of times.
+class WebSocketFrameParser {
+public:
+    enum Result { NeedMore, Complete, ProtocolError };
+    struct Frame {
+        bool fin;
+        uint8_t opcode;
+        std::string payload; // Already unmasked.
+    };
+    // Larger frames (and reassembled messages) are rejected rather than buffered.
+    static const uint64_t MaxPayload = 64 * 1024 * 1024;
+
+    void Feed(const char *data, size_t len);
+    Result Next(Frame &frame);
+
+private:
+    std::vector<uint8_t> m_buf;
+    size_t m_begin = 0; // Offset of the first unparsed byte in m_buf.
+};
+
+// Writes src XOR the 4-byte masking key to dst, a machine word at a time.  dst may equal src.
+void websocket_mask(uint8_t *dst, const uint8_t *src, size_t len, const uint8_t key[4]);